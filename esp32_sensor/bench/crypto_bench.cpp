@@ -0,0 +1,320 @@
+// Throughput and latency of the sensor's crypto primitives on the build
+// machine, against the system mbedtls through the host shim:
+//
+//   pio run -e native_bench && .pio/build/native_bench/program [iterations]
+//
+// or without PlatformIO, from esp32_sensor/:
+//
+//   g++ -O2 -Ihost -Iinclude -o crypto_bench bench/crypto_bench.cpp
+//       src/ecdsa.cpp src/ecdh-aes.cpp src/session-channel.cpp src/crypto-random-engine.cpp
+//       -lmbedcrypto -lcrypto
+//
+// The firmware functions run on crypto_backend, mbedtls unless built with
+// -D CRYPTO_BACKEND=CRYPTO_BACKEND_HOST. The symmetric primitives are also
+// timed on every backend this machine has, as "<backend>.<primitive>".
+//
+// Prints one JSON object on stdout, latencies in microseconds. The default
+// iteration counts can be replaced by one count for every benchmark.
+
+#include <Arduino.h>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#include "ecdsa.h"
+#include "ecdh-aes.h"
+#include "crypto-backend.h"
+#include "crypto-backend-host.h"
+#include "crypto-backend-mbedtls.h"
+#include "crypto-random-engine.h"
+#include "session-channel.h"
+#include "mbedtls/version.h"
+
+#define MAX_ITERATIONS 100000
+
+const size_t ECC_ITERATIONS = 200;
+const size_t SYMMETRIC_ITERATIONS = 20000;
+// About a check-in's worth of plaintext
+const size_t PAYLOAD_LEN = 64;
+
+static uint64_t samples[MAX_ITERATIONS];
+static size_t iterations_override;
+static bool first_result = true;
+
+static uint64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// nearest-rank percentile of the sorted samples
+static double percentile_us(size_t count, int percent)
+{
+    size_t rank = (count * percent + 99) / 100;
+    if (rank == 0)
+        rank = 1;
+    return samples[rank - 1] / 1000.0;
+}
+
+static void report(const char *name, size_t count, uint64_t total_ns)
+{
+    std::sort(samples, samples + count);
+    printf("%s\n    {\"name\":\"%s\",\"iterations\":%zu,\"ops_per_sec\":%.1f,"
+           "\"p50_us\":%.3f,\"p90_us\":%.3f,\"p99_us\":%.3f,\"max_us\":%.3f}",
+           first_result ? "" : ",", name, count, count * 1e9 / total_ns,
+           percentile_us(count, 50), percentile_us(count, 90), percentile_us(count, 99),
+           samples[count - 1] / 1000.0);
+    first_result = false;
+}
+
+// Time op one call at a time, after a few untimed calls to warm the caches
+template <typename Op>
+static void run(const char *name, size_t iterations, Op op)
+{
+    if (iterations_override > 0)
+        iterations = iterations_override;
+
+    for (int i = 0; i < 3; i++)
+        op();
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        uint64_t start = now_ns();
+        op();
+        samples[i] = now_ns() - start;
+        total += samples[i];
+    }
+    report(name, iterations, total);
+}
+
+static const char *backend_run_name(const char *backend, const char *primitive)
+{
+    static char name[48];
+    snprintf(name, sizeof(name), "%s.%s", backend, primitive);
+    return name;
+}
+
+// What the handlers call per check-in, on one backend
+template <typename Backend>
+static void run_backend(const uint8_t message[], size_t message_len,
+                        const uint8_t key[], const uint8_t plaintext[])
+{
+    run(backend_run_name(Backend::name, "sha256"), SYMMETRIC_ITERATIONS, [&] {
+        uint8_t hash[32];
+        Backend::sha256(message, message_len, hash);
+    });
+    run(backend_run_name(Backend::name, "hmac_sha256"), SYMMETRIC_ITERATIONS, [&] {
+        uint8_t mac[32];
+        hmac_sha256<Backend>(key, 32, message, message_len, mac);
+    });
+    run(backend_run_name(Backend::name, "hkdf_sha256"), SYMMETRIC_ITERATIONS, [&] {
+        uint8_t okm[32];
+        const uint8_t info[] = "handshake data";
+        hkdf_sha256_with<Backend>(nullptr, 0, key, 32, info, sizeof(info) - 1, okm, 32);
+    });
+
+    // Keyed once like a resume ticket key, so this is the per message cost
+    typename Backend::gcm_context gcm;
+    Backend::gcm_init(gcm);
+    Backend::gcm_setkey(gcm, key);
+    uint8_t nonce[12] = {0};
+    uint8_t ciphertext[PAYLOAD_LEN];
+    uint8_t tag[16];
+    Backend::gcm_seal(gcm, nonce, nullptr, 0, plaintext, PAYLOAD_LEN, ciphertext, tag);
+    run(backend_run_name(Backend::name, "gcm_seal"), SYMMETRIC_ITERATIONS, [&] {
+        uint8_t out[PAYLOAD_LEN], out_tag[16];
+        Backend::gcm_seal(gcm, nonce, nullptr, 0, plaintext, PAYLOAD_LEN, out, out_tag);
+    });
+    run(backend_run_name(Backend::name, "gcm_open"), SYMMETRIC_ITERATIONS, [&] {
+        uint8_t out[PAYLOAD_LEN];
+        if (Backend::gcm_open(gcm, nonce, nullptr, 0, ciphertext, PAYLOAD_LEN, tag, out) != 0)
+            abort();
+    });
+    Backend::gcm_free(gcm);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+    {
+        iterations_override = strtoul(argv[1], nullptr, 10);
+        if (iterations_override == 0 || iterations_override > MAX_ITERATIONS)
+        {
+            fprintf(stderr, "usage: %s [iterations, 1..%d]\n", argv[0], MAX_ITERATIONS);
+            return 1;
+        }
+    }
+
+    init_crypto_random_engine();
+
+    // Fixed inputs shaped like the real protocol messages
+    uint8_t message[142];
+    for (size_t i = 0; i < sizeof(message); i++)
+        message[i] = i;
+
+    mbedtls_ecdsa_context signer;
+    gen_signature_key(signer);
+    uint8_t signer_pub[POINT_LEN];
+    size_t signer_pub_len;
+    get_public_bytes(signer, signer_pub, signer_pub_len);
+
+    // Decompressing must give back the same point
+    uint8_t signer_pub_compressed[POINT_LEN];
+    size_t signer_pub_compressed_len;
+    get_public_bytes(signer, signer_pub_compressed, signer_pub_compressed_len, true);
+    mbedtls_ecp_point decompressed;
+    mbedtls_ecp_point_init(&decompressed);
+    if (read_point(signer_pub_compressed, signer_pub_compressed_len, decompressed) != 0 ||
+        mbedtls_ecp_point_cmp(&decompressed, &signer.Q) != 0)
+        return 1;
+    mbedtls_ecp_point_free(&decompressed);
+
+    uint8_t signature[MBEDTLS_ECDSA_MAX_LEN];
+    size_t signature_len;
+    sign(signer, message, sizeof(message), signature, signature_len);
+
+    // The signer doubles as the CA, a cert is 90 bytes
+    trust_anchor anchor;
+    if (load_trust_anchor(anchor, signer_pub) != 0)
+        return 1;
+    uint8_t cert_signature[MBEDTLS_ECDSA_MAX_LEN];
+    size_t cert_signature_len;
+    sign(signer, message, 90, cert_signature, cert_signature_len);
+
+    mbedtls_ecdh_context ours, peer;
+    gen_key(ours);
+    gen_key(peer);
+    uint8_t peer_pub[65];
+    size_t peer_pub_len;
+    get_public_bytes(peer, peer_pub, peer_pub_len);
+
+    uint8_t shared_secret[32];
+    uint8_t shared_key[32];
+    if (get_shared_secret(ours, peer_pub, shared_secret) != 0)
+        return 1;
+    get_shared_key(shared_secret, shared_key);
+
+    uint8_t plaintext[PAYLOAD_LEN] = {0};
+    uint8_t ciphertext[PAYLOAD_LEN];
+    uint8_t nonce[12];
+    uint8_t tag[16];
+    encrypt(shared_key, plaintext, PAYLOAD_LEN, nonce, ciphertext, tag);
+
+    printf("{\"benchmark\":\"crypto\",\"mbedtls\":\"%s\",\"backend\":\"%s\",\"results\":[",
+           MBEDTLS_VERSION_STRING, crypto_backend::name);
+
+    run("gen_signature_key", ECC_ITERATIONS, [] {
+        mbedtls_ecdsa_context ctx;
+        gen_signature_key(ctx);
+        mbedtls_ecdsa_free(&ctx);
+    });
+    run("sign", ECC_ITERATIONS, [&] {
+        uint8_t out[MBEDTLS_ECDSA_MAX_LEN];
+        size_t out_len;
+        sign(signer, message, sizeof(message), out, out_len);
+    });
+    run("verify", ECC_ITERATIONS, [&] {
+        if (verify(message, sizeof(message), signer_pub, signature, signature_len) != 0)
+            abort();
+    });
+    run("verify_compressed", ECC_ITERATIONS, [&] {
+        if (verify(message, sizeof(message), signer_pub_compressed, signature, signature_len) != 0)
+            abort();
+    });
+    run("read_point", SYMMETRIC_ITERATIONS, [&] {
+        mbedtls_ecp_point P;
+        mbedtls_ecp_point_init(&P);
+        if (read_point(signer_pub, signer_pub_len, P) != 0)
+            abort();
+        mbedtls_ecp_point_free(&P);
+    });
+    run("read_point_compressed", SYMMETRIC_ITERATIONS, [&] {
+        mbedtls_ecp_point P;
+        mbedtls_ecp_point_init(&P);
+        if (read_point(signer_pub_compressed, signer_pub_compressed_len, P) != 0)
+            abort();
+        mbedtls_ecp_point_free(&P);
+    });
+    run("verify_trust_anchor", ECC_ITERATIONS, [&] {
+        if (verify(anchor, message, 90, cert_signature, cert_signature_len) != 0)
+            abort();
+    });
+    // A burst of certs, one after the other and as one batch
+    verify_item burst[VERIFY_BATCH_MAX];
+    for (int i = 0; i < VERIFY_BATCH_MAX; i++)
+        burst[i] = {message, 90, nullptr, cert_signature, cert_signature_len};
+    run("verify_trust_anchor_x8", ECC_ITERATIONS / VERIFY_BATCH_MAX, [&] {
+        for (int i = 0; i < VERIFY_BATCH_MAX; i++)
+        {
+            if (verify(anchor, message, 90, cert_signature, cert_signature_len) != 0)
+                abort();
+        }
+    });
+    run("verify_batch_x8", ECC_ITERATIONS / VERIFY_BATCH_MAX, [&] {
+        int results[VERIFY_BATCH_MAX];
+        if (verify_batch(anchor, burst, VERIFY_BATCH_MAX, results) != 0)
+            abort();
+    });
+    run("gen_key", ECC_ITERATIONS, [] {
+        mbedtls_ecdh_context ctx;
+        gen_key(ctx);
+        mbedtls_ecdh_free(&ctx);
+    });
+    run("get_shared_secret", ECC_ITERATIONS, [&] {
+        uint8_t secret[32];
+        if (get_shared_secret(ours, peer_pub, secret) != 0)
+            abort();
+    });
+    run("hkdf_sha256", SYMMETRIC_ITERATIONS, [&] {
+        uint8_t key[32];
+        const uint8_t info[] = "handshake data";
+        hkdf_sha256(nullptr, 0, shared_secret, 32, info, sizeof(info) - 1, key, 32);
+    });
+    run("encrypt", SYMMETRIC_ITERATIONS, [&] {
+        uint8_t out_nonce[12], out[PAYLOAD_LEN], out_tag[16];
+        encrypt(shared_key, plaintext, PAYLOAD_LEN, out_nonce, out, out_tag);
+    });
+    run("decrypt", SYMMETRIC_ITERATIONS, [&] {
+        uint8_t out[PAYLOAD_LEN];
+        decrypt(shared_key, nonce, ciphertext, tag, out, PAYLOAD_LEN);
+    });
+
+    // The same payload over a session channel, keyed once up front
+    uint8_t channel_keys[CHANNEL_KEYS_LEN];
+    const uint8_t channel_info[] = "channel";
+    hkdf_sha256(nullptr, 0, shared_secret, 32, channel_info, sizeof(channel_info) - 1,
+                channel_keys, CHANNEL_KEYS_LEN);
+    session_channel phone, sensor;
+    init_session_channel(phone);
+    init_session_channel(sensor);
+    open_session_channel(phone, channel_keys, false);
+    open_session_channel(sensor, channel_keys, true);
+    run("channel_seal", SYMMETRIC_ITERATIONS, [&] {
+        uint8_t message[PAYLOAD_LEN + CHANNEL_OVERHEAD];
+        if (channel_seal(sensor, nullptr, 0, plaintext, PAYLOAD_LEN, message) == 0)
+            abort();
+    });
+    // Sealed ahead in order, so every open is a fresh message; run() adds
+    // three warm-up calls
+    const size_t message_len = PAYLOAD_LEN + CHANNEL_OVERHEAD;
+    size_t messages = (iterations_override > 0 ? iterations_override : SYMMETRIC_ITERATIONS) + 3;
+    std::vector<uint8_t> sealed(messages * message_len);
+    for (size_t i = 0; i < messages; i++)
+        channel_seal(phone, nullptr, 0, plaintext, PAYLOAD_LEN, &sealed[i * message_len]);
+    size_t opened = 0;
+    run("channel_open", SYMMETRIC_ITERATIONS, [&] {
+        uint8_t out[PAYLOAD_LEN];
+        if (channel_open(sensor, nullptr, 0, &sealed[opened++ * message_len], message_len, out) != 0)
+            abort();
+    });
+    close_session_channel(phone);
+    close_session_channel(sensor);
+    run_backend<mbedtls_backend>(message, sizeof(message), shared_key, plaintext);
+    run_backend<host_backend>(message, sizeof(message), shared_key, plaintext);
+
+    printf("\n]}\n");
+    return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Just enough of the Arduino core to build the sensor's transport-level
+// modules on Linux, see host/README
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+inline unsigned long millis()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+inline void delay(unsigned long ms)
+{
+    timespec ts = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000};
+    nanosleep(&ts, nullptr);
+}
+
+// A 240 MHz cycle counter from the monotonic clock, for src/metrics.cpp
+inline uint32_t getCpuFrequencyMhz()
+{
+    return 240;
+}
+
+struct host_esp
+{
+    uint32_t getCycleCount()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint32_t)((uint64_t)ts.tv_sec * 240000000 + (uint64_t)ts.tv_nsec * 240 / 1000);
+    }
+};
+inline host_esp ESP;
+
+// Serial goes to stderr so a program's stdout stays machine readable
+struct host_serial
+{
+    __attribute__((format(printf, 2, 3))) int printf(const char *format, ...)
+    {
+        va_list args;
+        va_start(args, format);
+        int n = vfprintf(stderr, format, args);
+        va_end(args);
+        return n;
+    }
+    size_t print(const char *text) { return fputs(text, stderr) < 0 ? 0 : strlen(text); }
+    size_t println(const char *text = "") { return print(text) + print("\n"); }
+    size_t write(const uint8_t *data, size_t len) { return fwrite(data, 1, len, stderr); }
+};
+inline host_serial Serial;
+
+inline long random(long low, long high)
+{
+    return low + rand() % (high - low);
+}
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+// WiFiServer and WiFiClient over POSIX sockets, with the non-blocking
+// behaviour of the ESP32 versions: available() never waits and a client
+// object is a cheap handle that only stop() closes
+
+#include "Arduino.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+class WiFiClient
+{
+public:
+    WiFiClient() : fd(-1) {}
+    explicit WiFiClient(int fd) : fd(fd) {}
+
+    explicit operator bool() const { return fd >= 0; }
+
+    int available()
+    {
+        int n = 0;
+        if (fd < 0 || ioctl(fd, FIONREAD, &n) < 0)
+            return 0;
+        return n;
+    }
+
+    uint8_t connected()
+    {
+        if (fd < 0)
+            return 0;
+        char c;
+        ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n > 0)
+            return 1;
+        if (n == 0)
+            return 0;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    int read(uint8_t *buf, size_t size)
+    {
+        ssize_t n = recv(fd, buf, size, MSG_DONTWAIT);
+        return n < 0 ? -1 : (int)n;
+    }
+
+    // blocks like the ESP32 one until everything is queued
+    size_t write(const uint8_t *buf, size_t size)
+    {
+        size_t sent = 0;
+        while (fd >= 0 && sent < size)
+        {
+            ssize_t n = send(fd, buf + sent, size - sent, MSG_NOSIGNAL);
+            if (n > 0)
+                sent += n;
+            else if (n < 0 && errno == EAGAIN)
+            {
+                pollfd p = {fd, POLLOUT, 0};
+                poll(&p, 1, 100);
+            }
+            else
+                break;
+        }
+        return sent;
+    }
+
+    int setNoDelay(bool nodelay)
+    {
+        int flag = nodelay;
+        return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+
+    // IPv4 of the peer in network byte order, like the ESP32 IPAddress
+    // converts to; 0 if unknown
+    uint32_t remoteIP()
+    {
+        sockaddr_in addr = {};
+        socklen_t len = sizeof(addr);
+        if (fd < 0 || getpeername(fd, (sockaddr *)&addr, &len) != 0 || addr.sin_family != AF_INET)
+            return 0;
+        return addr.sin_addr.s_addr;
+    }
+
+    void stop()
+    {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+
+private:
+    int fd;
+};
+
+class WiFiServer
+{
+public:
+    WiFiServer(uint16_t port = 80) : port(port), fd(-1) {}
+
+    void begin(uint16_t listen_port = 0)
+    {
+        if (listen_port != 0)
+            port = listen_port;
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        bind(fd, (sockaddr *)&addr, sizeof(addr));
+        listen(fd, 16);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+    }
+
+    void setNoDelay(bool nodelay) { no_delay = nodelay; }
+
+    bool hasClient()
+    {
+        pollfd p = {fd, POLLIN, 0};
+        return fd >= 0 && poll(&p, 1, 0) > 0;
+    }
+
+    WiFiClient available()
+    {
+        int client = accept(fd, nullptr, nullptr);
+        if (client < 0)
+            return WiFiClient();
+        WiFiClient c(client);
+        c.setNoDelay(no_delay);
+        return c;
+    }
+
+private:
+    uint16_t port;
+    int fd;
+    bool no_delay = false;
+};
+
+#endif
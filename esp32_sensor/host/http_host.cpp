@@ -0,0 +1,81 @@
+// The sensor's HTTP front end on Linux, for poking at it with curl or a
+// load generator without flashing a board:
+//
+//   g++ -O2 -Ihost -Iinclude host/http_host.cpp src/http-server.cpp -o http_host
+//   ./http_host 8080
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "http-server.h"
+
+http_server server;
+
+// Stands in for /handshake and /authenticate: echoes the body back after
+// CRYPTO_DELAY_MS, the reply deferred the way the firmware waits for its
+// crypto task
+const unsigned long CRYPTO_DELAY_MS = 20;
+
+struct pending_echo
+{
+    bool used;
+    http_ticket ticket;
+    unsigned long ready_at;
+    char body[HTTP_REQUEST_MAX];
+    size_t body_len;
+};
+pending_echo pending[HTTP_MAX_CONNECTIONS];
+
+void handle_echo()
+{
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+    {
+        if (pending[i].used)
+            continue;
+        pending[i].used = true;
+        pending[i].ready_at = millis() + CRYPTO_DELAY_MS;
+        memcpy(pending[i].body, server.body, server.body_len);
+        pending[i].body_len = server.body_len;
+        pending[i].ticket = http_defer(server);
+        return;
+    }
+    http_send(server, 503, "text/plain", "Busy");
+}
+
+void reply_ready_echoes(unsigned long now)
+{
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+    {
+        if (!pending[i].used || (long)(now - pending[i].ready_at) < 0)
+            continue;
+        http_reply(server, pending[i].ticket, 200, "application/json", pending[i].body, pending[i].body_len);
+        pending[i].used = false;
+    }
+}
+
+void handle_stats()
+{
+    char data[256];
+    snprintf(data, sizeof(data),
+             "{\"open\":%u,\"accepted\":%u,\"requests\":%u,\"reused\":%u,\"timed_out\":%u,\"rejected\":%u,\"evicted\":%u}",
+             http_open_connections(server), server.accepted, server.requests, server.reused,
+             server.timed_out, server.rejected, server.evicted);
+    http_send(server, 200, "application/json", data);
+}
+
+int main(int argc, char **argv)
+{
+    uint16_t port = argc > 1 ? atoi(argv[1]) : 8080;
+
+    http_on(server, "/handshake", HTTP_METHOD_POST, handle_echo);
+    http_on(server, "/authenticate", HTTP_METHOD_POST, handle_echo);
+    http_on(server, "/stats", HTTP_METHOD_GET, handle_stats);
+    http_begin(server, port);
+    printf("listening on %u\n", port);
+
+    for (;;)
+    {
+        http_poll(server, millis());
+        reply_ready_echoes(millis());
+        delay(1);
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+
+// Token buckets in front of the requests that cost a CA verify and a sign
+// (/handshake, /checkin), checked before the body is even parsed. Each
+// client IP gets its own bucket so one phone posting junk cannot use up the
+// others' share; a global bucket holds the total near what the crypto core
+// can sustain; and a cap on in-flight jobs keeps pipeline slots free for the
+// /authenticate of handshakes already under way.
+#define ADMISSION_CLIENTS 16
+
+// A phone needs one /handshake (or one /checkin) per check-in, retries
+// included a burst of 3 is plenty. Load tests from one machine look like a
+// single client and build with these raised, e.g. -D CLIENT_RATE_PER_S=1000.
+#ifndef CLIENT_BURST
+#define CLIENT_BURST 3
+#endif
+#ifndef CLIENT_RATE_PER_S
+#define CLIENT_RATE_PER_S 1
+#endif
+#define GLOBAL_BURST 16
+#define GLOBAL_RATE_PER_S 12
+// Of CRYPTO_PIPELINE_DEPTH jobs
+#define ADMISSION_MAX_IN_FLIGHT 6
+
+struct token_bucket
+{
+    uint32_t milli_tokens;
+    unsigned long refilled_at; // millis()
+};
+
+struct admission_client
+{
+    uint32_t ip; // 0 for a free slot
+    unsigned long last_seen;
+    token_bucket bucket;
+};
+
+struct admission_control
+{
+    admission_client clients[ADMISSION_CLIENTS];
+    token_bucket global;
+
+    uint32_t admitted;
+    uint32_t shed_client; // 429, that client is over its rate
+    uint32_t shed_global; // 503, everyone together is
+    uint32_t shed_busy;   // 503, too many handshakes in flight
+};
+
+enum admission_verdict : uint8_t
+{
+    ADMIT,
+    SHED_CLIENT,
+    SHED_GLOBAL,
+    SHED_BUSY,
+};
+
+void init_admission(admission_control &ac, unsigned long now);
+
+// Take a token from ip's bucket and the global one if both have one and
+// fewer than ADMISSION_MAX_IN_FLIGHT jobs are running; a shed request takes
+// nothing. The least recently seen client is forgotten for a new one.
+admission_verdict admit_request(admission_control &ac, uint32_t ip, uint32_t in_flight,
+                                unsigned long now);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef CERT_CACHE_H
+#define CERT_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ecdsa.h"
+
+#define CERT_CACHE_SIZE 32
+
+// A cert whose CA signature already verified, keyed by
+// SHA-256(cert_bytes || signature)
+struct cert_cache_entry
+{
+    uint8_t digest[32];
+    uint8_t cert[CERT_MAX_LEN];
+    uint8_t signature_len;
+    uint32_t valid_until; // epoch seconds, 0 if it could not be parsed
+    uint32_t last_used;   // cache tick of the last hit, for LRU eviction
+    bool used;
+};
+
+struct cert_cache
+{
+    cert_cache_entry entries[CERT_CACHE_SIZE];
+    uint32_t tick;
+
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t ref_hits;
+    uint32_t bytes_saved; // hex characters phones did not have to send
+};
+
+void cert_digest(const uint8_t cert[],
+                 const uint8_t signature[],
+                 size_t signature_len,
+                 uint8_t digest[]);
+
+// return true and copy the cert bytes out if the digest is cached and not
+// expired. now is epoch seconds, 0 when the clock is not synced in which
+// case expiry cannot be checked and entries stay valid.
+bool lookup_cert(cert_cache &cache,
+                 const uint8_t digest[],
+                 uint32_t now,
+                 uint8_t cert[]);
+
+// same as lookup_cert, for a phone that only sent the digest; also counts
+// the bytes it saved by not sending the full cert
+bool lookup_cert_ref(cert_cache &cache,
+                     const uint8_t digest[],
+                     uint32_t now,
+                     uint8_t cert[]);
+
+// remember a verified cert, evicting the least recently used entry if full
+void insert_cert(cert_cache &cache,
+                 const uint8_t digest[],
+                 const uint8_t cert[],
+                 size_t signature_len,
+                 uint32_t valid_until);
+
+#endif
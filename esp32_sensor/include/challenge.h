@@ -0,0 +1,87 @@
+#ifndef CHALLENGE_H
+#define CHALLENGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mbedtls/ecdh.h"
+
+// A signed nonce and ephemeral key published at GET /challenge, so a phone
+// can sign its session before it reaches the door and check in with a single
+// POST /checkin. The sensor signs
+//
+//   challenge_bytes = nonce[12] || s_pub[65]
+//
+// and the phone answers with a signature over session_bytes(nonce, c_pub,
+// s_pub), exactly like /authenticate does with s_nonce. s_pub is always
+// uncompressed, one signature serves phones of either point format.
+//
+// A new challenge replaces the current one every CHALLENGE_ROTATE_MS; the
+// previous one is still accepted until the next rotation, so a phone that
+// fetched it just before a rotation has at least that long to use it.
+#define CHALLENGE_ROTATE_MS 20000UL
+// Oldest challenge accepted, also when rotating stalled because the crypto
+// core was busy
+#define CHALLENGE_MAX_AGE_MS (2 * CHALLENGE_ROTATE_MS)
+// Check-ins remembered per challenge to refuse replays within its window
+#define CHALLENGE_SEEN_SLOTS 96
+
+struct challenge
+{
+    bool ready;
+    uint8_t nonce[12];
+    uint8_t pub[65];
+    uint8_t signature[80];
+    size_t signature_len;
+    unsigned long issued_at; // millis()
+    mbedtls_ecdh_context ecdh;
+
+    // first bytes of the client session keys admitted under this challenge
+    uint8_t seen[CHALLENGE_SEEN_SLOTS][8];
+    uint8_t seen_count;
+};
+
+struct challenge_board
+{
+    challenge slots[2]; // current and previous
+    uint8_t current;
+    bool rotating; // the crypto core is signing the next one
+
+    uint32_t published;
+    uint32_t answered;
+    uint32_t unknown;  // check-ins naming a challenge that is gone or never was
+    uint32_t replayed; // includes check-ins refused with the seen slots full
+};
+
+void init_challenges(challenge_board &board);
+
+void challenge_bytes(const uint8_t nonce[], const uint8_t pub[], uint8_t out[]);
+
+// return true if a new challenge should be signed now; the caller submits
+// the job and sets board.rotating until it is published
+bool challenge_due(const challenge_board &board, unsigned long now);
+
+// make a signed challenge current and retire the previous one. The board
+// takes over ecdh, which is left freshly initialised.
+void publish_challenge(challenge_board &board,
+                       const uint8_t nonce[],
+                       mbedtls_ecdh_context &ecdh,
+                       const uint8_t pub[],
+                       const uint8_t signature[], size_t signature_len,
+                       unsigned long now);
+
+// return the current challenge, nullptr if none was published yet
+challenge *current_challenge(challenge_board &board, unsigned long now);
+
+// return the current or previous challenge with this nonce, nullptr if
+// there is none or it is too old
+challenge *find_challenge(challenge_board &board, const uint8_t nonce[], unsigned long now);
+
+// return true if a check-in with this client session key was already
+// admitted under c
+bool challenge_seen(const challenge &c, const uint8_t session[]);
+
+// remember an admitted check-in, return false if it was seen before or
+// there is no room left to remember it
+bool mark_challenge_seen(challenge &c, const uint8_t session[]);
+
+#endif
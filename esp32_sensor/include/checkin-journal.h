@@ -0,0 +1,38 @@
+#ifndef CHECKIN_JOURNAL_H
+#define CHECKIN_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "checkin-queue.h"
+
+// Records in the ring, the file is preallocated to hold exactly this many
+#define JOURNAL_CAPACITY 512
+// Most events handed out by one journal_peek()
+#define JOURNAL_BATCH 16
+
+struct journal_stats
+{
+    uint32_t appended;
+    uint32_t replayed;
+    uint32_t corrupt;     // records skipped because their CRC did not match
+    uint32_t overwritten; // undelivered records lost to the ring wrapping
+};
+
+extern journal_stats journal_counters;
+
+// Open or create the journal on SPIFFS and find the undelivered tail,
+// return false if the file cannot be used
+bool open_journal();
+
+// Append a check-in that could not be delivered, return false on flash error
+bool journal_append(const checkin_event &event);
+
+// Copy up to max_events undelivered check-ins out, oldest first
+size_t journal_peek(checkin_event events[], size_t max_events);
+
+// Mark the first count events of the last journal_peek() as delivered
+void journal_commit(size_t count);
+
+uint32_t journal_pending();
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef CHECKIN_QUEUE_H
+#define CHECKIN_QUEUE_H
+
+#include <Arduino.h>
+#include "revocation-list.h"
+#include "employee-directory.h"
+
+#define CHECKIN_QUEUE_DEPTH 32
+// Most check-ins sent in one request to the central server
+#define CHECKIN_BATCH_MAX 16
+
+struct checkin_event
+{
+    char cert_id[7];
+    uint32_t timestamp; // wall clock seconds, 0 if the clock is not synced
+};
+
+struct checkin_verdict
+{
+    char cert_id[7];
+    bool accepted;
+};
+
+struct checkin_stats
+{
+    uint32_t requests;
+    uint32_t accepted;
+    uint32_t rejected;
+    uint32_t retries;
+    uint32_t dropped;        // neither delivered nor journaled, or refused on replay
+    uint32_t retried_events; // the server failed to record them, journaled again
+    uint32_t unknown;        // applied, but the server's verdict was unreadable
+};
+
+extern checkin_stats checkin_counters;
+
+// Start the task that forwards check-ins to http://<server_ip>/checkin/batch,
+// grouping whatever arrives within a short window into one request.
+// Check-ins the uplink cannot take go to the flash journal and are
+// replayed once it answers again. The same task keeps the revocation list
+// and the employee directory in step with http://<server_ip>/revoked and
+// /directory.
+void start_checkin_worker(const String &server_ip);
+
+// return false if the queue is full and the event was dropped
+bool enqueue_checkin(const char cert_id[], uint32_t timestamp);
+
+// return true and fill verdict once the central server answered a check-in
+bool poll_checkin_verdict(checkin_verdict &verdict);
+
+uint32_t checkin_queue_depth();
+
+// return true and fill list once a newer revocation list was fetched
+bool poll_revocations(revocation_list &list);
+
+// return true and fill dir once a newer directory was fetched
+bool poll_directory(employee_directory &dir);
+
+#endif
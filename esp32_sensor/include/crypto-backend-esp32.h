@@ -0,0 +1,115 @@
+#ifndef CRYPTO_BACKEND_ESP32_H
+#define CRYPTO_BACKEND_ESP32_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_system.h>
+#include "mbedtls/sha256.h"
+#include "mbedtls/gcm.h"
+#include "aes/esp_aes_gcm.h"
+#include "sha/sha_parallel_engine.h"
+
+// The ESP32's SHA and AES engines and its hardware RNG. GCM goes straight to
+// the esp_aes_gcm port, one-shot hashes take the SHA engine for the whole
+// message. Streaming hashes stay on mbedtls_sha256, which the core already
+// builds on the SHA engine.
+struct esp32_backend
+{
+    static constexpr const char *name = "esp32";
+
+    typedef mbedtls_sha256_context sha256_context;
+    typedef esp_gcm_context gcm_context;
+
+    static void sha256(const uint8_t *in, size_t len, uint8_t out[])
+    {
+        esp_sha(SHA2_256, in, len, out);
+    }
+
+    static void sha256_start(sha256_context &ctx)
+    {
+        mbedtls_sha256_init(&ctx);
+        mbedtls_sha256_starts_ret(&ctx, 0);
+    }
+
+    static void sha256_update(sha256_context &ctx, const uint8_t *in, size_t len)
+    {
+        mbedtls_sha256_update_ret(&ctx, in, len);
+    }
+
+    static void sha256_finish(sha256_context &ctx, uint8_t out[])
+    {
+        mbedtls_sha256_finish_ret(&ctx, out);
+        mbedtls_sha256_free(&ctx);
+    }
+
+    static void gcm_init(gcm_context &ctx)
+    {
+        esp_aes_gcm_init(&ctx);
+    }
+
+    static int gcm_setkey(gcm_context &ctx, const uint8_t key[])
+    {
+        return esp_aes_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, key, 256);
+    }
+
+    static void gcm_free(gcm_context &ctx)
+    {
+        esp_aes_gcm_free(&ctx);
+    }
+
+    static int gcm_seal(gcm_context &ctx, const uint8_t iv[],
+                        const uint8_t *aad, size_t aad_len,
+                        const uint8_t *in, size_t len,
+                        uint8_t *out, uint8_t tag[])
+    {
+        return esp_aes_gcm_crypt_and_tag(&ctx, MBEDTLS_GCM_ENCRYPT, len, iv, 12,
+                                         aad, aad_len, in, out, 16, tag);
+    }
+
+    static int gcm_open(gcm_context &ctx, const uint8_t iv[],
+                        const uint8_t *aad, size_t aad_len,
+                        const uint8_t *in, size_t len,
+                        const uint8_t tag[], uint8_t *out)
+    {
+        return esp_aes_gcm_auth_decrypt(&ctx, len, iv, 12, aad, aad_len, tag, 16, in, out);
+    }
+
+    // Streaming, for payloads that do not sit in one buffer. Every chunk but
+    // the last must be a multiple of 16 bytes. gcm_finish_open returns 0 if
+    // the tag matched; until then the plaintext is unauthenticated.
+    static int gcm_start(gcm_context &ctx, bool seal, const uint8_t iv[],
+                         const uint8_t *aad, size_t aad_len)
+    {
+        return esp_aes_gcm_starts(&ctx, seal ? MBEDTLS_GCM_ENCRYPT : MBEDTLS_GCM_DECRYPT, iv, 12, aad, aad_len);
+    }
+
+    static int gcm_update(gcm_context &ctx, const uint8_t *in, size_t len, uint8_t *out)
+    {
+        return esp_aes_gcm_update(&ctx, len, in, out);
+    }
+
+    static int gcm_finish_seal(gcm_context &ctx, uint8_t tag[])
+    {
+        return esp_aes_gcm_finish(&ctx, tag, 16);
+    }
+
+    static int gcm_finish_open(gcm_context &ctx, const uint8_t tag[])
+    {
+        uint8_t expected[16];
+        int ret = esp_aes_gcm_finish(&ctx, expected, 16);
+        if (ret != 0)
+            return ret;
+        uint8_t diff = 0;
+        for (int i = 0; i < 16; i++)
+            diff |= expected[i] ^ tag[i];
+        return diff == 0 ? 0 : -1;
+    }
+
+    // Safe from either core
+    static void fill_random(uint8_t *out, size_t len)
+    {
+        esp_fill_random(out, len);
+    }
+};
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef CRYPTO_BACKEND_HOST_H
+#define CRYPTO_BACKEND_HOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+// Linux builds (bench, host shim) through OpenSSL's libcrypto, which picks
+// AES-NI, SHA-NI or the ARMv8 crypto extensions at run time. Link with
+// -lcrypto.
+struct host_backend
+{
+    static constexpr const char *name = "openssl";
+
+    struct sha256_context
+    {
+        EVP_MD_CTX *md;
+    };
+
+    struct gcm_context
+    {
+        EVP_CIPHER_CTX *cipher; // keyed once, the IV is set per message
+    };
+
+    static void sha256(const uint8_t *in, size_t len, uint8_t out[])
+    {
+        SHA256(in, len, out);
+    }
+
+    static void sha256_start(sha256_context &ctx)
+    {
+        ctx.md = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(ctx.md, EVP_sha256(), nullptr);
+    }
+
+    static void sha256_update(sha256_context &ctx, const uint8_t *in, size_t len)
+    {
+        EVP_DigestUpdate(ctx.md, in, len);
+    }
+
+    static void sha256_finish(sha256_context &ctx, uint8_t out[])
+    {
+        EVP_DigestFinal_ex(ctx.md, out, nullptr);
+        EVP_MD_CTX_free(ctx.md);
+        ctx.md = nullptr;
+    }
+
+    static void gcm_init(gcm_context &ctx)
+    {
+        ctx.cipher = EVP_CIPHER_CTX_new();
+    }
+
+    static int gcm_setkey(gcm_context &ctx, const uint8_t key[])
+    {
+        return EVP_CipherInit_ex(ctx.cipher, EVP_aes_256_gcm(), nullptr, key, nullptr, 1) == 1 ? 0 : -1;
+    }
+
+    static void gcm_free(gcm_context &ctx)
+    {
+        EVP_CIPHER_CTX_free(ctx.cipher);
+        ctx.cipher = nullptr;
+    }
+
+    static int gcm_seal(gcm_context &ctx, const uint8_t iv[],
+                        const uint8_t *aad, size_t aad_len,
+                        const uint8_t *in, size_t len,
+                        uint8_t *out, uint8_t tag[])
+    {
+        int n;
+        if (EVP_CipherInit_ex(ctx.cipher, nullptr, nullptr, nullptr, iv, 1) != 1 ||
+            (aad_len > 0 && EVP_CipherUpdate(ctx.cipher, nullptr, &n, aad, aad_len) != 1) ||
+            EVP_CipherUpdate(ctx.cipher, out, &n, in, len) != 1 ||
+            EVP_CipherFinal_ex(ctx.cipher, out + n, &n) != 1 ||
+            EVP_CIPHER_CTX_ctrl(ctx.cipher, EVP_CTRL_GCM_GET_TAG, 16, tag) != 1)
+            return -1;
+        return 0;
+    }
+
+    static int gcm_open(gcm_context &ctx, const uint8_t iv[],
+                        const uint8_t *aad, size_t aad_len,
+                        const uint8_t *in, size_t len,
+                        const uint8_t tag[], uint8_t *out)
+    {
+        int n;
+        if (EVP_CipherInit_ex(ctx.cipher, nullptr, nullptr, nullptr, iv, 0) != 1 ||
+            (aad_len > 0 && EVP_CipherUpdate(ctx.cipher, nullptr, &n, aad, aad_len) != 1) ||
+            EVP_CipherUpdate(ctx.cipher, out, &n, in, len) != 1 ||
+            EVP_CIPHER_CTX_ctrl(ctx.cipher, EVP_CTRL_GCM_SET_TAG, 16, (void *)tag) != 1 ||
+            EVP_CipherFinal_ex(ctx.cipher, out + n, &n) != 1)
+            return -1;
+        return 0;
+    }
+
+    static int gcm_start(gcm_context &ctx, bool seal, const uint8_t iv[],
+                         const uint8_t *aad, size_t aad_len)
+    {
+        int n;
+        if (EVP_CipherInit_ex(ctx.cipher, nullptr, nullptr, nullptr, iv, seal ? 1 : 0) != 1 ||
+            (aad_len > 0 && EVP_CipherUpdate(ctx.cipher, nullptr, &n, aad, aad_len) != 1))
+            return -1;
+        return 0;
+    }
+
+    // Any chunk size, libcrypto buffers nothing for GCM
+    static int gcm_update(gcm_context &ctx, const uint8_t *in, size_t len, uint8_t *out)
+    {
+        int n;
+        return EVP_CipherUpdate(ctx.cipher, out, &n, in, len) == 1 ? 0 : -1;
+    }
+
+    static int gcm_finish_seal(gcm_context &ctx, uint8_t tag[])
+    {
+        uint8_t last[16];
+        int n;
+        if (EVP_CipherFinal_ex(ctx.cipher, last, &n) != 1 ||
+            EVP_CIPHER_CTX_ctrl(ctx.cipher, EVP_CTRL_GCM_GET_TAG, 16, tag) != 1)
+            return -1;
+        return 0;
+    }
+
+    static int gcm_finish_open(gcm_context &ctx, const uint8_t tag[])
+    {
+        uint8_t last[16];
+        int n;
+        if (EVP_CIPHER_CTX_ctrl(ctx.cipher, EVP_CTRL_GCM_SET_TAG, 16, (void *)tag) != 1 ||
+            EVP_CipherFinal_ex(ctx.cipher, last, &n) != 1)
+            return -1;
+        return 0;
+    }
+
+    static void fill_random(uint8_t *out, size_t len)
+    {
+        RAND_bytes(out, len);
+    }
+};
+
+#endif
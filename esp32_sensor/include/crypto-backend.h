@@ -0,0 +1,153 @@
+#ifndef CRYPTO_BACKEND_H
+#define CRYPTO_BACKEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Hashing, AES-256-GCM and random bytes behind one backend picked at compile
+// time. A backend is a struct of static functions and context types, so
+// callers inline straight into the library calls:
+//
+//   sha256(in, len, out)                       one-shot, out[32]
+//   sha256_start/update/finish(ctx, ...)       finish also frees ctx
+//   gcm_init/setkey/free(ctx, key[32])         key once, many messages
+//   gcm_seal(ctx, iv[12], aad, in, out, tag[16])     return 0 if sealed
+//   gcm_open(ctx, iv[12], aad, in, tag[16], out)     return 0 if the tag matched
+//   gcm_start/update/finish_seal/finish_open(ctx, ...) the same in pieces
+//   fill_random(out, len)
+//
+// crypto_backend is the one the firmware code uses. Anything templated on a
+// backend (hmac_sha256, hkdf_sha256_with) can also be run with another one,
+// which is how bench/crypto_bench.cpp compares them. The curve arithmetic
+// stays on mbedtls everywhere, the ESP32 has no accelerator for it.
+#define CRYPTO_BACKEND_MBEDTLS 1 // portable software, crypto-backend-mbedtls.h
+#define CRYPTO_BACKEND_ESP32 2   // SHA/AES engines and RNG, crypto-backend-esp32.h
+#define CRYPTO_BACKEND_HOST 3    // OpenSSL on Linux, crypto-backend-host.h
+
+// -D CRYPTO_BACKEND=CRYPTO_BACKEND_... overrides the default for the target
+#ifndef CRYPTO_BACKEND
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP_PLATFORM)
+#define CRYPTO_BACKEND CRYPTO_BACKEND_ESP32
+#else
+#define CRYPTO_BACKEND CRYPTO_BACKEND_MBEDTLS
+#endif
+#endif
+
+#if CRYPTO_BACKEND == CRYPTO_BACKEND_ESP32
+#include "crypto-backend-esp32.h"
+typedef esp32_backend crypto_backend;
+#elif CRYPTO_BACKEND == CRYPTO_BACKEND_HOST
+#include "crypto-backend-host.h"
+typedef host_backend crypto_backend;
+#elif CRYPTO_BACKEND == CRYPTO_BACKEND_MBEDTLS
+#include "crypto-backend-mbedtls.h"
+typedef mbedtls_backend crypto_backend;
+#else
+#error "unknown CRYPTO_BACKEND"
+#endif
+
+// HMAC-SHA256 (RFC 2104) over the backend's SHA-256
+template <typename Backend>
+struct hmac_sha256_context
+{
+    typename Backend::sha256_context sha;
+    uint8_t pad[64]; // key ^ opad, for the outer hash
+};
+
+template <typename Backend>
+void hmac_sha256_start(hmac_sha256_context<Backend> &ctx, const uint8_t *key, size_t key_len)
+{
+    uint8_t block[64] = {0};
+    if (key_len > 64)
+        Backend::sha256(key, key_len, block);
+    else if (key_len > 0)
+        memcpy(block, key, key_len);
+
+    for (int i = 0; i < 64; i++)
+    {
+        ctx.pad[i] = block[i] ^ 0x5c;
+        block[i] ^= 0x36;
+    }
+    Backend::sha256_start(ctx.sha);
+    Backend::sha256_update(ctx.sha, block, 64);
+}
+
+template <typename Backend>
+void hmac_sha256_update(hmac_sha256_context<Backend> &ctx, const uint8_t *in, size_t len)
+{
+    Backend::sha256_update(ctx.sha, in, len);
+}
+
+template <typename Backend>
+void hmac_sha256_finish(hmac_sha256_context<Backend> &ctx, uint8_t out[])
+{
+    uint8_t inner[32];
+    Backend::sha256_finish(ctx.sha, inner);
+    Backend::sha256_start(ctx.sha);
+    Backend::sha256_update(ctx.sha, ctx.pad, 64);
+    Backend::sha256_update(ctx.sha, inner, 32);
+    Backend::sha256_finish(ctx.sha, out);
+}
+
+template <typename Backend>
+void hmac_sha256(const uint8_t *key, size_t key_len, const uint8_t *in, size_t len, uint8_t out[])
+{
+    hmac_sha256_context<Backend> ctx;
+    hmac_sha256_start(ctx, key, key_len);
+    hmac_sha256_update(ctx, in, len);
+    hmac_sha256_finish(ctx, out);
+}
+
+// RFC 5869 with SHA-256 in its two steps, so one secret can be extracted
+// once and expanded for several uses. An empty salt is 32 zero bytes (the
+// same HMAC key).
+template <typename Backend>
+void hkdf_sha256_extract(const uint8_t *salt, size_t salt_len,
+                         const uint8_t *ikm, size_t ikm_len,
+                         uint8_t prk[])
+{
+    hmac_sha256<Backend>(salt, salt_len, ikm, ikm_len, prk);
+}
+
+// return 0 if okm_len is at most 255 * 32
+template <typename Backend>
+int hkdf_sha256_expand(const uint8_t prk[],
+                       const uint8_t *info, size_t info_len,
+                       uint8_t *okm, size_t okm_len)
+{
+    if (okm_len > 255 * 32)
+        return -1;
+
+    uint8_t t[32];
+    size_t done = 0;
+    for (uint8_t counter = 1; done < okm_len; counter++)
+    {
+        hmac_sha256_context<Backend> ctx;
+        hmac_sha256_start(ctx, prk, 32);
+        if (counter > 1)
+            hmac_sha256_update(ctx, t, 32);
+        hmac_sha256_update(ctx, info, info_len);
+        hmac_sha256_update(ctx, &counter, 1);
+        hmac_sha256_finish(ctx, t);
+
+        size_t copy_len = okm_len - done > 32 ? 32 : okm_len - done;
+        memcpy(okm + done, t, copy_len);
+        done += copy_len;
+    }
+    return 0;
+}
+
+// Extract and expand in one, return 0 if okm_len is at most 255 * 32
+template <typename Backend>
+int hkdf_sha256_with(const uint8_t *salt, size_t salt_len,
+                     const uint8_t *ikm, size_t ikm_len,
+                     const uint8_t *info, size_t info_len,
+                     uint8_t *okm, size_t okm_len)
+{
+    uint8_t prk[32];
+    hkdf_sha256_extract<Backend>(salt, salt_len, ikm, ikm_len, prk);
+    return hkdf_sha256_expand<Backend>(prk, info, info_len, okm, okm_len);
+}
+
+#endif
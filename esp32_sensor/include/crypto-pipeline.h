@@ -0,0 +1,87 @@
+#ifndef CRYPTO_PIPELINE_H
+#define CRYPTO_PIPELINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mbedtls/ecdh.h"
+#include "ecdsa.h"
+#include "key-pool.h"
+#include "http-server.h"
+
+// Jobs in flight at once, a power of two
+#define CRYPTO_PIPELINE_DEPTH 8
+
+enum crypto_job_kind : uint8_t
+{
+    CRYPTO_HANDSHAKE,    // verify the cert if needed, take a key pair, sign
+    CRYPTO_AUTHENTICATE, // verify the session signature, derive the resumption secret
+    CRYPTO_CHALLENGE,    // take a key pair, sign the challenge for GET /challenge
+    CRYPTO_CHECKIN,      // a handshake's cert check and an authenticate in one
+};
+
+// Everything one request needs from the crypto core, filled in by the loop
+// task and handed over whole. The crypto task only touches the job, the CA
+// anchor, the signing key and the key pool.
+struct crypto_job
+{
+    crypto_job_kind kind;
+    http_ticket ticket;
+    bool binary; // the request came in the wire codec, so does the reply
+    int status;  // 0 if every signature checked out
+
+    // handshake, the cert half of checkin
+    bool verify_cert;  // false when the cert cache already vouched for it
+    bool cert_batched; // verify_cert done in a batch, cert_status has the verdict
+    int cert_status;
+    uint8_t cert[CERT_MAX_LEN];
+    uint8_t digest[32];
+    uint32_t valid_until;
+    uint8_t cert_signature[80];
+    size_t cert_signature_len;
+    uint8_t c_nonce[12];
+    uint8_t client_session[POINT_LEN]; // session_pub follows its format
+    mbedtls_ecdh_context ecdh; // out: the session key pair; in for authenticate
+    uint8_t session_pub[POINT_LEN]; // out, also for challenge
+    uint8_t session_signature[80]; // out, also for challenge
+    size_t session_signature_len;
+
+    // authenticate, the session half of checkin
+    uint8_t id[6];
+    uint8_t s_nonce[12]; // to tell if the session was replaced meanwhile; the challenge nonce
+    uint8_t client_pub[POINT_LEN];
+    uint8_t session_message[SESSION_MAX_LEN];
+    size_t session_message_len;
+    uint8_t signature[80];
+    size_t signature_len;
+    uint8_t resumption_secret[32]; // out, HKDF of the ECDH secret, see resume-ticket.h
+};
+
+struct crypto_pipeline_stats
+{
+    uint32_t submitted;
+    uint32_t completed;
+    uint32_t busy; // requests turned away because every job was in flight
+    uint32_t batches;      // cert checks of queued jobs verified together
+    uint32_t batched_certs;
+};
+
+extern crypto_pipeline_stats crypto_counters;
+
+// Start the crypto task on core 0. It owns the key pool from now on and
+// refills it whenever no job has arrived for a while.
+void start_crypto_pipeline(trust_anchor &ca, mbedtls_ecdsa_context *signer, key_pool &keys);
+
+// return a free job, nullptr if all are in flight or the pipeline is not
+// running; loop task only
+crypto_job *crypto_job_alloc();
+
+void crypto_submit(crypto_job *job);
+
+// return the next finished job, nullptr if there is none; loop task only
+crypto_job *crypto_poll();
+
+void crypto_job_free(crypto_job *job);
+
+uint32_t crypto_jobs_in_flight();
+
+#endif
@@ -3,11 +3,17 @@
 
 #include "mbedtls/ctr_drbg.h"
 #include "mbedtls/entropy.h"
+#include "mbedtls/ecp.h"
 
 extern mbedtls_entropy_context entropy;
 extern mbedtls_ctr_drbg_context ctr_drbg;
 
+// Shared secp256r1 group, loaded once at boot and treated as read-only
+// afterwards. Every keygen, sign and verify path uses it instead of loading
+// the curve into a throwaway context.
+extern mbedtls_ecp_group p256_group;
+
 void init_crypto_random_engine();
 
 
-#endif
\ No newline at end of file
+#endif
@@ -3,15 +3,25 @@
 
 #include "mbedtls/ecdh.h"
 
+// RFC 5869 with SHA-256, return 0 if successfull
+int hkdf_sha256(const uint8_t *salt, size_t salt_len,
+                const uint8_t *ikm, size_t ikm_len,
+                const uint8_t *info, size_t info_len,
+                uint8_t *okm, size_t okm_len);
+
+// ctx.grp is left empty, every operation runs on p256_group
 void gen_key(mbedtls_ecdh_context &ctx);
 
+// compressed asks for the 33 byte form, see POINT_LEN in ecdsa.h
 void get_public_bytes(mbedtls_ecdh_context &ctx,
                       uint8_t pub_key[],
-                      size_t &pub_key_len);
+                      size_t &pub_key_len,
+                      bool compressed = false);
 
-// return 0 if the public bytes is valid and get shared secret successfully
+// return 0 if the public bytes is valid and get shared secret successfully,
+// peer_pub_bytes in either format
 int get_shared_secret(mbedtls_ecdh_context &ctx,
-                      uint8_t peer_pub_bytes[],
+                      const uint8_t peer_pub_bytes[],
                       uint8_t shared_secret[]);
 
 void get_shared_key(const uint8_t shared_secret[], uint8_t shared_key[]);
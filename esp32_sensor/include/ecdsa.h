@@ -4,6 +4,28 @@
 #include "mbedtls/ecdsa.h"
 #include "mbedtls/pk.h"
 
+// SEC1 encodings of a P-256 point: 0x04 x y, or 0x02/0x03 x with the parity
+// of y. Every key in a cert or a session carries its own format this way, so
+// phones that only know uncompressed keys keep working unchanged.
+#define POINT_LEN 65
+#define COMPRESSED_POINT_LEN 33
+// id[6] pub valid_until[19]
+#define CERT_MAX_LEN (6 + POINT_LEN + 19)
+// nonce[12] c_pub s_pub
+#define SESSION_MAX_LEN (12 + 2 * POINT_LEN)
+
+// return the length of the point starting with prefix, 0 if prefix is not
+// a point format
+size_t point_len(uint8_t prefix);
+
+// return the length of a cert from its embedded key
+size_t cert_len(const uint8_t cert[]);
+
+// Decode a point in either format, decompressing if needed. Return 0 if it
+// is a valid public key; len must match the prefix.
+int read_point(const uint8_t bytes[], size_t len, mbedtls_ecp_point &P);
+
+// ctx.grp is left empty, every operation runs on p256_group
 void gen_signature_key(mbedtls_ecdsa_context &ctx);
 
 // return 0 if succesfull
@@ -15,17 +37,20 @@ int export_private_key(const mbedtls_ecdsa_context &ctx,
                        uint8_t pem_buf[],
                        size_t pem_buf_size);
 
-void get_public_bytes(mbedtls_ecdsa_context &ctx, uint8_t pub_key[], size_t &pub_key_len);
+void get_public_bytes(mbedtls_ecdsa_context &ctx, uint8_t pub_key[], size_t &pub_key_len,
+                      bool compressed = false);
 
-void cert_bytes(const uint8_t id[],
-                const uint8_t public_bytes[],
-                const uint8_t valid_until[],
-                uint8_t cert_bytes[]);
+// public_bytes in either format, return the cert length
+size_t cert_bytes(const uint8_t id[],
+                  const uint8_t public_bytes[],
+                  const uint8_t valid_until[],
+                  uint8_t cert_bytes[]);
 
-void session_bytes(const uint8_t nonce[],
-                   const uint8_t c_pub_bytes[],
-                   const uint8_t s_pub_bytes[],
-                   uint8_t session_bytes[]);
+// keys in either format, return the length of session_bytes
+size_t session_bytes(const uint8_t nonce[],
+                     const uint8_t c_pub_bytes[],
+                     const uint8_t s_pub_bytes[],
+                     uint8_t session_bytes[]);
 
 void sign(mbedtls_ecdsa_context &ctx,
           const uint8_t message[],
@@ -33,11 +58,51 @@ void sign(mbedtls_ecdsa_context &ctx,
           uint8_t signature[],
           size_t &signature_len);
 
-// Return 0 if the signature is valid
+// Return 0 if the signature is valid, peer_pub_bytes in either format
 int verify(const uint8_t message[],
            size_t message_len,
-           uint8_t peer_pub_bytes[],
+           const uint8_t peer_pub_bytes[],
            const uint8_t signature[],
            size_t signature_len);
 
+// CA public key decoded and validated once at boot. grp is secp256r1 with
+// its generator replaced by the CA key, so mbedtls builds and caches a
+// fixed-base comb table for Q_CA exactly like it does for G.
+struct trust_anchor
+{
+    mbedtls_ecp_group grp;
+    uint8_t pub_bytes[POINT_LEN];
+    bool loaded;
+};
+
+// return 0 if the CA public bytes are a valid point in either format
+int load_trust_anchor(trust_anchor &anchor, const uint8_t ca_pub_bytes[]);
+
+// Return 0 if the signature is valid, computes u1*G + u2*Q_CA from the
+// precomputed tables of both points
+int verify(trust_anchor &anchor,
+           const uint8_t message[],
+           size_t message_len,
+           const uint8_t signature[],
+           size_t signature_len);
+
+// One signature of a batch; pub_bytes in either format, nullptr for the CA
+struct verify_item
+{
+    const uint8_t *message;
+    size_t message_len;
+    const uint8_t *pub_bytes;
+    const uint8_t *signature;
+    size_t signature_len;
+};
+
+#define VERIFY_BATCH_MAX 8
+
+// Verify count signatures sharing one inversion mod n per VERIFY_BATCH_MAX
+// of them. mbedtls_ecp_mul still normalizes u1*G and u2*Q (an inversion
+// mod p each); only the normalization of their sum is skipped, r is
+// compared in Jacobian coordinates. results[i] is 0 if items[i] is valid, a
+// bad signature never spoils the others; return 0 if all are valid.
+int verify_batch(trust_anchor &anchor, const verify_item items[], size_t count, int results[]);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,68 @@
+#ifndef EMPLOYEE_DIRECTORY_H
+#define EMPLOYEE_DIRECTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Active cert ids and the employee each belongs to, mirrored from the
+// central server so a check-in can be judged the moment the phone is
+// authenticated. The server stays the authority: its verdict still comes
+// back through the checkin task and overrides ours if they disagree.
+#define DIRECTORY_MAX 256
+// Employee ids past this are looked up fine but their presence is not kept
+#define PRESENCE_MAX_EMPLOYEE 2048
+
+struct directory_entry
+{
+    uint8_t id[6];
+    uint16_t employee; // EmployeeID on the central server, never 0
+};
+
+struct employee_directory
+{
+    directory_entry entries[DIRECTORY_MAX]; // sorted by id
+    uint16_t count;
+    uint32_t version; // the central server's
+    bool loaded;      // false until the first snapshot
+};
+
+// Who already checked in today here, one bit per employee id
+struct presence_map
+{
+    uint32_t day; // UTC days since epoch, 0 while the clock is not synced
+    uint8_t bits[PRESENCE_MAX_EMPLOYEE / 8];
+};
+
+struct directory_stats
+{
+    uint32_t snapshots; // full directories fetched
+    uint32_t deltas;    // changes applied on top of one
+    uint32_t accepted;  // check-ins we lit blue without waiting
+    uint32_t refused;   // check-ins we lit red without waiting
+    uint32_t repeats;   // accepted ones whose employee was already in today
+    uint32_t overruled; // central verdicts that disagreed with ours
+    uint32_t overflows; // syncs that did not fit in DIRECTORY_MAX
+};
+
+extern directory_stats directory_counters;
+
+// empty directory, not loaded
+void clear_directory(employee_directory &dir);
+
+// add id or move it to another employee, return false if the directory is full
+bool put_employee(employee_directory &dir, const uint8_t id[], uint16_t employee);
+
+void remove_employee(employee_directory &dir, const uint8_t id[]);
+
+// return the employee of an active cert id, 0 if there is none
+uint16_t find_employee(const employee_directory &dir, const uint8_t id[]);
+
+void clear_presence(presence_map &presence);
+
+// return true if employee already checked in today, and mark them in.
+// now is epoch seconds; a new day starts with nobody in.
+bool mark_present(presence_map &presence, uint16_t employee, uint32_t now);
+
+uint32_t present_count(const presence_map &presence);
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <WiFi.h>
+
+// lwIP on the ESP32 has 10 sockets in total, the uplink and the listener
+// need theirs
+#define HTTP_MAX_CONNECTIONS 6
+#define HTTP_MAX_ROUTES 8
+// Request line, headers and body together; a full /handshake is about 600
+#define HTTP_REQUEST_MAX 2048
+// Header and body go out in one write when they fit
+#define HTTP_RESPONSE_MAX 1536
+
+// A request must arrive completely within this long of its first byte
+#define HTTP_READ_TIMEOUT_MS 2000
+// A kept-alive connection with no request in flight is closed after this
+#define HTTP_IDLE_TIMEOUT_MS 5000
+// When every slot is taken, a kept-alive connection idle for longer than
+// this is closed for a new client; about the time a phone may need between
+// /handshake and /authenticate
+#define HTTP_EVICT_IDLE_MS 1000
+// Requests on one connection before it is closed anyway
+#define HTTP_MAX_REQUESTS_PER_CONNECTION 16
+
+enum http_method : uint8_t
+{
+    HTTP_METHOD_GET,
+    HTTP_METHOD_POST,
+    HTTP_METHOD_OTHER,
+};
+
+struct http_connection
+{
+    WiFiClient client;
+    uint32_t remote_ip; // IPv4 of the client, as lwIP stores it
+    bool open;
+    char buf[HTTP_REQUEST_MAX + 1]; // +1 so the body can be nul terminated
+    size_t len;
+    size_t header_len;     // 0 until the blank line after the headers arrived
+    size_t content_length;
+    http_method method;
+    const char *path; // nul terminated, inside buf
+    const char *content_type; // "" if the request had none
+    const char *accept;       // "" if the request had none
+    bool keep_alive;
+    unsigned long request_started; // millis() of the first byte, when len > 0
+    unsigned long idle_since;
+    uint16_t served;
+    uint16_t generation; // bumped per accepted client, see http_ticket
+    bool deferred;       // handler returned without replying
+    int8_t route;        // index of the route serving the request, -1 if none
+};
+
+// A request whose handler deferred the reply. The slot may be reused by
+// another client before the reply is ready, the generation tells them apart.
+struct http_ticket
+{
+    uint8_t slot;
+    uint16_t generation;
+};
+
+typedef void (*http_handler)();
+
+struct http_route
+{
+    const char *path;
+    http_method method;
+    http_handler handler;
+
+    uint32_t requests;
+    uint32_t errors; // replies other than 2xx
+};
+
+// Non-blocking server that multiplexes a few keep-alive connections from
+// loop(). Handlers run one at a time and answer the current request with
+// http_send().
+struct http_server
+{
+    WiFiServer listener;
+    http_connection conns[HTTP_MAX_CONNECTIONS];
+    http_route routes[HTTP_MAX_ROUTES];
+    size_t route_count;
+
+    // the request being handled, only valid inside a handler
+    http_connection *current;
+    http_method method;
+    const char *content_type;
+    const char *accept;
+    uint32_t remote_ip;
+    char *body; // nul terminated, handlers may parse it in place
+    size_t body_len;
+    bool replied;
+    unsigned long now; // as passed to the last http_poll()
+
+    char tx[HTTP_RESPONSE_MAX];
+
+    uint32_t accepted;
+    uint32_t requests;
+    uint32_t reused;    // requests served on an already used connection
+    uint32_t timed_out; // connections closed by a read deadline
+    uint32_t rejected;  // malformed or oversized requests
+    uint32_t evicted;   // idle connections closed to make room
+};
+
+// start listening; routes may be added before or after
+void http_begin(http_server &server, uint16_t port);
+
+// register handler for path (query strings are ignored); a request with
+// another method on a known path gets 405
+void http_on(http_server &server, const char *path, http_method method, http_handler handler);
+
+// accept, read and dispatch whatever is ready without blocking, at most one
+// request per connection per call; call it every loop()
+void http_poll(http_server &server, unsigned long now);
+
+// answer the current request, only the first reply of a handler is sent
+void http_send(http_server &server, int code, const char *content_type, const char *body, size_t body_len);
+void http_send(http_server &server, int code, const char *content_type, const char *body);
+
+// Keep the current request open after its handler returns. The connection
+// reads nothing more until http_reply() answers it.
+http_ticket http_defer(http_server &server);
+
+// answer a deferred request, return false if its client is already gone
+bool http_reply(http_server &server, const http_ticket &ticket, int code,
+                const char *content_type, const char *body, size_t body_len);
+
+uint32_t http_open_connections(const http_server &server);
+
+#endif
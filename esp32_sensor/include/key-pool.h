@@ -0,0 +1,28 @@
+#ifndef KEY_POOL_H
+#define KEY_POOL_H
+
+#include <stdint.h>
+#include "mbedtls/ecdh.h"
+
+#define KEY_POOL_SIZE 8
+
+// Ephemeral ECDH key pairs generated ahead of time, handed out in a ring
+struct key_pool
+{
+    mbedtls_ecdh_context keys[KEY_POOL_SIZE];
+    uint8_t head; // next key to hand out
+    uint8_t depth;
+
+    uint32_t hits;
+    uint32_t misses;
+};
+
+void init_key_pool(key_pool &pool);
+
+// generate one key pair if the pool is not full, return true if it did
+bool refill_key_pool(key_pool &pool);
+
+// move a ready key pair into ctx, or generate one inline if the pool is empty
+void take_key(key_pool &pool, mbedtls_ecdh_context &ctx);
+
+#endif
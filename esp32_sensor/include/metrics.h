@@ -0,0 +1,44 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include "text-buffer.h"
+
+// Steps of a check-in that are timed, each one recorded by a single task
+enum metric_phase : uint8_t
+{
+    PHASE_PARSE,          // loop task, decoding a /handshake or /authenticate body
+    PHASE_CERT_VERIFY,    // crypto task
+    PHASE_ECDH_KEYGEN,    // crypto task, taking a key pair from the pool
+    PHASE_SESSION_SIGN,   // crypto task
+    PHASE_SESSION_VERIFY, // crypto task
+    PHASE_CENTRAL_POST,   // checkin task, one batch upload with its reply
+    PHASE_RESUME,         // loop task, checking a /resume from ticket to proof
+    PHASE_CERT_BATCH,     // crypto task, all the cert checks of one batch
+    PHASE_COUNT,
+};
+
+// Upper bounds of the histogram buckets in microseconds, a last bucket
+// takes everything slower
+#define METRIC_BUCKETS 13
+extern const uint32_t metric_bucket_us[METRIC_BUCKETS];
+
+struct metric_histogram
+{
+    uint32_t counts[METRIC_BUCKETS + 1]; // not cumulative
+    uint64_t sum_us;
+};
+
+extern metric_histogram phase_latency[PHASE_COUNT];
+
+// Cycle counter of the calling core. A phase has to end on the core it
+// started on, which holds since every task is pinned.
+uint32_t metric_start();
+
+// add the time since start, as returned by metric_start(), to phase
+void metric_record(metric_phase phase, uint32_t start);
+
+// the phase histograms in Prometheus text format
+void write_metrics(text_writer &out);
+
+#endif
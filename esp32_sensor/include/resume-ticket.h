@@ -0,0 +1,75 @@
+#ifndef RESUME_TICKET_H
+#define RESUME_TICKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "crypto-backend.h"
+
+// Handed to a phone after a full /authenticate so its next check-in can go
+// through /resume with a MAC instead of signatures. Only the sensor can
+// read it:
+//
+//   key_id nonce[12] AES-256-GCM(id[6] expires[4] secret[32]) tag[16]
+//
+// The phone derives the same secret from the ECDH session keys and proves
+// it holds it with resume_proof().
+#define TICKET_SECRET_LEN 32
+#define TICKET_LEN (1 + 12 + 6 + 4 + TICKET_SECRET_LEN + 16)
+// Long enough for a shift. Keys rotate as often, so every ticket still valid
+// was sealed under the current or the previous key.
+#define TICKET_LIFETIME_S (10 * 3600UL)
+#define TICKET_KEY_ROTATE_MS (TICKET_LIFETIME_S * 1000)
+// How far the phone's clock in a /resume may be from ours
+#define RESUME_WINDOW_S 30
+// Resumes remembered to refuse replays while their timestamp is in the window
+#define RESUME_REPLAY_SLOTS 64
+
+struct ticket_key
+{
+    uint8_t id;
+    bool loaded;
+    crypto_backend::gcm_context gcm; // keyed once when the key is made
+};
+
+struct resume_replay
+{
+    uint8_t nonce[12];  // of the ticket used
+    uint32_t timestamp; // of the resume, 0 if the slot is free
+};
+
+// Ticket keys live in RAM only, a reboot sends every phone back to the full
+// handshake once
+struct ticket_keys
+{
+    ticket_key keys[2]; // current and previous
+    uint8_t current;
+    unsigned long rotated_at; // millis()
+    resume_replay replays[RESUME_REPLAY_SLOTS];
+
+    uint32_t issued;
+    uint32_t resumed;
+    uint32_t bad;      // forged, corrupt, wrong proof or a retired key
+    uint32_t expired;
+    uint32_t stale;    // timestamp outside the window
+    uint32_t replayed; // includes resumes refused with the replay slots full
+};
+
+void init_ticket_keys(ticket_keys &keys, unsigned long now);
+
+// retire the previous key and make a new current one when it is time
+void rotate_ticket_keys(ticket_keys &keys, unsigned long now);
+
+// seal a ticket for id valid until expires (wall clock)
+void seal_ticket(ticket_keys &keys, const uint8_t id[], uint32_t expires,
+                 const uint8_t secret[], uint8_t ticket[]);
+
+// HMAC-SHA256(secret, "resume" || timestamp as 4 bytes big endian || ticket)
+void resume_proof(const uint8_t secret[], uint32_t timestamp, const uint8_t ticket[], uint8_t proof[]);
+
+// return 0 if the ticket is ours and unexpired, timestamp is within the
+// window of now, proof matches and the same resume was not seen before;
+// id is the cert id the ticket was issued to
+int check_resume(ticket_keys &keys, const uint8_t ticket[], uint32_t timestamp,
+                 const uint8_t proof[], uint32_t now, uint8_t id[]);
+
+#endif
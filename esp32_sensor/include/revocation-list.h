@@ -0,0 +1,46 @@
+#ifndef REVOCATION_LIST_H
+#define REVOCATION_LIST_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Cert ids the central server revoked, checked before any ECC work. A Bloom
+// filter answers "not revoked" for almost every id without touching the
+// list; only its hits are confirmed by binary search of the sorted ids.
+#define REVOCATION_MAX 256
+#define REVOCATION_BLOOM_BITS 2048
+#define REVOCATION_BLOOM_HASHES 3
+
+struct revocation_list
+{
+    uint8_t ids[REVOCATION_MAX][6]; // sorted, no duplicates once indexed
+    uint16_t count;
+    uint32_t version; // the central server's, 0 before the first sync
+    uint8_t bloom[REVOCATION_BLOOM_BITS / 8];
+};
+
+struct revocation_stats
+{
+    uint32_t syncs;    // lists fetched from the central server
+    uint32_t revoked;  // certs turned away for their id
+    uint32_t expired;  // certs turned away for their valid_until
+    uint32_t bloom_false_positives;
+    uint32_t overflows; // lists refused for having more than REVOCATION_MAX ids
+};
+
+extern revocation_stats revocation_counters;
+
+// empty list at the given version
+void clear_revocations(revocation_list &list, uint32_t version);
+
+// append one id in any order, return false if the list is full
+bool add_revocation(revocation_list &list, const uint8_t id[]);
+
+// sort the ids, drop duplicates and build the filter; call once after the
+// last add_revocation
+void index_revocations(revocation_list &list);
+
+// return true if id (the first 6 bytes of a cert) is revoked
+bool is_revoked(const revocation_list &list, const uint8_t id[]);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef SENSOR_EVENTS_H
+#define SENSOR_EVENTS_H
+
+#include <stdint.h>
+
+// Edges buffered between two drains, a power of two
+#define SENSOR_RING_SIZE 64
+// A falling edge only counts if the pin was high at least this long before,
+// shorter pulses are contact bounce or IR noise
+#define SENSOR_SETTLE_US 5000
+
+struct sensor_edge
+{
+    uint32_t at_us; // micros() in the interrupt
+    uint8_t level;  // pin level after the edge
+};
+
+struct sensor_stats
+{
+    uint32_t edges;      // captured by the interrupt
+    uint32_t overflows;  // edges lost to a full ring
+    uint32_t detections;
+    uint32_t bounces;    // falling edges rejected by settle or debounce
+};
+
+extern sensor_stats sensor_counters;
+
+// Capture every edge of pin from a GPIO interrupt. Detections closer than
+// debounce_ms to the previous one are ignored.
+void start_sensor_capture(int pin, unsigned long debounce_ms);
+
+// Drain the captured edges, return true if one was a new detection, with
+// detected_ms the millis() at which its edge happened, however late the
+// drain runs
+bool poll_motion(unsigned long &detected_ms);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef SESSION_CHANNEL_H
+#define SESSION_CHANNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "crypto-backend.h"
+
+// AES-256-GCM between the sensor and one authenticated phone, set up once
+// per session so a message costs one seal or open and nothing else. Both
+// sides expand the session's ECDH secret (after the same HKDF extract as the
+// resumption secret) with info "channel" into
+//
+//   phone_key[32] sensor_key[32] phone_salt[4] sensor_salt[4]
+//
+// Each direction has its own key and counts its messages; the nonce is
+// salt || seq, seq big endian. A message is
+//
+//   seq[8] ciphertext tag[16]
+//
+// and is accepted only with a seq above every one accepted before, which
+// refuses replays and reordering.
+//
+// No message path carries channel messages yet, so the firmware neither
+// derives these keys nor keeps channels per session; run_authenticate is
+// where the "channel" expand goes once one does. Until then only
+// bench/crypto_bench.cpp uses this.
+#define CHANNEL_KEYS_LEN (32 + 32 + 4 + 4)
+#define CHANNEL_HEADER_LEN 8
+#define CHANNEL_TAG_LEN 16
+#define CHANNEL_OVERHEAD (CHANNEL_HEADER_LEN + CHANNEL_TAG_LEN)
+
+struct channel_direction
+{
+    crypto_backend::gcm_context gcm; // keyed once
+    uint8_t salt[4];
+    uint64_t next_seq; // next to send, or the lowest still accepted
+    uint64_t stream_seq; // of the message being sealed or opened in pieces
+};
+
+struct session_channel
+{
+    bool ready;
+    channel_direction send;
+    channel_direction receive;
+};
+
+void init_session_channel(session_channel &ch);
+
+// key ch from the expanded keys; sensor picks which half is ours
+void open_session_channel(session_channel &ch, const uint8_t keys[], bool sensor);
+
+// drop the keys, ch can be opened again
+void close_session_channel(session_channel &ch);
+
+// seal plaintext into message, which has room for len + CHANNEL_OVERHEAD
+// bytes; return the message length, 0 if ch is not open
+size_t channel_seal(session_channel &ch,
+                    const uint8_t *aad, size_t aad_len,
+                    const uint8_t *plaintext, size_t len,
+                    uint8_t message[]);
+
+// return 0 if message is authentic and newer than every one opened before,
+// plaintext gets message_len - CHANNEL_OVERHEAD bytes
+int channel_open(session_channel &ch,
+                 const uint8_t *aad, size_t aad_len,
+                 const uint8_t message[], size_t message_len,
+                 uint8_t plaintext[]);
+
+// The same in pieces, e.g. straight between the HTTP buffer and a file.
+// Chunks before the last must be multiples of 16 bytes. One message per
+// direction at a time; each call returns 0 if it went through.
+int channel_seal_start(session_channel &ch, const uint8_t *aad, size_t aad_len,
+                       uint8_t header[]);
+int channel_seal_update(session_channel &ch, const uint8_t *in, size_t len, uint8_t *out);
+int channel_seal_finish(session_channel &ch, uint8_t tag[]);
+
+// Nothing opened is authentic until channel_open_finish returns 0
+int channel_open_start(session_channel &ch, const uint8_t *aad, size_t aad_len,
+                       const uint8_t header[]);
+int channel_open_update(session_channel &ch, const uint8_t *in, size_t len, uint8_t *out);
+int channel_open_finish(session_channel &ch, const uint8_t tag[]);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef SESSION_TABLE_H
+#define SESSION_TABLE_H
+
+#include <stdint.h>
+#include "mbedtls/ecdh.h"
+
+// Must be a power of two
+#define SESSION_TABLE_SIZE 32
+
+enum session_slot_state : uint8_t
+{
+    SLOT_EMPTY,
+    SLOT_USED,
+    SLOT_DELETED,
+};
+
+// A pending handshake, between /handshake and /authenticate. The slot owns
+// its ecdh context and frees it when the session ends or expires.
+struct session_slot
+{
+    uint8_t id[6];
+    uint8_t state;
+    unsigned long created_at; // millis()
+    uint8_t s_nonce[12];
+    uint8_t client_pub[65]; // from the CA-verified cert
+    mbedtls_ecdh_context ecdh;
+};
+
+// Open addressing with linear probing, keyed by the 6 byte cert id
+struct session_table
+{
+    session_slot slots[SESSION_TABLE_SIZE];
+    unsigned long ttl_ms;
+    uint32_t live;
+
+    uint32_t expired;
+    uint32_t rejected; // inserts refused because every slot was live
+};
+
+void init_session_table(session_table &table, unsigned long ttl_ms);
+
+// return a slot for id with a freshly initialised ecdh context, replacing any
+// previous session of the same id; nullptr if the table is full
+session_slot *insert_session(session_table &table, const uint8_t id[], unsigned long now);
+
+// return the live session for id, nullptr if there is none or it expired
+session_slot *find_session(session_table &table, const uint8_t id[], unsigned long now);
+
+void remove_session(session_table &table, session_slot *slot);
+
+// free every expired slot, cheap enough to call from loop()
+void expire_sessions(session_table &table, unsigned long now);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+
+// Bounded ring for exactly one producer and one consumer, which may run on
+// different cores. No locks and no allocation: the producer only writes
+// tail, the consumer only writes head. N must be a power of two.
+template <typename T, size_t N>
+struct spsc_queue
+{
+    static_assert((N & (N - 1)) == 0, "spsc_queue size must be a power of two");
+
+    T items[N];
+    std::atomic<size_t> head{0}; // next item to pop
+    std::atomic<size_t> tail{0}; // next free slot
+};
+
+// return false if the queue is full, producer side only. Always inlined so
+// an IRAM interrupt handler can push without calling into flash.
+template <typename T, size_t N>
+__attribute__((always_inline)) inline bool spsc_push(spsc_queue<T, N> &queue, const T &item)
+{
+    size_t tail = queue.tail.load(std::memory_order_relaxed);
+    if (tail - queue.head.load(std::memory_order_acquire) == N)
+        return false;
+
+    queue.items[tail & (N - 1)] = item;
+    // publish the item before the consumer can see the new tail
+    queue.tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+// return false if the queue is empty, consumer side only
+template <typename T, size_t N>
+__attribute__((always_inline)) inline bool spsc_pop(spsc_queue<T, N> &queue, T &item)
+{
+    size_t head = queue.head.load(std::memory_order_relaxed);
+    if (head == queue.tail.load(std::memory_order_acquire))
+        return false;
+
+    item = queue.items[head & (N - 1)];
+    // the slot may be overwritten once the producer sees the new head
+    queue.head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T, size_t N>
+size_t spsc_size(const spsc_queue<T, N> &queue)
+{
+    return queue.tail.load(std::memory_order_acquire) - queue.head.load(std::memory_order_acquire);
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef TEXT_BUFFER_H
+#define TEXT_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// return true if hex is exactly 2 * len hex digits, either case, decoded
+// into bytes
+bool hex_decode(const char *hex, size_t hex_len, uint8_t bytes[], size_t len);
+
+// 2 * len uppercase hex digits, not nul terminated
+void hex_encode(const uint8_t bytes[], size_t len, char hex[]);
+
+// Appends into a caller-owned buffer and never writes past it; once
+// something does not fit, overflow is set and nothing more is written.
+// The text is always nul terminated.
+struct text_writer
+{
+    char *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+};
+
+void init_text_writer(text_writer &writer, char buf[], size_t size);
+
+void write_text(text_writer &writer, const char *text, size_t text_len);
+void write_text(text_writer &writer, const char *text);
+void write_hex(text_writer &writer, const uint8_t bytes[], size_t len);
+void write_uint(text_writer &writer, uint32_t value);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef WALL_CLOCK_H
+#define WALL_CLOCK_H
+
+#include <stdint.h>
+
+// Start SNTP against the given server, time is kept in UTC
+void init_wall_clock(const char *ntp_server);
+
+// seconds since epoch, 0 while the clock has not been synced yet
+uint32_t wall_clock_now();
+
+// parse a "%Y-%m-%d %H:%M:%S" UTC timestamp as used by cert valid_until,
+// return 0 if malformed
+uint32_t parse_timestamp(const char *text);
+
+#endif
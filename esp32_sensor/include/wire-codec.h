@@ -0,0 +1,126 @@
+#ifndef WIRE_CODEC_H
+#define WIRE_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary encoding of /handshake, /authenticate, /resume, /challenge and
+// /checkin, sent as application/octet-stream next to the hex-in-JSON one.
+// Every message starts with WIRE_VERSION and a wire_type byte, followed by
+// raw fixed-width fields; DER signatures are prefixed with their length.
+//
+//   handshake           id[6] pub[65] valid_until[19] sig_len sig c_nonce[12] session[65]
+//   handshake_ref       cert_ref[32] c_nonce[12] session[65]
+//   authenticate        id[6] session[65] sig_len sig
+//   resume              ticket[71] timestamp[4] proof[32]
+//   checkin             id[6] pub[65] valid_until[19] sig_len sig challenge[12]
+//                       session[65] session_sig_len session_sig
+//   checkin_ref         cert_ref[32] challenge[12] session[65] session_sig_len session_sig
+//   handshake_reply     id[6] pub[65] valid_until[19] s_nonce[12] session[65]
+//                       session_sig_len session_sig cert_sig_len cert_sig
+//   authenticate_reply  expires[4] ticket_len ticket
+//   challenge_reply     id[6] pub[65] valid_until[19] challenge[12] session[65]
+//                       expires_in[2] challenge_sig_len challenge_sig cert_sig_len cert_sig
+//
+// pub and session are SEC1 points, written [65] above: 65 bytes after an
+// 0x04 prefix or 33 after 0x02/0x03, the prefix says which. cert_ref and
+// signatures cover the points as sent.
+//
+// Integers are big endian. ticket_len is 0 when no ticket was issued.
+// expires_in is how many seconds the challenge is still accepted. A /checkin
+// is answered with an authenticate_reply.
+#define WIRE_VERSION 1
+#define WIRE_CONTENT_TYPE "application/octet-stream"
+// DER of two 32 byte integers
+#define WIRE_MAX_SIGNATURE 72
+// An uncompressed point, a compressed one is 33
+#define WIRE_MAX_POINT 65
+// Opaque to everyone but the sensor, see resume-ticket.h
+#define WIRE_TICKET_LEN 71
+
+enum wire_type : uint8_t
+{
+    WIRE_HANDSHAKE = 0x01,
+    WIRE_HANDSHAKE_REF = 0x02,
+    WIRE_AUTHENTICATE = 0x03,
+    WIRE_RESUME = 0x04,
+    WIRE_CHECKIN = 0x05,
+    WIRE_CHECKIN_REF = 0x06,
+    WIRE_HANDSHAKE_REPLY = 0x81,
+    WIRE_AUTHENTICATE_REPLY = 0x83,
+    WIRE_CHALLENGE_REPLY = 0x85,
+};
+
+struct wire_handshake
+{
+    bool has_cert_ref;
+    uint8_t cert_ref[32];
+    uint8_t id[6];
+    uint8_t pub[WIRE_MAX_POINT];
+    uint8_t valid_until[19];
+    uint8_t signature[WIRE_MAX_SIGNATURE];
+    size_t signature_len;
+    uint8_t c_nonce[12];
+    uint8_t session[WIRE_MAX_POINT];
+};
+
+struct wire_authenticate
+{
+    uint8_t id[6];
+    uint8_t session[WIRE_MAX_POINT];
+    uint8_t signature[WIRE_MAX_SIGNATURE];
+    size_t signature_len;
+};
+
+// A handshake and an authenticate in one: hello.c_nonce is the nonce of the
+// challenge answered, hello.session the phone's key
+struct wire_checkin
+{
+    wire_handshake hello;
+    uint8_t session_signature[WIRE_MAX_SIGNATURE];
+    size_t session_signature_len;
+};
+
+struct wire_resume
+{
+    uint8_t ticket[WIRE_TICKET_LEN];
+    uint32_t timestamp; // the phone's wall clock
+    uint8_t proof[32];
+};
+
+// return 0 if body is a complete version 1 handshake or handshake_ref
+int decode_handshake(const uint8_t body[], size_t body_len, wire_handshake &request);
+
+// return 0 if body is a complete version 1 authenticate
+int decode_authenticate(const uint8_t body[], size_t body_len, wire_authenticate &request);
+
+// return 0 if body is a complete version 1 resume
+int decode_resume(const uint8_t body[], size_t body_len, wire_resume &request);
+
+// return 0 if body is a complete version 1 checkin or checkin_ref
+int decode_checkin(const uint8_t body[], size_t body_len, wire_checkin &request);
+
+// cert is the sensor's id, pub and valid_until as in cert_bytes(); return
+// the encoded length, 0 if out is too small or a point prefix is invalid
+size_t encode_handshake_reply(const uint8_t cert[],
+                              const uint8_t s_nonce[],
+                              const uint8_t session[],
+                              const uint8_t session_signature[], size_t session_signature_len,
+                              const uint8_t cert_signature[], size_t cert_signature_len,
+                              uint8_t out[], size_t out_size);
+
+// same as encode_handshake_reply for a published challenge
+size_t encode_challenge_reply(const uint8_t cert[],
+                              const uint8_t nonce[],
+                              const uint8_t session[],
+                              uint16_t expires_in,
+                              const uint8_t challenge_signature[], size_t challenge_signature_len,
+                              const uint8_t cert_signature[], size_t cert_signature_len,
+                              uint8_t out[], size_t out_size);
+
+// ticket may be nullptr when none was issued; return the encoded length, 0
+// if out is too small
+size_t encode_authenticate_reply(uint32_t expires, const uint8_t ticket[],
+                                 uint8_t out[], size_t out_size);
+
+#endif
@@ -0,0 +1,85 @@
+#include "admission.h"
+
+#include <string.h>
+
+static void fill_bucket(token_bucket &bucket, uint32_t burst, unsigned long now)
+{
+    bucket.milli_tokens = burst * 1000;
+    bucket.refilled_at = now;
+}
+
+// rate tokens per second is rate milli tokens per millisecond
+static void refill(token_bucket &bucket, uint32_t burst, uint32_t rate_per_s, unsigned long now)
+{
+    unsigned long elapsed = now - bucket.refilled_at;
+    uint32_t cap = burst * 1000;
+    if (elapsed >= cap / rate_per_s)
+        bucket.milli_tokens = cap;
+    else
+    {
+        bucket.milli_tokens += elapsed * rate_per_s;
+        if (bucket.milli_tokens > cap)
+            bucket.milli_tokens = cap;
+    }
+    bucket.refilled_at = now;
+}
+
+static admission_client &find_client(admission_control &ac, uint32_t ip, unsigned long now)
+{
+    admission_client *oldest = &ac.clients[0];
+    for (int i = 0; i < ADMISSION_CLIENTS; i++)
+    {
+        admission_client &c = ac.clients[i];
+        if (c.ip == ip)
+            return c;
+        if (c.ip == 0)
+        {
+            if (oldest->ip != 0)
+                oldest = &c;
+        }
+        else if (oldest->ip != 0 && now - c.last_seen > now - oldest->last_seen)
+            oldest = &c;
+    }
+
+    oldest->ip = ip;
+    oldest->last_seen = now;
+    fill_bucket(oldest->bucket, CLIENT_BURST, now);
+    return *oldest;
+}
+
+void init_admission(admission_control &ac, unsigned long now)
+{
+    memset(&ac, 0, sizeof(ac));
+    fill_bucket(ac.global, GLOBAL_BURST, now);
+}
+
+admission_verdict admit_request(admission_control &ac, uint32_t ip, uint32_t in_flight,
+                                unsigned long now)
+{
+    if (in_flight >= ADMISSION_MAX_IN_FLIGHT)
+    {
+        ac.shed_busy++;
+        return SHED_BUSY;
+    }
+
+    admission_client &client = find_client(ac, ip, now);
+    client.last_seen = now;
+    refill(client.bucket, CLIENT_BURST, CLIENT_RATE_PER_S, now);
+    if (client.bucket.milli_tokens < 1000)
+    {
+        ac.shed_client++;
+        return SHED_CLIENT;
+    }
+
+    refill(ac.global, GLOBAL_BURST, GLOBAL_RATE_PER_S, now);
+    if (ac.global.milli_tokens < 1000)
+    {
+        ac.shed_global++;
+        return SHED_GLOBAL;
+    }
+
+    client.bucket.milli_tokens -= 1000;
+    ac.global.milli_tokens -= 1000;
+    ac.admitted++;
+    return ADMIT;
+}
@@ -0,0 +1,103 @@
+#include "cert-cache.h"
+
+#include <string.h>
+#include "crypto-backend.h"
+
+// id + valid_until + pub + signature as hex in the full handshake, against
+// the 64 hex characters of the digest
+static uint32_t cert_hex_len(const uint8_t cert[], size_t signature_len)
+{
+    return 6 + 19 + point_len(cert[6]) * 2 + signature_len * 2;
+}
+
+void cert_digest(const uint8_t cert[],
+                 const uint8_t signature[],
+                 size_t signature_len,
+                 uint8_t digest[])
+{
+    crypto_backend::sha256_context sha;
+    crypto_backend::sha256_start(sha);
+    crypto_backend::sha256_update(sha, cert, cert_len(cert));
+    crypto_backend::sha256_update(sha, signature, signature_len);
+    crypto_backend::sha256_finish(sha, digest);
+}
+
+static cert_cache_entry *find_entry(cert_cache &cache, const uint8_t digest[], uint32_t now)
+{
+    for (int i = 0; i < CERT_CACHE_SIZE; i++)
+    {
+        cert_cache_entry &entry = cache.entries[i];
+        if (!entry.used || memcmp(entry.digest, digest, 32) != 0)
+            continue;
+
+        if (now != 0 && entry.valid_until != 0 && now >= entry.valid_until)
+        {
+            entry.used = false;
+            return nullptr;
+        }
+        entry.last_used = ++cache.tick;
+        return &entry;
+    }
+    return nullptr;
+}
+
+bool lookup_cert(cert_cache &cache,
+                 const uint8_t digest[],
+                 uint32_t now,
+                 uint8_t cert[])
+{
+    cert_cache_entry *entry = find_entry(cache, digest, now);
+    if (entry == nullptr)
+    {
+        cache.misses++;
+        return false;
+    }
+    memcpy(cert, entry->cert, cert_len(entry->cert));
+    cache.hits++;
+    return true;
+}
+
+bool lookup_cert_ref(cert_cache &cache,
+                     const uint8_t digest[],
+                     uint32_t now,
+                     uint8_t cert[])
+{
+    cert_cache_entry *entry = find_entry(cache, digest, now);
+    if (entry == nullptr)
+    {
+        cache.misses++;
+        return false;
+    }
+    memcpy(cert, entry->cert, cert_len(entry->cert));
+    cache.hits++;
+    cache.ref_hits++;
+    cache.bytes_saved += cert_hex_len(entry->cert, entry->signature_len) - 64;
+    return true;
+}
+
+void insert_cert(cert_cache &cache,
+                 const uint8_t digest[],
+                 const uint8_t cert[],
+                 size_t signature_len,
+                 uint32_t valid_until)
+{
+    cert_cache_entry *victim = &cache.entries[0];
+    for (int i = 0; i < CERT_CACHE_SIZE; i++)
+    {
+        cert_cache_entry &entry = cache.entries[i];
+        if (!entry.used)
+        {
+            victim = &entry;
+            break;
+        }
+        if (entry.last_used < victim->last_used)
+            victim = &entry;
+    }
+
+    memcpy(victim->digest, digest, 32);
+    memcpy(victim->cert, cert, cert_len(cert));
+    victim->signature_len = signature_len;
+    victim->valid_until = valid_until;
+    victim->last_used = ++cache.tick;
+    victim->used = true;
+}
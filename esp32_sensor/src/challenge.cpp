@@ -0,0 +1,94 @@
+#include "challenge.h"
+
+#include <string.h>
+
+void init_challenges(challenge_board &board)
+{
+    memset(&board, 0, sizeof(board));
+    for (int i = 0; i < 2; i++)
+        mbedtls_ecdh_init(&board.slots[i].ecdh);
+}
+
+void challenge_bytes(const uint8_t nonce[], const uint8_t pub[], uint8_t out[])
+{
+    memcpy(out, nonce, 12);
+    memcpy(out + 12, pub, 65);
+}
+
+static bool is_fresh(const challenge &c, unsigned long now)
+{
+    return c.ready && now - c.issued_at < CHALLENGE_MAX_AGE_MS;
+}
+
+bool challenge_due(const challenge_board &board, unsigned long now)
+{
+    if (board.rotating)
+        return false;
+    const challenge &c = board.slots[board.current];
+    return !c.ready || now - c.issued_at >= CHALLENGE_ROTATE_MS;
+}
+
+void publish_challenge(challenge_board &board,
+                       const uint8_t nonce[],
+                       mbedtls_ecdh_context &ecdh,
+                       const uint8_t pub[],
+                       const uint8_t signature[], size_t signature_len,
+                       unsigned long now)
+{
+    // The slot of the previous challenge is reused, its key is dropped
+    uint8_t next = board.slots[board.current].ready ? board.current ^ 1 : board.current;
+    challenge &c = board.slots[next];
+
+    mbedtls_ecdh_free(&c.ecdh);
+    c.ecdh = ecdh;
+    mbedtls_ecdh_init(&ecdh);
+    memcpy(c.nonce, nonce, 12);
+    memcpy(c.pub, pub, 65);
+    memcpy(c.signature, signature, signature_len);
+    c.signature_len = signature_len;
+    c.issued_at = now;
+    c.seen_count = 0;
+    c.ready = true;
+
+    board.current = next;
+    board.rotating = false;
+    board.published++;
+}
+
+challenge *current_challenge(challenge_board &board, unsigned long now)
+{
+    challenge &c = board.slots[board.current];
+    return is_fresh(c, now) ? &c : nullptr;
+}
+
+challenge *find_challenge(challenge_board &board, const uint8_t nonce[], unsigned long now)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        challenge &c = board.slots[i];
+        if (is_fresh(c, now) && memcmp(c.nonce, nonce, 12) == 0)
+            return &c;
+    }
+    board.unknown++;
+    return nullptr;
+}
+
+bool challenge_seen(const challenge &c, const uint8_t session[])
+{
+    // A replay carries the same ephemeral key, a fresh check-in a new one.
+    // Skip the point prefix, x alone tells keys apart.
+    for (int i = 0; i < c.seen_count; i++)
+    {
+        if (memcmp(c.seen[i], session + 1, 8) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool mark_challenge_seen(challenge &c, const uint8_t session[])
+{
+    if (challenge_seen(c, session) || c.seen_count == CHALLENGE_SEEN_SLOTS)
+        return false;
+    memcpy(c.seen[c.seen_count++], session + 1, 8);
+    return true;
+}
@@ -0,0 +1,229 @@
+#include "checkin-journal.h"
+
+#include <Arduino.h>
+#include "FS.h"
+#include "SPIFFS.h"
+#include "esp32/rom/crc.h"
+
+// Check-ins the uplink could not take, in an append-only ring of fixed-size
+// records. A record is never rewritten until the ring wraps past it, and
+// the delivered position lives in its own tiny file that changes once per
+// replayed batch, so flash writes stay proportional to outage traffic.
+
+const char *JOURNAL_PATH = "/journal.bin";
+const char *JOURNAL_ACK_PATH = "/journal.ack";
+
+struct journal_record
+{
+    uint32_t seq; // 1-based, 0 marks a slot that was never written
+    char cert_id[6];
+    uint16_t reserved;
+    uint32_t timestamp;
+    uint32_t crc; // over every field above
+};
+
+static_assert(sizeof(journal_record) == 20, "journal_record layout changed");
+
+struct journal_ack
+{
+    uint32_t seq;
+    uint32_t crc;
+};
+
+journal_stats journal_counters;
+
+static File journal_file;
+static uint32_t next_seq = 1;  // seq the next append gets
+static uint32_t acked_seq = 0; // every seq up to this one was delivered
+static uint32_t peeked_seqs[JOURNAL_BATCH];
+static size_t peeked_count = 0;
+
+static uint32_t record_crc(const journal_record &record)
+{
+    return crc32_le(0, (const uint8_t *)&record, offsetof(journal_record, crc));
+}
+
+static size_t record_offset(uint32_t seq)
+{
+    return ((seq - 1) % JOURNAL_CAPACITY) * sizeof(journal_record);
+}
+
+static bool read_record(uint32_t seq, journal_record &record)
+{
+    if (!journal_file.seek(record_offset(seq)))
+        return false;
+    if (journal_file.read((uint8_t *)&record, sizeof(record)) != sizeof(record))
+        return false;
+    return record.seq == seq && record.crc == record_crc(record);
+}
+
+static uint32_t oldest_pending_seq()
+{
+    uint32_t oldest = acked_seq + 1;
+    if (next_seq - oldest > JOURNAL_CAPACITY)
+        oldest = next_seq - JOURNAL_CAPACITY;
+    return oldest;
+}
+
+static bool create_journal()
+{
+    File file = SPIFFS.open(JOURNAL_PATH, FILE_WRITE);
+    if (!file)
+        return false;
+
+    uint8_t zeros[sizeof(journal_record) * 16] = {0};
+    for (size_t written = 0; written < JOURNAL_CAPACITY * sizeof(journal_record); written += sizeof(zeros))
+    {
+        if (file.write(zeros, sizeof(zeros)) != sizeof(zeros))
+        {
+            file.close();
+            return false;
+        }
+    }
+    file.close();
+    return true;
+}
+
+static void load_ack()
+{
+    acked_seq = 0;
+    File file = SPIFFS.open(JOURNAL_ACK_PATH);
+    if (!file)
+        return;
+
+    journal_ack ack;
+    if (file.read((uint8_t *)&ack, sizeof(ack)) == sizeof(ack) &&
+        ack.crc == crc32_le(0, (const uint8_t *)&ack.seq, sizeof(ack.seq)))
+        acked_seq = ack.seq;
+    file.close();
+}
+
+static void store_ack()
+{
+    journal_ack ack;
+    ack.seq = acked_seq;
+    ack.crc = crc32_le(0, (const uint8_t *)&ack.seq, sizeof(ack.seq));
+
+    File file = SPIFFS.open(JOURNAL_ACK_PATH, FILE_WRITE);
+    if (!file)
+    {
+        Serial.println("Failed to write journal ack");
+        return;
+    }
+    file.write((const uint8_t *)&ack, sizeof(ack));
+    file.close();
+}
+
+bool open_journal()
+{
+    if (!SPIFFS.exists(JOURNAL_PATH) && !create_journal())
+    {
+        Serial.println("Failed to create check-in journal");
+        return false;
+    }
+
+    journal_file = SPIFFS.open(JOURNAL_PATH, "r+");
+    if (!journal_file || journal_file.size() != JOURNAL_CAPACITY * sizeof(journal_record))
+    {
+        Serial.println("Check-in journal unusable, recreating");
+        journal_file.close();
+        if (!create_journal())
+            return false;
+        journal_file = SPIFFS.open(JOURNAL_PATH, "r+");
+        if (!journal_file)
+            return false;
+    }
+
+    // The newest intact record tells where appending resumes
+    uint32_t newest = 0;
+    journal_record record;
+    journal_file.seek(0);
+    for (int i = 0; i < JOURNAL_CAPACITY; i++)
+    {
+        if (journal_file.read((uint8_t *)&record, sizeof(record)) != sizeof(record))
+            break;
+        if (record.seq != 0 && record.crc == record_crc(record) && record.seq > newest)
+            newest = record.seq;
+    }
+    next_seq = newest + 1;
+
+    load_ack();
+    if (acked_seq > newest)
+        acked_seq = newest;
+
+    Serial.printf("check-in journal: %u pending\n", (unsigned)journal_pending());
+    return true;
+}
+
+bool journal_append(const checkin_event &event)
+{
+    if (!journal_file)
+        return false;
+
+    if (next_seq - acked_seq > JOURNAL_CAPACITY)
+        journal_counters.overwritten++;
+
+    journal_record record;
+    record.seq = next_seq;
+    memcpy(record.cert_id, event.cert_id, 6);
+    record.reserved = 0;
+    record.timestamp = event.timestamp;
+    record.crc = record_crc(record);
+
+    if (!journal_file.seek(record_offset(record.seq)) ||
+        journal_file.write((const uint8_t *)&record, sizeof(record)) != sizeof(record))
+    {
+        Serial.println("Failed to append to check-in journal");
+        return false;
+    }
+    journal_file.flush();
+
+    next_seq++;
+    journal_counters.appended++;
+    return true;
+}
+
+size_t journal_peek(checkin_event events[], size_t max_events)
+{
+    peeked_count = 0;
+    if (!journal_file)
+        return 0;
+    if (max_events > JOURNAL_BATCH)
+        max_events = JOURNAL_BATCH;
+
+    journal_record record;
+    for (uint32_t seq = oldest_pending_seq(); seq < next_seq && peeked_count < max_events; seq++)
+    {
+        if (!read_record(seq, record))
+        {
+            // Torn write or worn-out sector: skip it, but still commit past it
+            journal_counters.corrupt++;
+            if (peeked_count == 0)
+                acked_seq = seq;
+            continue;
+        }
+
+        checkin_event &event = events[peeked_count];
+        memcpy(event.cert_id, record.cert_id, 6);
+        event.cert_id[6] = '\0';
+        event.timestamp = record.timestamp;
+        peeked_seqs[peeked_count++] = seq;
+    }
+    return peeked_count;
+}
+
+void journal_commit(size_t count)
+{
+    if (count == 0 || count > peeked_count)
+        return;
+
+    acked_seq = peeked_seqs[count - 1];
+    journal_counters.replayed += count;
+    peeked_count = 0;
+    store_ack();
+}
+
+uint32_t journal_pending()
+{
+    return next_seq - oldest_pending_seq();
+}
@@ -0,0 +1,485 @@
+#include "checkin-queue.h"
+
+#include <WiFi.h>
+#include <HTTPClient.h>
+#include <ArduinoJson.h>
+#include "checkin-journal.h"
+#include "metrics.h"
+
+const unsigned long INITIAL_BACKOFF_MS = 250;
+const int MAX_ATTEMPTS = 3;
+// While the uplink is down, how often it is tried again to find out
+// whether it came back: with the newest batch if one is waiting, else with
+// the oldest journaled check-ins
+const unsigned long PROBE_INTERVAL_MS = 10000;
+// How long the first check-in of a batch waits for company
+const unsigned long BATCH_WINDOW_MS = 150;
+// How often the revocation list and the directory are asked for, the
+// server answers 304 when they did not change
+const unsigned long REVOCATION_SYNC_MS = 60000;
+
+checkin_stats checkin_counters;
+
+static QueueHandle_t checkin_events;
+static QueueHandle_t checkin_verdicts;
+static String checkin_url;
+static bool uplink_healthy = true;
+
+static String revoked_url;
+// Holds the newest list until the loop task takes it
+static QueueHandle_t revocation_updates;
+// Built here by the checkin task, too big for its stack
+static revocation_list fetched_revocations;
+static unsigned long last_revocation_sync;
+
+static String directory_url;
+static QueueHandle_t directory_updates;
+// Deltas apply to this copy, the loop task gets the result whole
+static employee_directory fetched_directory;
+
+// What the server made of one event of a batch
+enum checkin_outcome : uint8_t
+{
+    OUTCOME_ACCEPTED,
+    OUTCOME_REJECTED, // not a cert the server knows, or malformed
+    OUTCOME_RETRY,    // the server failed to record it, send it again
+    OUTCOME_UNKNOWN,  // the batch was applied but its reply was unreadable
+};
+
+// One request for the whole batch, outcomes[i] gets the server's decision
+// for events[i]. Return the HTTP status, or a negative HTTPClient error on
+// transport failure; only 200 means the batch was applied.
+static int post_batch(HTTPClient &http, WiFiClient &uplink,
+                      const checkin_event events[], size_t count,
+                      checkin_outcome outcomes[])
+{
+    // {"events":[["000002",1712345678],...]}
+    char body[16 + CHECKIN_BATCH_MAX * 24];
+    size_t len = snprintf(body, sizeof(body), "{\"events\":[");
+    for (size_t i = 0; i < count; i++)
+        len += snprintf(body + len, sizeof(body) - len, "%s[\"%s\",%u]",
+                        i == 0 ? "" : ",", events[i].cert_id, (unsigned)events[i].timestamp);
+    len += snprintf(body + len, sizeof(body) - len, "]}");
+
+    // Same client every time, HTTPClient keeps the socket open between posts
+    uint32_t start = metric_start();
+    http.begin(uplink, checkin_url);
+    http.addHeader("Content-Type", "application/json");
+    int code = http.POST((uint8_t *)body, len);
+    checkin_counters.requests++;
+
+    if (code == 200)
+    {
+        // The server already applied the batch, so a reply that cannot be
+        // read must not get it sent again
+        DynamicJsonDocument doc(256 + count * 128);
+        bool readable = deserializeJson(doc, http.getStream()) == DeserializationError::Ok;
+        JsonArray results = doc["results"];
+        for (size_t i = 0; i < count; i++)
+        {
+            JsonVariant result = results[i];
+            if (!readable || result.isNull())
+                outcomes[i] = OUTCOME_UNKNOWN;
+            else if (result["success"] | false)
+                outcomes[i] = OUTCOME_ACCEPTED;
+            else if (result["retry"] | false)
+                outcomes[i] = OUTCOME_RETRY;
+            else
+                outcomes[i] = OUTCOME_REJECTED;
+        }
+    }
+    else if (code > 0)
+        http.getString(); // drain the body so the connection can be reused
+
+    http.end();
+    metric_record(PHASE_CENTRAL_POST, start);
+    return code;
+}
+
+static int deliver(HTTPClient &http, WiFiClient &uplink,
+                   const checkin_event events[], size_t count,
+                   checkin_outcome outcomes[])
+{
+    unsigned long backoff = INITIAL_BACKOFF_MS;
+    for (int attempt = 1;; attempt++)
+    {
+        int code = post_batch(http, uplink, events, count, outcomes);
+        // A 4xx will not get better by resending the same body
+        if (code == 200 || (code >= 400 && code < 500) || attempt == MAX_ATTEMPTS)
+            return code;
+
+        checkin_counters.retries++;
+        vTaskDelay(pdMS_TO_TICKS(backoff));
+        backoff *= 2;
+    }
+}
+
+// Journal the events the server asked to get again, return how many
+static size_t journal_retries(const checkin_event events[], size_t count,
+                              const checkin_outcome outcomes[])
+{
+    size_t retried = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (outcomes[i] != OUTCOME_RETRY)
+            continue;
+        retried++;
+        checkin_counters.retried_events++;
+        if (!journal_append(events[i]))
+            checkin_counters.dropped++;
+    }
+    return retried;
+}
+
+// Only real decisions reach the LEDs; a retried or unreadable outcome is
+// no verdict on the phone
+static void report_verdict(const checkin_event &event, checkin_outcome outcome)
+{
+    if (outcome == OUTCOME_UNKNOWN)
+    {
+        checkin_counters.unknown++;
+        return;
+    }
+    if (outcome == OUTCOME_RETRY)
+        return;
+
+    checkin_verdict verdict;
+    memcpy(verdict.cert_id, event.cert_id, sizeof(verdict.cert_id));
+    verdict.accepted = outcome == OUTCOME_ACCEPTED;
+    if (verdict.accepted)
+        checkin_counters.accepted++;
+    else
+        checkin_counters.rejected++;
+    xQueueSend(checkin_verdicts, &verdict, 0);
+}
+
+// Replay one batch from the journal, return false if the uplink failed or
+// the server recorded none of it.
+// Replayed check-ins are old news, they do not light the LEDs.
+static bool replay_journal(HTTPClient &http, WiFiClient &uplink)
+{
+    checkin_event batch[JOURNAL_BATCH];
+    checkin_outcome outcomes[JOURNAL_BATCH];
+    size_t count = journal_peek(batch, JOURNAL_BATCH);
+    if (count == 0)
+        return true;
+
+    int code = post_batch(http, uplink, batch, count, outcomes);
+    if (code >= 400 && code < 500)
+        checkin_counters.dropped += count; // the server refused them, drop
+    else if (code != 200)
+        return false;
+
+    journal_commit(count);
+    if (code != 200)
+        return true;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (outcomes[i] == OUTCOME_UNKNOWN)
+            checkin_counters.unknown++;
+    }
+    // Back at the end of the ring, behind everything still pending. If the
+    // server could record none of them, wait a probe interval like for an
+    // outage instead of resending them straight away.
+    return journal_retries(batch, count, outcomes) < count;
+}
+
+// Fetch the revoked ids if the server has a newer list than the last one,
+// return the HTTP status or a negative HTTPClient error. A list that does
+// not fit is refused whole: the previous one stays in force and the next
+// sync asks again, rather than letting some revoked certs back in.
+static int sync_revocations(HTTPClient &http, WiFiClient &uplink)
+{
+    http.begin(uplink, revoked_url + "?since=" + String(fetched_revocations.version));
+    int code = http.GET();
+
+    if (code == 200)
+    {
+        // {"version":7,"ids":["000002",...]}
+        DynamicJsonDocument doc(256 + REVOCATION_MAX * 24);
+        DeserializationError error = deserializeJson(doc, http.getStream());
+        JsonArray ids = doc["ids"];
+        if (error == DeserializationError::NoMemory || ids.size() > REVOCATION_MAX)
+        {
+            Serial.println("revocation list too long, keeping the previous one");
+            revocation_counters.overflows++;
+            code = -1;
+        }
+        else if (error != DeserializationError::Ok)
+            code = -1;
+        else
+        {
+            clear_revocations(fetched_revocations, doc["version"] | 0);
+            for (JsonVariant id : ids)
+            {
+                const char *text = id | "";
+                if (strlen(text) == 6)
+                    add_revocation(fetched_revocations, (const uint8_t *)text);
+            }
+            index_revocations(fetched_revocations);
+            xQueueOverwrite(revocation_updates, &fetched_revocations);
+            revocation_counters.syncs++;
+        }
+    }
+    else if (code == 507)
+    {
+        // The server knows what we hold and would not cut the list short
+        http.getString();
+        Serial.println("revocation list too long, keeping the previous one");
+        revocation_counters.overflows++;
+    }
+    else if (code > 0)
+        http.getString();
+
+    http.end();
+    return code;
+}
+
+// Fetch what changed in the directory since our version, or all of it
+// before the first snapshot; return the HTTP status or a negative
+// HTTPClient error
+static int sync_directory(HTTPClient &http, WiFiClient &uplink)
+{
+    String url = directory_url;
+    if (fetched_directory.loaded)
+        url += "?since=" + String(fetched_directory.version);
+    http.begin(uplink, url);
+    int code = http.GET();
+
+    if (code == 200)
+    {
+        // {"version":9,"snapshot":false,"add":[["000002",1],...],"remove":["000003",...]}
+        DynamicJsonDocument doc(512 + DIRECTORY_MAX * 48);
+        if (deserializeJson(doc, http.getStream()) != DeserializationError::Ok)
+            code = -1;
+        else if (!(doc["snapshot"] | false) && !fetched_directory.loaded)
+            code = -1; // a delta with nothing to apply it to
+        else
+        {
+            if (doc["snapshot"] | false)
+            {
+                clear_directory(fetched_directory);
+                fetched_directory.loaded = true;
+                directory_counters.snapshots++;
+            }
+            else
+                directory_counters.deltas++;
+
+            for (JsonVariant id : doc["remove"].as<JsonArray>())
+            {
+                const char *text = id | "";
+                if (strlen(text) == 6)
+                    remove_employee(fetched_directory, (const uint8_t *)text);
+            }
+            for (JsonVariant entry : doc["add"].as<JsonArray>())
+            {
+                const char *text = entry[0] | "";
+                uint16_t employee = entry[1] | 0;
+                if (strlen(text) != 6 || employee == 0)
+                    continue;
+                if (!put_employee(fetched_directory, (const uint8_t *)text, employee))
+                {
+                    // Later deltas would never resend what is left out, so
+                    // drop back to asking for a snapshot; until one fits,
+                    // the loop task waits for the central verdicts
+                    Serial.println("directory full, check-ins wait for the central server");
+                    directory_counters.overflows++;
+                    fetched_directory.loaded = false;
+                    break;
+                }
+            }
+            fetched_directory.version = doc["version"] | 0;
+            xQueueOverwrite(directory_updates, &fetched_directory);
+        }
+    }
+    else if (code > 0)
+        http.getString();
+
+    http.end();
+    return code;
+}
+
+// Block for the first event, then collect more until the batch is full or
+// the window closes
+static size_t collect_batch(checkin_event batch[], TickType_t wait)
+{
+    if (xQueueReceive(checkin_events, &batch[0], wait) != pdTRUE)
+        return 0;
+
+    size_t count = 1;
+    TickType_t window_end = xTaskGetTickCount() + pdMS_TO_TICKS(BATCH_WINDOW_MS);
+    while (count < CHECKIN_BATCH_MAX)
+    {
+        TickType_t now = xTaskGetTickCount();
+        if ((int32_t)(window_end - now) <= 0)
+            break;
+        if (xQueueReceive(checkin_events, &batch[count], window_end - now) != pdTRUE)
+            break;
+        count++;
+    }
+    return count;
+}
+
+static void checkin_worker(void *)
+{
+    WiFiClient uplink;
+    HTTPClient http;
+    http.setReuse(true);
+
+    checkin_event batch[CHECKIN_BATCH_MAX];
+    checkin_outcome outcomes[CHECKIN_BATCH_MAX];
+    unsigned long last_probe = 0; // millis() of the last try while the uplink is down
+    for (;;)
+    {
+        // A sync that is due while the uplink is down is skipped, not retried
+        // in a tight loop
+        if (millis() - last_revocation_sync >= REVOCATION_SYNC_MS)
+        {
+            if (uplink_healthy)
+            {
+                sync_revocations(http, uplink);
+                sync_directory(http, uplink);
+            }
+            last_revocation_sync = millis();
+        }
+
+        TickType_t wait = portMAX_DELAY;
+        if (journal_pending() == 0)
+            uplink_healthy = true;
+        else if (uplink_healthy)
+            wait = 0;
+        else
+        {
+            unsigned long since_probe = millis() - last_probe;
+            wait = since_probe >= PROBE_INTERVAL_MS ? 0 : pdMS_TO_TICKS(PROBE_INTERVAL_MS - since_probe);
+        }
+        TickType_t sync_wait = pdMS_TO_TICKS(REVOCATION_SYNC_MS - (millis() - last_revocation_sync));
+        if (wait > sync_wait)
+            wait = sync_wait;
+
+        size_t count = collect_batch(batch, wait);
+        // Check-ins keep coming during a rush, so the probe cannot wait for
+        // a quiet moment
+        bool probe_due = !uplink_healthy && millis() - last_probe >= PROBE_INTERVAL_MS;
+        if (count > 0)
+        {
+            if (uplink_healthy || probe_due)
+            {
+                // While the uplink is down the new batch is the probe, tried once
+                int code;
+                if (uplink_healthy)
+                    code = deliver(http, uplink, batch, count, outcomes);
+                else
+                {
+                    code = post_batch(http, uplink, batch, count, outcomes);
+                    last_probe = millis();
+                }
+
+                if (code == 200)
+                {
+                    uplink_healthy = true;
+                    journal_retries(batch, count, outcomes);
+                    for (size_t i = 0; i < count; i++)
+                        report_verdict(batch[i], outcomes[i]);
+                    continue;
+                }
+                if (code >= 400 && code < 500)
+                {
+                    // The server refused the batch itself, journaling it
+                    // would only wedge the replay
+                    Serial.printf("check-in batch refused (%d)\n", code);
+                    checkin_counters.dropped += count;
+                    uplink_healthy = true;
+                    continue;
+                }
+                if (uplink_healthy)
+                {
+                    Serial.printf("uplink down (%d), journaling check-ins\n", code);
+                    uplink_healthy = false;
+                    last_probe = millis();
+                }
+            }
+
+            for (size_t i = 0; i < count; i++)
+            {
+                if (!journal_append(batch[i]))
+                    checkin_counters.dropped++;
+            }
+            continue;
+        }
+
+        // Nothing new: drain the backlog, or probe the uplink with it
+        if (uplink_healthy || probe_due)
+        {
+            uplink_healthy = replay_journal(http, uplink);
+            if (!uplink_healthy)
+                last_probe = millis();
+        }
+    }
+}
+
+void start_checkin_worker(const String &server_ip)
+{
+    checkin_url = "http://" + server_ip + "/checkin/batch";
+    revoked_url = "http://" + server_ip + "/revoked";
+    revocation_updates = xQueueCreate(1, sizeof(revocation_list));
+    clear_revocations(fetched_revocations, 0);
+    directory_url = "http://" + server_ip + "/directory";
+    directory_updates = xQueueCreate(1, sizeof(employee_directory));
+    clear_directory(fetched_directory);
+    // Fetch both right away
+    last_revocation_sync = millis() - REVOCATION_SYNC_MS;
+    checkin_events = xQueueCreate(CHECKIN_QUEUE_DEPTH, sizeof(checkin_event));
+    checkin_verdicts = xQueueCreate(CHECKIN_QUEUE_DEPTH, sizeof(checkin_verdict));
+    open_journal();
+
+    // Core 0 next to the WiFi stack, loop() keeps core 1 to itself
+    xTaskCreatePinnedToCore(checkin_worker, "checkin", 6144, nullptr, 1, nullptr, 0);
+}
+
+bool enqueue_checkin(const char cert_id[], uint32_t timestamp)
+{
+    if (checkin_events == nullptr)
+        return false;
+
+    checkin_event event;
+    memcpy(event.cert_id, cert_id, 6);
+    event.cert_id[6] = '\0';
+    event.timestamp = timestamp;
+
+    if (xQueueSend(checkin_events, &event, 0) != pdTRUE)
+    {
+        checkin_counters.dropped++;
+        return false;
+    }
+    return true;
+}
+
+bool poll_checkin_verdict(checkin_verdict &verdict)
+{
+    if (checkin_verdicts == nullptr)
+        return false;
+    return xQueueReceive(checkin_verdicts, &verdict, 0) == pdTRUE;
+}
+
+uint32_t checkin_queue_depth()
+{
+    if (checkin_events == nullptr)
+        return 0;
+    return uxQueueMessagesWaiting(checkin_events);
+}
+
+bool poll_revocations(revocation_list &list)
+{
+    if (revocation_updates == nullptr)
+        return false;
+    return xQueueReceive(revocation_updates, &list, 0) == pdTRUE;
+}
+
+bool poll_directory(employee_directory &dir)
+{
+    if (directory_updates == nullptr)
+        return false;
+    return xQueueReceive(directory_updates, &dir, 0) == pdTRUE;
+}
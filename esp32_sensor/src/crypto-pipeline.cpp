@@ -0,0 +1,243 @@
+#include "crypto-pipeline.h"
+
+#include <Arduino.h>
+#include "ecdh-aes.h"
+#include "challenge.h"
+#include "metrics.h"
+#include "spsc-queue.h"
+#include "mbedtls/platform_util.h"
+
+// Generate key pairs ahead only once jobs stop arriving for this long
+const unsigned long KEY_POOL_IDLE_MS = 250;
+
+crypto_pipeline_stats crypto_counters;
+
+static crypto_job jobs[CRYPTO_PIPELINE_DEPTH];
+// Jobs only move by index: loop task -> crypto task -> loop task
+static spsc_queue<uint8_t, CRYPTO_PIPELINE_DEPTH> submitted;
+static spsc_queue<uint8_t, CRYPTO_PIPELINE_DEPTH> completed;
+// Free jobs, touched by the loop task only
+static uint8_t free_jobs[CRYPTO_PIPELINE_DEPTH];
+static uint8_t free_count;
+
+static TaskHandle_t crypto_task;
+static trust_anchor *ca_anchor;
+static mbedtls_ecdsa_context *server_signer;
+static key_pool *session_keys;
+
+// return 0 if the cert is CA signed or the cert cache already said so
+static int check_cert(crypto_job &job)
+{
+    if (!job.verify_cert)
+        return 0;
+    if (job.cert_batched)
+        return job.cert_status;
+
+    uint32_t start = metric_start();
+    int status = verify(*ca_anchor, job.cert, cert_len(job.cert), job.cert_signature, job.cert_signature_len);
+    metric_record(PHASE_CERT_VERIFY, start);
+    return status;
+}
+
+// Verify the certs of the queued jobs together, sharing the inversions; each
+// job still gets its own verdict. One cert alone is left to check_cert.
+static void verify_certs(const uint8_t indices[], size_t count)
+{
+    verify_item items[CRYPTO_PIPELINE_DEPTH];
+    crypto_job *owners[CRYPTO_PIPELINE_DEPTH];
+    size_t item_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        crypto_job &job = jobs[indices[i]];
+        job.cert_batched = false;
+        if (!job.verify_cert || (job.kind != CRYPTO_HANDSHAKE && job.kind != CRYPTO_CHECKIN))
+            continue;
+        items[item_count] = {job.cert, cert_len(job.cert), nullptr, job.cert_signature, job.cert_signature_len};
+        owners[item_count++] = &job;
+    }
+    if (item_count < 2)
+        return;
+
+    uint32_t start = metric_start();
+    int results[CRYPTO_PIPELINE_DEPTH];
+    verify_batch(*ca_anchor, items, item_count, results);
+    metric_record(PHASE_CERT_BATCH, start);
+    for (size_t i = 0; i < item_count; i++)
+    {
+        owners[i]->cert_batched = true;
+        owners[i]->cert_status = results[i];
+    }
+    crypto_counters.batches++;
+    crypto_counters.batched_certs += item_count;
+}
+
+static void run_handshake(crypto_job &job)
+{
+    if (check_cert(job) != 0)
+    {
+        job.status = -1;
+        return;
+    }
+
+    uint32_t start = metric_start();
+    take_key(*session_keys, job.ecdh);
+    // Answer in the point format the phone used, old phones only know 0x04
+    size_t session_pub_len;
+    get_public_bytes(job.ecdh, job.session_pub, session_pub_len, job.client_session[0] != 0x04);
+    metric_record(PHASE_ECDH_KEYGEN, start);
+
+    start = metric_start();
+    uint8_t session_message[SESSION_MAX_LEN];
+    size_t session_message_len = session_bytes(job.c_nonce, job.client_session, job.session_pub, session_message);
+    sign(*server_signer, session_message, session_message_len, job.session_signature, job.session_signature_len);
+    metric_record(PHASE_SESSION_SIGN, start);
+    job.status = 0;
+}
+
+static void run_authenticate(crypto_job &job)
+{
+    uint32_t start = metric_start();
+    job.status = verify(job.session_message, job.session_message_len, job.client_pub, job.signature, job.signature_len);
+    metric_record(PHASE_SESSION_VERIFY, start);
+    if (job.status != 0)
+        return;
+
+    // Both sides can compute this from the session keys, a later /resume
+    // proves possession of it instead of signing again
+    uint8_t shared_secret[32];
+    const uint8_t info[] = "resumption";
+    if (get_shared_secret(job.ecdh, job.session_message + 12, shared_secret) != 0 ||
+        hkdf_sha256(nullptr, 0, shared_secret, 32, info, sizeof(info) - 1, job.resumption_secret, 32) != 0)
+        job.status = -1;
+    mbedtls_platform_zeroize(shared_secret, sizeof(shared_secret));
+}
+
+static void run_challenge(crypto_job &job)
+{
+    uint32_t start = metric_start();
+    take_key(*session_keys, job.ecdh);
+    size_t session_pub_len;
+    get_public_bytes(job.ecdh, job.session_pub, session_pub_len);
+    metric_record(PHASE_ECDH_KEYGEN, start);
+
+    start = metric_start();
+    uint8_t message[77];
+    challenge_bytes(job.s_nonce, job.session_pub, message);
+    sign(*server_signer, message, sizeof(message), job.session_signature, job.session_signature_len);
+    metric_record(PHASE_SESSION_SIGN, start);
+    job.status = 0;
+}
+
+static void run_checkin(crypto_job &job)
+{
+    if (check_cert(job) != 0)
+    {
+        job.status = -1;
+        return;
+    }
+    run_authenticate(job);
+}
+
+static void crypto_worker(void *)
+{
+    bool idle = false;
+    for (;;)
+    {
+        // Right after a job wait a while for the next one; once idle, keep
+        // refilling the pool one key at a time until it is full
+        TickType_t wait = pdMS_TO_TICKS(KEY_POOL_IDLE_MS);
+        if (session_keys->depth == KEY_POOL_SIZE)
+            wait = portMAX_DELAY;
+        else if (idle)
+            wait = 0;
+
+        if (ulTaskNotifyTake(pdTRUE, wait) == 0)
+        {
+            idle = true;
+            refill_key_pool(*session_keys);
+            continue;
+        }
+
+        // Take everything queued at once so a burst of handshakes shares
+        // one batch verify; jobs submitted meanwhile wait for the next round
+        uint8_t indices[CRYPTO_PIPELINE_DEPTH];
+        size_t count = 0;
+        while (count < CRYPTO_PIPELINE_DEPTH && spsc_pop(submitted, indices[count]))
+            count++;
+        verify_certs(indices, count);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            uint8_t index = indices[i];
+            crypto_job &job = jobs[index];
+            if (job.kind == CRYPTO_HANDSHAKE)
+                run_handshake(job);
+            else if (job.kind == CRYPTO_AUTHENTICATE)
+                run_authenticate(job);
+            else if (job.kind == CRYPTO_CHALLENGE)
+                run_challenge(job);
+            else
+                run_checkin(job);
+            spsc_push(completed, index);
+        }
+        idle = false;
+    }
+}
+
+void start_crypto_pipeline(trust_anchor &ca, mbedtls_ecdsa_context *signer, key_pool &keys)
+{
+    ca_anchor = &ca;
+    server_signer = signer;
+    session_keys = &keys;
+
+    for (int i = 0; i < CRYPTO_PIPELINE_DEPTH; i++)
+    {
+        mbedtls_ecdh_init(&jobs[i].ecdh);
+        free_jobs[i] = i;
+    }
+    free_count = CRYPTO_PIPELINE_DEPTH;
+
+    // Core 0, loop() parses the next request on core 1 meanwhile. mbedtls
+    // needs a few KB of stack for the ECDSA temporaries.
+    xTaskCreatePinnedToCore(crypto_worker, "crypto", 8192, nullptr, 2, &crypto_task, 0);
+}
+
+crypto_job *crypto_job_alloc()
+{
+    if (crypto_task == nullptr || free_count == 0)
+    {
+        crypto_counters.busy++;
+        return nullptr;
+    }
+    return &jobs[free_jobs[--free_count]];
+}
+
+void crypto_submit(crypto_job *job)
+{
+    // Never full, there are only as many jobs as slots
+    spsc_push(submitted, (uint8_t)(job - jobs));
+    crypto_counters.submitted++;
+    xTaskNotifyGive(crypto_task);
+}
+
+crypto_job *crypto_poll()
+{
+    uint8_t index;
+    if (!spsc_pop(completed, index))
+        return nullptr;
+    crypto_counters.completed++;
+    return &jobs[index];
+}
+
+void crypto_job_free(crypto_job *job)
+{
+    // Drop a key pair nobody took over
+    mbedtls_ecdh_free(&job->ecdh);
+    mbedtls_ecdh_init(&job->ecdh);
+    free_jobs[free_count++] = job - jobs;
+}
+
+uint32_t crypto_jobs_in_flight()
+{
+    return CRYPTO_PIPELINE_DEPTH - free_count;
+}
@@ -4,7 +4,7 @@
 
 mbedtls_entropy_context entropy;
 mbedtls_ctr_drbg_context ctr_drbg;
-
+mbedtls_ecp_group p256_group;
 
 
 void init_crypto_random_engine()
@@ -23,4 +23,34 @@ void init_crypto_random_engine()
         while (1)
             ;
     }
+
+    mbedtls_ecp_group_init(&p256_group);
+    ret = mbedtls_ecp_group_load(&p256_group, MBEDTLS_ECP_DP_SECP256R1);
+    if (ret != 0)
+    {
+        Serial.printf("Failed to load secp256r1: -0x%04X\n", -ret);
+        while (1)
+            ;
+    }
+
+    // With MBEDTLS_ECP_FIXED_POINT_OPTIM the comb table for G is the const
+    // one in flash and this is a no-op; otherwise the first multiplication by
+    // G builds the table and caches it in p256_group.T. Do it now so the group
+    // is never mutated once requests start using it.
+    mbedtls_mpi one;
+    mbedtls_ecp_point warmup;
+    mbedtls_mpi_init(&one);
+    mbedtls_ecp_point_init(&warmup);
+    ret = mbedtls_mpi_lset(&one, 1);
+    if (ret == 0)
+        ret = mbedtls_ecp_mul(&p256_group, &warmup, &one, &p256_group.G,
+                              mbedtls_ctr_drbg_random, &ctr_drbg);
+    mbedtls_ecp_point_free(&warmup);
+    mbedtls_mpi_free(&one);
+    if (ret != 0)
+    {
+        Serial.printf("Failed to precompute secp256r1 table: -0x%04X\n", -ret);
+        while (1)
+            ;
+    }
 }
\ No newline at end of file
@@ -1,26 +1,102 @@
 #include "ecdsa.h"
 
 #include <Arduino.h>
-#include "mbedtls/sha256.h"
 #include "mbedtls/error.h"
+#include "mbedtls/asn1.h"
+#include "mbedtls/asn1write.h"
 
+#include "crypto-backend.h"
 #include "crypto-random-engine.h"
 
+size_t point_len(uint8_t prefix)
+{
+    if (prefix == 0x04)
+        return POINT_LEN;
+    if (prefix == 0x02 || prefix == 0x03)
+        return COMPRESSED_POINT_LEN;
+    return 0;
+}
+
+size_t cert_len(const uint8_t cert[])
+{
+    return 6 + point_len(cert[6]) + 19;
+}
+
+// y = sqrt(x^3 - 3x + b) with the parity asked for; p = 3 mod 4, so the
+// root is a power. mbedtls 2.x cannot read compressed points itself.
+static int decompress_point(const uint8_t bytes[], mbedtls_ecp_point &P)
+{
+    const mbedtls_mpi &p = p256_group.P;
+    mbedtls_mpi rhs, y2, exp;
+    mbedtls_mpi_init(&rhs);
+    mbedtls_mpi_init(&y2);
+    mbedtls_mpi_init(&exp);
+
+    int ret = mbedtls_mpi_read_binary(&P.X, bytes + 1, 32);
+    if (ret == 0 && mbedtls_mpi_cmp_mpi(&P.X, &p) >= 0)
+        ret = MBEDTLS_ERR_ECP_INVALID_KEY;
+
+    // rhs = (x^2 - 3) x + b, A is left empty for curves with a = -3
+    if (ret == 0)
+        ret = mbedtls_mpi_mul_mpi(&rhs, &P.X, &P.X);
+    if (ret == 0)
+        ret = p256_group.A.p == NULL ? mbedtls_mpi_sub_int(&rhs, &rhs, 3)
+                                     : mbedtls_mpi_add_mpi(&rhs, &rhs, &p256_group.A);
+    if (ret == 0)
+        ret = mbedtls_mpi_mul_mpi(&rhs, &rhs, &P.X);
+    if (ret == 0)
+        ret = mbedtls_mpi_add_mpi(&rhs, &rhs, &p256_group.B);
+    if (ret == 0)
+        ret = mbedtls_mpi_mod_mpi(&rhs, &rhs, &p);
+
+    // y = rhs^((p + 1) / 4)
+    if (ret == 0)
+        ret = mbedtls_mpi_add_int(&exp, &p, 1);
+    if (ret == 0)
+        ret = mbedtls_mpi_shift_r(&exp, 2);
+    if (ret == 0)
+        ret = mbedtls_mpi_exp_mod(&P.Y, &rhs, &exp, &p, NULL);
+
+    // x is not on the curve if rhs has no root
+    if (ret == 0)
+        ret = mbedtls_mpi_mul_mpi(&y2, &P.Y, &P.Y);
+    if (ret == 0)
+        ret = mbedtls_mpi_mod_mpi(&y2, &y2, &p);
+    if (ret == 0 && mbedtls_mpi_cmp_mpi(&y2, &rhs) != 0)
+        ret = MBEDTLS_ERR_ECP_INVALID_KEY;
+
+    if (ret == 0 && mbedtls_mpi_get_bit(&P.Y, 0) != (bytes[0] & 1))
+        ret = mbedtls_mpi_sub_mpi(&P.Y, &p, &P.Y);
+    if (ret == 0)
+        ret = mbedtls_mpi_lset(&P.Z, 1);
+
+    mbedtls_mpi_free(&rhs);
+    mbedtls_mpi_free(&y2);
+    mbedtls_mpi_free(&exp);
+    return ret;
+}
+
+int read_point(const uint8_t bytes[], size_t len, mbedtls_ecp_point &P)
+{
+    if (len == 0 || point_len(bytes[0]) != len)
+        return MBEDTLS_ERR_ECP_BAD_INPUT_DATA;
+
+    int ret;
+    if (len == COMPRESSED_POINT_LEN)
+        ret = decompress_point(bytes, P);
+    else
+        ret = mbedtls_ecp_point_read_binary(&p256_group, &P, bytes, len);
+    if (ret == 0)
+        ret = mbedtls_ecp_check_pubkey(&p256_group, &P);
+    return ret;
+}
+
 void gen_signature_key(mbedtls_ecdsa_context &ctx)
 {
     mbedtls_ecdsa_init(&ctx);
 
-    // Load the curve (secp256r1)
-    int ret = mbedtls_ecp_group_load(&ctx.grp, MBEDTLS_ECP_DP_SECP256R1);
-    if (ret != 0)
-    {
-        Serial.printf("mbedtls_ecp_group_load failed: -0x%04x\n", -ret);
-        while (1)
-            ;
-    }
-
-    ret = mbedtls_ecp_gen_keypair(&ctx.grp, &ctx.d, &ctx.Q,
-                                  mbedtls_ctr_drbg_random, &ctr_drbg);
+    int ret = mbedtls_ecp_gen_keypair(&p256_group, &ctx.d, &ctx.Q,
+                                      mbedtls_ctr_drbg_random, &ctr_drbg);
     if (ret != 0)
     {
         Serial.printf("mbedtls_ecp_gen_keypair failed: -0x%04x\n", -ret);
@@ -66,7 +142,7 @@ int export_private_key(const mbedtls_ecdsa_context &ctx,
     mbedtls_ecdsa_context *copy_ctx = mbedtls_pk_ec(pk);
     mbedtls_ecdsa_init(copy_ctx);
 
-    int ret = mbedtls_ecp_group_copy(&copy_ctx->grp, &ctx.grp);
+    int ret = mbedtls_ecp_group_copy(&copy_ctx->grp, &p256_group);
     if (ret != 0)
     {
         Serial.printf("cannot copy group %d\n", ret);
@@ -100,11 +176,12 @@ int export_private_key(const mbedtls_ecdsa_context &ctx,
     return 0;
 }
 
-void get_public_bytes(mbedtls_ecdsa_context &ctx, uint8_t pub_key[], size_t &pub_key_len)
+void get_public_bytes(mbedtls_ecdsa_context &ctx, uint8_t pub_key[], size_t &pub_key_len,
+                      bool compressed)
 {
-    int ret = mbedtls_ecp_point_write_binary(&ctx.grp, &ctx.Q,
-                                             MBEDTLS_ECP_PF_UNCOMPRESSED,
-                                             &pub_key_len, pub_key, 65);
+    int ret = mbedtls_ecp_point_write_binary(&p256_group, &ctx.Q,
+                                             compressed ? MBEDTLS_ECP_PF_COMPRESSED : MBEDTLS_ECP_PF_UNCOMPRESSED,
+                                             &pub_key_len, pub_key, POINT_LEN);
     if (ret != 0)
     {
         Serial.printf("Failed to export public key: -0x%04X\n", -ret);
@@ -113,24 +190,70 @@ void get_public_bytes(mbedtls_ecdsa_context &ctx, uint8_t pub_key[], size_t &pub
     }
 }
 
-void cert_bytes(const uint8_t id[],
-                const uint8_t public_bytes[],
-                const uint8_t valid_until[],
-                uint8_t cert_bytes[])
+size_t cert_bytes(const uint8_t id[],
+                  const uint8_t public_bytes[],
+                  const uint8_t valid_until[],
+                  uint8_t cert_bytes[])
 {
+    size_t pub_len = point_len(public_bytes[0]);
     memcpy(cert_bytes, id, 6);
-    memcpy(cert_bytes + 6, public_bytes, 65);
-    memcpy(cert_bytes + 6 + 65, valid_until, 19);
+    memcpy(cert_bytes + 6, public_bytes, pub_len);
+    memcpy(cert_bytes + 6 + pub_len, valid_until, 19);
+    return 6 + pub_len + 19;
 }
 
-void session_bytes(const uint8_t nonce[],
-                   const uint8_t c_pub_bytes[],
-                   const uint8_t s_pub_bytes[],
-                   uint8_t session_bytes[])
+size_t session_bytes(const uint8_t nonce[],
+                     const uint8_t c_pub_bytes[],
+                     const uint8_t s_pub_bytes[],
+                     uint8_t session_bytes[])
 {
+    size_t c_pub_len = point_len(c_pub_bytes[0]);
+    size_t s_pub_len = point_len(s_pub_bytes[0]);
     memcpy(session_bytes, nonce, 12);
-    memcpy(session_bytes + 12, c_pub_bytes, 65);
-    memcpy(session_bytes + 12 + 65, s_pub_bytes, 65);
+    memcpy(session_bytes + 12, c_pub_bytes, c_pub_len);
+    memcpy(session_bytes + 12 + c_pub_len, s_pub_bytes, s_pub_len);
+    return 12 + c_pub_len + s_pub_len;
+}
+
+// Same DER layout as mbedtls_ecdsa_write_signature, so phones and the
+// central server see no difference.
+static int write_signature(const mbedtls_mpi &r, const mbedtls_mpi &s,
+                           uint8_t signature[], size_t &signature_len)
+{
+    uint8_t buf[MBEDTLS_ECDSA_MAX_LEN];
+    unsigned char *p = buf + sizeof(buf);
+    size_t len = 0;
+
+    MBEDTLS_ASN1_CHK_ADD(len, mbedtls_asn1_write_mpi(&p, buf, &s));
+    MBEDTLS_ASN1_CHK_ADD(len, mbedtls_asn1_write_mpi(&p, buf, &r));
+    MBEDTLS_ASN1_CHK_ADD(len, mbedtls_asn1_write_len(&p, buf, len));
+    MBEDTLS_ASN1_CHK_ADD(len, mbedtls_asn1_write_tag(&p, buf,
+                                                     MBEDTLS_ASN1_CONSTRUCTED | MBEDTLS_ASN1_SEQUENCE));
+
+    memcpy(signature, p, len);
+    signature_len = len;
+    return 0;
+}
+
+// return 0 if the DER signature is well formed
+static int read_signature(const uint8_t signature[], size_t signature_len,
+                          mbedtls_mpi &r, mbedtls_mpi &s)
+{
+    unsigned char *p = (unsigned char *)signature;
+    const unsigned char *end = signature + signature_len;
+    size_t len;
+
+    if (mbedtls_asn1_get_tag(&p, end, &len,
+                             MBEDTLS_ASN1_CONSTRUCTED | MBEDTLS_ASN1_SEQUENCE) != 0)
+        return -1;
+    if (p + len != end)
+        return -1;
+    if (mbedtls_asn1_get_mpi(&p, end, &r) != 0 ||
+        mbedtls_asn1_get_mpi(&p, end, &s) != 0)
+        return -1;
+    if (p != end)
+        return -1;
+    return 0;
 }
 
 void sign(mbedtls_ecdsa_context &ctx,
@@ -140,12 +263,22 @@ void sign(mbedtls_ecdsa_context &ctx,
           size_t &signature_len)
 {
     uint8_t hash[32];
-    mbedtls_sha256_ret(message, message_len, hash, 0);
+    crypto_backend::sha256(message, message_len, hash);
 
-    if (mbedtls_ecdsa_write_signature(&ctx, MBEDTLS_MD_SHA256,
-                                      hash, sizeof(hash),
-                                      signature, &signature_len,
-                                      mbedtls_ctr_drbg_random, &ctr_drbg) != 0)
+    mbedtls_mpi r, s;
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&s);
+
+    int ret = mbedtls_ecdsa_sign(&p256_group, &r, &s, &ctx.d,
+                                 hash, sizeof(hash),
+                                 mbedtls_ctr_drbg_random, &ctr_drbg);
+    if (ret == 0)
+        ret = write_signature(r, s, signature, signature_len);
+
+    mbedtls_mpi_free(&r);
+    mbedtls_mpi_free(&s);
+
+    if (ret != 0)
     {
         Serial.println("Signing failed");
         while (1)
@@ -156,31 +289,356 @@ void sign(mbedtls_ecdsa_context &ctx,
 // Return 0 if the signature is valid
 int verify(const uint8_t message[],
            size_t message_len,
-           uint8_t peer_pub_bytes[],
+           const uint8_t peer_pub_bytes[],
            const uint8_t signature[],
            size_t signature_len)
 {
-    mbedtls_ecdsa_context ctx;
-    mbedtls_ecdsa_init(&ctx);
+    mbedtls_ecp_point Q;
+    mbedtls_mpi r, s;
+    mbedtls_ecp_point_init(&Q);
+    mbedtls_mpi_init(&r);
+    mbedtls_mpi_init(&s);
 
-    if (mbedtls_ecp_group_load(&ctx.grp, MBEDTLS_ECP_DP_SECP256R1) != 0)
+    int ret = read_point(peer_pub_bytes, point_len(peer_pub_bytes[0]), Q);
+    if (ret != 0)
     {
-        Serial.println("Curve load failed");
-        while (1)
-            ;
+        Serial.printf("Public key load failed: -0x%04x\n", -ret);
+        ret = -1;
+    }
+    else if (read_signature(signature, signature_len, r, s) != 0)
+    {
+        Serial.println("Signature parse failed");
+        ret = -1;
+    }
+    else
+    {
+        uint8_t hash[32];
+        crypto_backend::sha256(message, message_len, hash);
+
+        ret = mbedtls_ecdsa_verify(&p256_group, hash, sizeof(hash), &Q, &r, &s);
     }
 
-    int ret = mbedtls_ecp_point_read_binary(&ctx.grp, &ctx.Q, peer_pub_bytes, 65);
+    mbedtls_ecp_point_free(&Q);
+    mbedtls_mpi_free(&r);
+    mbedtls_mpi_free(&s);
+    return ret;
+}
+
+
+// return 0 if the CA public bytes are a valid point
+int load_trust_anchor(trust_anchor &anchor, const uint8_t ca_pub_bytes[])
+{
+    anchor.loaded = false;
+    mbedtls_ecp_group_init(&anchor.grp);
+
+    int ret = mbedtls_ecp_group_load(&anchor.grp, MBEDTLS_ECP_DP_SECP256R1);
     if (ret != 0)
     {
-        Serial.printf("Public key load failed: -0x%04x\n", -ret);
-        return -1;
+        Serial.printf("Trust anchor curve load failed: -0x%04x\n", -ret);
+        return ret;
     }
 
-    uint8_t hash[32];
-    mbedtls_sha256_ret(message, message_len, hash, 0);
+    mbedtls_ecp_point Q;
+    mbedtls_ecp_point_init(&Q);
+    size_t pub_len = point_len(ca_pub_bytes[0]);
+    ret = read_point(ca_pub_bytes, pub_len, Q);
+    if (ret != 0)
+    {
+        Serial.printf("Invalid CA public key: -0x%04x\n", -ret);
+        mbedtls_ecp_point_free(&Q);
+        mbedtls_ecp_group_free(&anchor.grp);
+        return ret;
+    }
+
+    // The freshly loaded table belongs to G; it is either the const one in
+    // flash (T_size == 0) or not built yet, so dropping it leaks nothing.
+    anchor.grp.T = NULL;
+    anchor.grp.T_size = 0;
+    ret = mbedtls_ecp_copy(&anchor.grp.G, &Q);
+    mbedtls_ecp_point_free(&Q);
+    if (ret != 0)
+    {
+        mbedtls_ecp_group_free(&anchor.grp);
+        return ret;
+    }
+
+#if MBEDTLS_ECP_FIXED_POINT_OPTIM != 1
+#warning "MBEDTLS_ECP_FIXED_POINT_OPTIM is off, the CA comb table is rebuilt on every verify"
+#endif
+
+    // Multiplying by "G" once builds the comb table for Q_CA and caches it in
+    // anchor.grp.T, so no request ever pays for it.
+    mbedtls_mpi one;
+    mbedtls_ecp_point warmup;
+    mbedtls_mpi_init(&one);
+    mbedtls_ecp_point_init(&warmup);
+    ret = mbedtls_mpi_lset(&one, 1);
+    if (ret == 0)
+        ret = mbedtls_ecp_mul(&anchor.grp, &warmup, &one, &anchor.grp.G,
+                              mbedtls_ctr_drbg_random, &ctr_drbg);
+    mbedtls_ecp_point_free(&warmup);
+    mbedtls_mpi_free(&one);
+    if (ret != 0)
+    {
+        Serial.printf("Trust anchor table failed: -0x%04x\n", -ret);
+        mbedtls_ecp_group_free(&anchor.grp);
+        return ret;
+    }
+
+    memcpy(anchor.pub_bytes, ca_pub_bytes, pub_len);
+    anchor.loaded = true;
+    return 0;
+}
+
+static int mul_mod(mbedtls_mpi &X, const mbedtls_mpi &A, const mbedtls_mpi &B, const mbedtls_mpi &m)
+{
+    int ret = mbedtls_mpi_mul_mpi(&X, &A, &B);
+    if (ret == 0)
+        ret = mbedtls_mpi_mod_mpi(&X, &X, &m);
+    return ret;
+}
+
+// Return 0 if x(R1 + R2) mod n == r, for affine R1 and R2. The sum is left
+// in Jacobian coordinates: with H = x2 - x1 it has X3 = rr^2 - H^3 -
+// 2 x1 H^2 and Z3 = H, so x = X3 / H^2 and the test is X3 == r H^2, or
+// (r + n) H^2 while r + n < p. The sum costs no
+// inversion mod p (R1 and R2 already cost one each in mbedtls_ecp_mul).
+static int check_sum_x(mbedtls_ecp_point &R1, mbedtls_ecp_point &R2, const mbedtls_mpi &r)
+{
+    const mbedtls_mpi &P = p256_group.P;
+    const mbedtls_mpi &N = p256_group.N;
+    mbedtls_mpi H, rr, H2, t, x3;
+    mbedtls_ecp_point sum;
+    mbedtls_mpi_init(&H);
+    mbedtls_mpi_init(&rr);
+    mbedtls_mpi_init(&H2);
+    mbedtls_mpi_init(&t);
+    mbedtls_mpi_init(&x3);
+    mbedtls_ecp_point_init(&sum);
+
+    int ret = 0;
+    mbedtls_ecp_point *single = nullptr;
+    if (mbedtls_ecp_is_zero(&R1))
+        single = &R2;
+    else if (mbedtls_ecp_is_zero(&R2))
+        single = &R1;
+
+    if (single == nullptr)
+    {
+        ret = mbedtls_mpi_sub_mpi(&H, &R2.X, &R1.X);
+        if (ret == 0)
+            ret = mbedtls_mpi_mod_mpi(&H, &H, &P);
+        if (ret == 0 && mbedtls_mpi_cmp_int(&H, 0) == 0)
+        {
+            // R1 == +-R2: the sum doubles or vanishes, let mbedtls sort it out
+            ret = mbedtls_mpi_lset(&t, 1);
+            if (ret == 0)
+                ret = mbedtls_ecp_muladd(&p256_group, &sum, &t, &R1, &t, &R2);
+            single = &sum;
+        }
+    }
+
+    if (ret == 0 && single != nullptr)
+    {
+        if (mbedtls_ecp_is_zero(single))
+            ret = MBEDTLS_ERR_ECP_VERIFY_FAILED;
+        if (ret == 0)
+            ret = mbedtls_mpi_mod_mpi(&t, &single->X, &N);
+        if (ret == 0 && mbedtls_mpi_cmp_mpi(&t, &r) != 0)
+            ret = MBEDTLS_ERR_ECP_VERIFY_FAILED;
+    }
+    else if (ret == 0)
+    {
+        ret = mbedtls_mpi_sub_mpi(&rr, &R2.Y, &R1.Y);
+        if (ret == 0)
+            ret = mul_mod(H2, H, H, P);
+        // x3 = rr^2 - H^3 - 2 x1 H^2
+        if (ret == 0)
+            ret = mul_mod(x3, rr, rr, P);
+        if (ret == 0)
+            ret = mul_mod(t, H2, H, P);
+        if (ret == 0)
+            ret = mbedtls_mpi_sub_mpi(&x3, &x3, &t);
+        if (ret == 0)
+            ret = mul_mod(t, R1.X, H2, P);
+        if (ret == 0)
+            ret = mbedtls_mpi_shift_l(&t, 1);
+        if (ret == 0)
+            ret = mbedtls_mpi_sub_mpi(&x3, &x3, &t);
+        if (ret == 0)
+            ret = mbedtls_mpi_mod_mpi(&x3, &x3, &P);
+
+        if (ret == 0)
+            ret = mul_mod(t, r, H2, P);
+        if (ret == 0 && mbedtls_mpi_cmp_mpi(&t, &x3) != 0)
+        {
+            ret = mbedtls_mpi_add_mpi(&t, &r, &N);
+            if (ret == 0 && mbedtls_mpi_cmp_mpi(&t, &P) >= 0)
+                ret = MBEDTLS_ERR_ECP_VERIFY_FAILED;
+            if (ret == 0)
+                ret = mul_mod(t, t, H2, P);
+            if (ret == 0 && mbedtls_mpi_cmp_mpi(&t, &x3) != 0)
+                ret = MBEDTLS_ERR_ECP_VERIFY_FAILED;
+        }
+    }
 
-    ret = mbedtls_ecdsa_read_signature(&ctx, hash, sizeof(hash), signature, signature_len);
-    mbedtls_ecdsa_free(&ctx);
+    mbedtls_mpi_free(&H);
+    mbedtls_mpi_free(&rr);
+    mbedtls_mpi_free(&H2);
+    mbedtls_mpi_free(&t);
+    mbedtls_mpi_free(&x3);
+    mbedtls_ecp_point_free(&sum);
     return ret;
-}
\ No newline at end of file
+}
+
+// u1*G + u2*Q for every signature that parsed, after one inversion mod n
+// for all their s (Montgomery's trick). Q_CA and G come from their cached
+// comb tables; any other key is decoded and multiplied on its own.
+int verify_batch(trust_anchor &anchor, const verify_item items[], size_t count, int results[])
+{
+    if (count > VERIFY_BATCH_MAX)
+    {
+        int first = verify_batch(anchor, items, VERIFY_BATCH_MAX, results);
+        int rest = verify_batch(anchor, items + VERIFY_BATCH_MAX, count - VERIFY_BATCH_MAX,
+                                results + VERIFY_BATCH_MAX);
+        return first != 0 ? first : rest;
+    }
+
+    const mbedtls_mpi &N = p256_group.N;
+    mbedtls_mpi r[VERIFY_BATCH_MAX], s[VERIFY_BATCH_MAX], e[VERIFY_BATCH_MAX], acc[VERIFY_BATCH_MAX];
+    mbedtls_mpi inv, t, u1, u2;
+    mbedtls_ecp_point R1, R2, Q;
+    for (size_t i = 0; i < count; i++)
+    {
+        mbedtls_mpi_init(&r[i]);
+        mbedtls_mpi_init(&s[i]);
+        mbedtls_mpi_init(&e[i]);
+        mbedtls_mpi_init(&acc[i]);
+    }
+    mbedtls_mpi_init(&inv);
+    mbedtls_mpi_init(&t);
+    mbedtls_mpi_init(&u1);
+    mbedtls_mpi_init(&u2);
+    mbedtls_ecp_point_init(&R1);
+    mbedtls_ecp_point_init(&R2);
+    mbedtls_ecp_point_init(&Q);
+
+    // Items that parsed, in order; the others keep their failure
+    uint8_t live[VERIFY_BATCH_MAX];
+    size_t live_count = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const verify_item &item = items[i];
+        results[i] = MBEDTLS_ERR_ECP_VERIFY_FAILED;
+        if (item.pub_bytes == nullptr && !anchor.loaded)
+            continue;
+        if (read_signature(item.signature, item.signature_len, r[i], s[i]) != 0 ||
+            mbedtls_mpi_cmp_int(&r[i], 1) < 0 || mbedtls_mpi_cmp_mpi(&r[i], &N) >= 0 ||
+            mbedtls_mpi_cmp_int(&s[i], 1) < 0 || mbedtls_mpi_cmp_mpi(&s[i], &N) >= 0)
+            continue;
+
+        // e = H(m) mod n
+        uint8_t hash[32];
+        crypto_backend::sha256(item.message, item.message_len, hash);
+        int ret = mbedtls_mpi_read_binary(&e[i], hash, sizeof(hash));
+        if (ret == 0 && mbedtls_mpi_cmp_mpi(&e[i], &N) >= 0)
+            ret = mbedtls_mpi_sub_mpi(&e[i], &e[i], &N);
+        if (ret != 0)
+        {
+            results[i] = ret;
+            continue;
+        }
+        live[live_count++] = i;
+    }
+
+    // acc[k] = s_0 * ... * s_k over the live items, inverted once. Walking
+    // back, inv = 1 / acc[k], so 1 / s_k = inv * acc[k - 1] and
+    // 1 / acc[k - 1] = inv * s_k. Each s is replaced by its inverse.
+    int ret = 0;
+    for (size_t k = 0; k < live_count && ret == 0; k++)
+    {
+        if (k == 0)
+            ret = mbedtls_mpi_copy(&acc[0], &s[live[0]]);
+        else
+            ret = mul_mod(acc[k], acc[k - 1], s[live[k]], N);
+    }
+    if (ret == 0 && live_count > 0)
+        ret = mbedtls_mpi_inv_mod(&inv, &acc[live_count - 1], &N);
+    for (size_t k = live_count; k-- > 1 && ret == 0;)
+    {
+        mbedtls_mpi &s_k = s[live[k]];
+        ret = mul_mod(t, inv, acc[k - 1], N);
+        if (ret == 0)
+            ret = mul_mod(inv, inv, s_k, N);
+        if (ret == 0)
+            ret = mbedtls_mpi_copy(&s_k, &t);
+    }
+    if (ret == 0 && live_count > 0)
+        ret = mbedtls_mpi_copy(&s[live[0]], &inv);
+
+    for (size_t k = 0; k < live_count; k++)
+    {
+        size_t i = live[k];
+        const verify_item &item = items[i];
+        if (ret != 0)
+        {
+            results[i] = ret;
+            continue;
+        }
+
+        // u1 = e / s, u2 = r / s
+        int status = mul_mod(u1, e[i], s[i], N);
+        if (status == 0)
+            status = mul_mod(u2, r[i], s[i], N);
+        if (status == 0)
+            status = mbedtls_ecp_mul(&p256_group, &R1, &u1, &p256_group.G,
+                                     mbedtls_ctr_drbg_random, &ctr_drbg);
+        if (status == 0 && item.pub_bytes == nullptr)
+        {
+            status = mbedtls_ecp_mul(&anchor.grp, &R2, &u2, &anchor.grp.G,
+                                     mbedtls_ctr_drbg_random, &ctr_drbg);
+        }
+        else if (status == 0)
+        {
+            status = read_point(item.pub_bytes, point_len(item.pub_bytes[0]), Q);
+            if (status == 0)
+                status = mbedtls_ecp_mul(&p256_group, &R2, &u2, &Q,
+                                         mbedtls_ctr_drbg_random, &ctr_drbg);
+        }
+        if (status == 0)
+            status = check_sum_x(R1, R2, r[i]);
+        results[i] = status;
+    }
+
+    int batch_status = 0;
+    for (size_t i = 0; i < count && batch_status == 0; i++)
+        batch_status = results[i];
+
+    for (size_t i = 0; i < count; i++)
+    {
+        mbedtls_mpi_free(&r[i]);
+        mbedtls_mpi_free(&s[i]);
+        mbedtls_mpi_free(&e[i]);
+        mbedtls_mpi_free(&acc[i]);
+    }
+    mbedtls_mpi_free(&inv);
+    mbedtls_mpi_free(&t);
+    mbedtls_mpi_free(&u1);
+    mbedtls_mpi_free(&u2);
+    mbedtls_ecp_point_free(&R1);
+    mbedtls_ecp_point_free(&R2);
+    mbedtls_ecp_point_free(&Q);
+    return batch_status;
+}
+
+// Return 0 if the signature is valid, a batch of one
+int verify(trust_anchor &anchor,
+           const uint8_t message[],
+           size_t message_len,
+           const uint8_t signature[],
+           size_t signature_len)
+{
+    verify_item item = {message, message_len, nullptr, signature, signature_len};
+    int result;
+    return verify_batch(anchor, &item, 1, &result);
+}
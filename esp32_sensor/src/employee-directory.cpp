@@ -0,0 +1,94 @@
+#include "employee-directory.h"
+
+#include <string.h>
+
+directory_stats directory_counters;
+
+// return the index of id, or where it would go
+static size_t lower_bound(const employee_directory &dir, const uint8_t id[])
+{
+    size_t low = 0;
+    size_t high = dir.count;
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        if (memcmp(dir.entries[mid].id, id, 6) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+void clear_directory(employee_directory &dir)
+{
+    dir.count = 0;
+    dir.version = 0;
+    dir.loaded = false;
+}
+
+bool put_employee(employee_directory &dir, const uint8_t id[], uint16_t employee)
+{
+    size_t at = lower_bound(dir, id);
+    if (at < dir.count && memcmp(dir.entries[at].id, id, 6) == 0)
+    {
+        dir.entries[at].employee = employee;
+        return true;
+    }
+    if (dir.count == DIRECTORY_MAX)
+        return false;
+
+    memmove(&dir.entries[at + 1], &dir.entries[at], (dir.count - at) * sizeof(directory_entry));
+    memcpy(dir.entries[at].id, id, 6);
+    dir.entries[at].employee = employee;
+    dir.count++;
+    return true;
+}
+
+void remove_employee(employee_directory &dir, const uint8_t id[])
+{
+    size_t at = lower_bound(dir, id);
+    if (at == dir.count || memcmp(dir.entries[at].id, id, 6) != 0)
+        return;
+    memmove(&dir.entries[at], &dir.entries[at + 1], (dir.count - at - 1) * sizeof(directory_entry));
+    dir.count--;
+}
+
+uint16_t find_employee(const employee_directory &dir, const uint8_t id[])
+{
+    size_t at = lower_bound(dir, id);
+    if (at == dir.count || memcmp(dir.entries[at].id, id, 6) != 0)
+        return 0;
+    return dir.entries[at].employee;
+}
+
+void clear_presence(presence_map &presence)
+{
+    presence.day = 0;
+    memset(presence.bits, 0, sizeof(presence.bits));
+}
+
+bool mark_present(presence_map &presence, uint16_t employee, uint32_t now)
+{
+    uint32_t day = now / 86400;
+    if (day != presence.day)
+    {
+        memset(presence.bits, 0, sizeof(presence.bits));
+        presence.day = day;
+    }
+    if (employee >= PRESENCE_MAX_EMPLOYEE)
+        return false;
+
+    uint8_t mask = 1 << (employee % 8);
+    bool present = presence.bits[employee / 8] & mask;
+    presence.bits[employee / 8] |= mask;
+    return present;
+}
+
+uint32_t present_count(const presence_map &presence)
+{
+    uint32_t count = 0;
+    for (size_t i = 0; i < sizeof(presence.bits); i++)
+        count += __builtin_popcount(presence.bits[i]);
+    return count;
+}
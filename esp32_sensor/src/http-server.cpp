@@ -0,0 +1,416 @@
+#include "http-server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static const char *status_text(int code)
+{
+    switch (code)
+    {
+    case 200: return "OK";
+    case 303: return "See Other";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 409: return "Conflict";
+    case 413: return "Payload Too Large";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default: return "";
+    }
+}
+
+static void write_response(http_server &server, http_connection &conn, int code,
+                           const char *content_type, const char *body, size_t body_len)
+{
+    int head = snprintf(server.tx, sizeof(server.tx),
+                        "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %u\r\nConnection: %s\r\n\r\n",
+                        code, status_text(code), content_type, (unsigned)body_len,
+                        conn.keep_alive ? "keep-alive" : "close");
+
+    // One segment for the usual small reply, two writes otherwise
+    if (head + body_len <= sizeof(server.tx))
+    {
+        memcpy(server.tx + head, body, body_len);
+        conn.client.write((const uint8_t *)server.tx, head + body_len);
+    }
+    else
+    {
+        conn.client.write((const uint8_t *)server.tx, head);
+        conn.client.write((const uint8_t *)body, body_len);
+    }
+}
+
+static void close_connection(http_connection &conn)
+{
+    conn.client.stop();
+    conn.open = false;
+    conn.deferred = false;
+    conn.len = 0;
+    conn.header_len = 0;
+}
+
+// answer a request that never reached a handler and hang up
+static void reject(http_server &server, http_connection &conn, int code)
+{
+    conn.keep_alive = false;
+    write_response(server, conn, code, "text/plain", status_text(code), strlen(status_text(code)));
+    close_connection(conn);
+}
+
+// Parse the request line and the headers in buf[0, header_len), return 0 or
+// the status to reject the request with
+static int parse_head(http_connection &conn)
+{
+    char *line = conn.buf;
+    char *head_end = conn.buf + conn.header_len - 2;
+    char *eol = strstr(line, "\r\n");
+    *eol = '\0';
+
+    // METHOD SP target SP version
+    char *target = strchr(line, ' ');
+    if (target == nullptr)
+        return 400;
+    *target++ = '\0';
+    char *version = strchr(target, ' ');
+    if (version == nullptr || target[0] != '/')
+        return 400;
+    *version++ = '\0';
+
+    if (strcmp(line, "GET") == 0)
+        conn.method = HTTP_METHOD_GET;
+    else if (strcmp(line, "POST") == 0)
+        conn.method = HTTP_METHOD_POST;
+    else
+        conn.method = HTTP_METHOD_OTHER;
+
+    char *query = strchr(target, '?');
+    if (query != nullptr)
+        *query = '\0';
+    conn.path = target;
+
+    if (strcmp(version, "HTTP/1.1") == 0)
+        conn.keep_alive = true;
+    else if (strcmp(version, "HTTP/1.0") == 0)
+        conn.keep_alive = false;
+    else
+        return 400;
+
+    conn.content_length = 0;
+    conn.content_type = "";
+    conn.accept = "";
+    for (line = eol + 2; line < head_end; line = eol + 2)
+    {
+        eol = strstr(line, "\r\n");
+        *eol = '\0';
+
+        char *value = strchr(line, ':');
+        if (value == nullptr)
+            return 400;
+        *value++ = '\0';
+        while (*value == ' ' || *value == '\t')
+            value++;
+
+        if (strcasecmp(line, "Content-Length") == 0)
+            conn.content_length = strtoul(value, nullptr, 10);
+        else if (strcasecmp(line, "Content-Type") == 0)
+            conn.content_type = value;
+        else if (strcasecmp(line, "Accept") == 0)
+            conn.accept = value;
+        else if (strcasecmp(line, "Connection") == 0)
+        {
+            if (strcasecmp(value, "close") == 0)
+                conn.keep_alive = false;
+            else if (strcasecmp(value, "keep-alive") == 0)
+                conn.keep_alive = true;
+        }
+        else if (strcasecmp(line, "Transfer-Encoding") == 0)
+            return 501; // nobody sends chunked bodies to a door sensor
+    }
+
+    if (conn.content_length > HTTP_REQUEST_MAX - conn.header_len)
+        return 413;
+    return 0;
+}
+
+static void dispatch(http_server &server, http_connection &conn)
+{
+    size_t end = conn.header_len + conn.content_length;
+
+    // Handlers get a nul terminated body; a pipelined request may start
+    // right after it, so the byte is put back afterwards
+    char saved = conn.buf[end];
+    conn.buf[end] = '\0';
+
+    server.current = &conn;
+    server.method = conn.method;
+    server.content_type = conn.content_type;
+    server.accept = conn.accept;
+    server.remote_ip = conn.remote_ip;
+    server.body = conn.buf + conn.header_len;
+    server.body_len = conn.content_length;
+    server.replied = false;
+
+    bool known_path = false;
+    conn.route = -1;
+    for (size_t i = 0; i < server.route_count; i++)
+    {
+        if (strcmp(server.routes[i].path, conn.path) != 0)
+            continue;
+        known_path = true;
+        if (server.routes[i].method == conn.method)
+        {
+            conn.route = i;
+            break;
+        }
+    }
+
+    if (conn.route >= 0)
+    {
+        server.routes[conn.route].requests++;
+        server.routes[conn.route].handler();
+    }
+    else if (known_path)
+        http_send(server, 405, "text/plain", "Method Not Allowed");
+    else
+        http_send(server, 404, "text/plain", "Not Found");
+
+    if (!server.replied)
+        http_send(server, 500, "text/plain", "No reply");
+
+    server.current = nullptr;
+    conn.buf[end] = saved;
+}
+
+// Drop the request just served, keeping whatever the client pipelined
+static void next_request(http_connection &conn, unsigned long now)
+{
+    size_t consumed = conn.header_len + conn.content_length;
+    memmove(conn.buf, conn.buf + consumed, conn.len - consumed);
+    conn.len -= consumed;
+    conn.header_len = 0;
+    conn.content_length = 0;
+    conn.request_started = now;
+    conn.idle_since = now;
+}
+
+// Count the request just answered and get ready for the next one
+static void finish_request(http_connection &conn, unsigned long now)
+{
+    conn.served++;
+    if (conn.keep_alive)
+        next_request(conn, now);
+    else
+        close_connection(conn);
+}
+
+static void respond(http_server &server, http_connection &conn, int code,
+                    const char *content_type, const char *body, size_t body_len)
+{
+    if (conn.served + 1 >= HTTP_MAX_REQUESTS_PER_CONNECTION)
+        conn.keep_alive = false;
+    if (conn.route >= 0 && (code < 200 || code > 299))
+        server.routes[conn.route].errors++;
+    write_response(server, conn, code, content_type, body, body_len);
+}
+
+static void service(http_server &server, http_connection &conn, unsigned long now)
+{
+    // Its reply comes from http_reply(), nothing to read until then
+    if (conn.deferred)
+        return;
+
+    int available = conn.client.available();
+    if (available > 0)
+    {
+        size_t room = HTTP_REQUEST_MAX - conn.len;
+        if (room == 0)
+        {
+            reject(server, conn, 413);
+            server.rejected++;
+            return;
+        }
+        if (conn.len == 0)
+            conn.request_started = now;
+
+        int n = conn.client.read((uint8_t *)conn.buf + conn.len, (size_t)available < room ? available : room);
+        if (n > 0)
+            conn.len += n;
+    }
+    else if (conn.len == 0 && !conn.client.connected())
+    {
+        close_connection(conn);
+        return;
+    }
+
+    if (conn.header_len == 0 && conn.len > 0)
+    {
+        conn.buf[conn.len] = '\0';
+        char *head_end = strstr(conn.buf, "\r\n\r\n");
+        if (head_end != nullptr)
+        {
+            conn.header_len = head_end + 4 - conn.buf;
+            int status = parse_head(conn);
+            if (status != 0)
+            {
+                reject(server, conn, status);
+                server.rejected++;
+                return;
+            }
+        }
+        else if (conn.len == HTTP_REQUEST_MAX)
+        {
+            reject(server, conn, 413);
+            server.rejected++;
+            return;
+        }
+    }
+
+    if (conn.header_len == 0 || conn.len < conn.header_len + conn.content_length)
+    {
+        if (conn.len > 0 && now - conn.request_started > HTTP_READ_TIMEOUT_MS)
+        {
+            reject(server, conn, 408);
+            server.timed_out++;
+        }
+        else if (conn.len == 0 && now - conn.idle_since > HTTP_IDLE_TIMEOUT_MS)
+            close_connection(conn);
+        else if (available <= 0 && !conn.client.connected())
+            close_connection(conn); // gone halfway through a request
+        return;
+    }
+
+    if (conn.served > 0)
+        server.reused++;
+    server.requests++;
+    dispatch(server, conn);
+
+    if (!conn.deferred)
+        finish_request(conn, now);
+}
+
+// Take a new client if one is waiting, making room by closing the longest
+// idle kept-alive connection when every slot is taken. Connections that have
+// not sent their first request yet, or are between the two protocol steps,
+// are left alone.
+static void accept_client(http_server &server, unsigned long now)
+{
+    if (!server.listener.hasClient())
+        return;
+
+    http_connection *slot = nullptr;
+    http_connection *idlest = nullptr;
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS && slot == nullptr; i++)
+    {
+        http_connection &conn = server.conns[i];
+        if (!conn.open)
+            slot = &conn;
+        else if (conn.served > 0 && conn.len == 0 && now - conn.idle_since > HTTP_EVICT_IDLE_MS &&
+                 (idlest == nullptr || conn.idle_since < idlest->idle_since))
+            idlest = &conn;
+    }
+    if (slot == nullptr)
+    {
+        // Everyone is mid-request, the client waits in the backlog
+        if (idlest == nullptr)
+            return;
+        close_connection(*idlest);
+        server.evicted++;
+        slot = idlest;
+    }
+
+    slot->client = server.listener.available();
+    if (!slot->client)
+        return;
+    slot->client.setNoDelay(true);
+    slot->remote_ip = slot->client.remoteIP();
+    slot->open = true;
+    slot->len = 0;
+    slot->header_len = 0;
+    slot->content_length = 0;
+    slot->served = 0;
+    slot->generation++;
+    slot->deferred = false;
+    slot->request_started = now;
+    slot->idle_since = now;
+    server.accepted++;
+}
+
+void http_begin(http_server &server, uint16_t port)
+{
+    server.listener.begin(port);
+    server.listener.setNoDelay(true);
+}
+
+void http_on(http_server &server, const char *path, http_method method, http_handler handler)
+{
+    if (server.route_count == HTTP_MAX_ROUTES)
+        return;
+    server.routes[server.route_count++] = {path, method, handler, 0, 0};
+}
+
+void http_poll(http_server &server, unsigned long now)
+{
+    server.now = now;
+    accept_client(server, now);
+
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+    {
+        if (server.conns[i].open)
+            service(server, server.conns[i], now);
+    }
+}
+
+void http_send(http_server &server, int code, const char *content_type, const char *body, size_t body_len)
+{
+    http_connection *conn = server.current;
+    if (conn == nullptr || server.replied)
+        return;
+    server.replied = true;
+    respond(server, *conn, code, content_type, body, body_len);
+}
+
+void http_send(http_server &server, int code, const char *content_type, const char *body)
+{
+    http_send(server, code, content_type, body, strlen(body));
+}
+
+http_ticket http_defer(http_server &server)
+{
+    http_connection *conn = server.current;
+    conn->deferred = true;
+    server.replied = true;
+    return {(uint8_t)(conn - server.conns), conn->generation};
+}
+
+bool http_reply(http_server &server, const http_ticket &ticket, int code,
+                const char *content_type, const char *body, size_t body_len)
+{
+    if (ticket.slot >= HTTP_MAX_CONNECTIONS)
+        return false;
+    http_connection &conn = server.conns[ticket.slot];
+    if (!conn.open || !conn.deferred || conn.generation != ticket.generation)
+        return false;
+
+    conn.deferred = false;
+    respond(server, conn, code, content_type, body, body_len);
+    finish_request(conn, server.now);
+    return true;
+}
+
+uint32_t http_open_connections(const http_server &server)
+{
+    uint32_t open = 0;
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++)
+    {
+        if (server.conns[i].open)
+            open++;
+    }
+    return open;
+}
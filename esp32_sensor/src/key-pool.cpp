@@ -0,0 +1,41 @@
+#include "key-pool.h"
+
+#include <string.h>
+#include "ecdh-aes.h"
+
+void init_key_pool(key_pool &pool)
+{
+    memset(&pool, 0, sizeof(pool));
+    for (int i = 0; i < KEY_POOL_SIZE; i++)
+        mbedtls_ecdh_init(&pool.keys[i]);
+}
+
+bool refill_key_pool(key_pool &pool)
+{
+    if (pool.depth == KEY_POOL_SIZE)
+        return false;
+
+    gen_key(pool.keys[(pool.head + pool.depth) % KEY_POOL_SIZE]);
+    pool.depth++;
+    return true;
+}
+
+void take_key(key_pool &pool, mbedtls_ecdh_context &ctx)
+{
+    if (pool.depth == 0)
+    {
+        pool.misses++;
+        gen_key(ctx);
+        return;
+    }
+
+    // Move the context, its MPIs now belong to ctx
+    mbedtls_ecdh_context &ready = pool.keys[pool.head];
+    mbedtls_ecdh_free(&ctx);
+    ctx = ready;
+    mbedtls_ecdh_init(&ready);
+
+    pool.head = (pool.head + 1) % KEY_POOL_SIZE;
+    pool.depth--;
+    pool.hits++;
+}
@@ -1,19 +1,34 @@
 #include <Arduino.h>
 #include <WiFi.h>
-#include <WebServer.h>
 #include <ArduinoJson.h>
-#include <map>
 #include <HTTPClient.h>
 #include "ecdsa.h"
 #include "ecdh-aes.h"
 #include "crypto-random-engine.h"
+#include "cert-cache.h"
+#include "wall-clock.h"
+#include "session-table.h"
+#include "key-pool.h"
+#include "checkin-queue.h"
+#include "checkin-journal.h"
+#include "http-server.h"
+#include "crypto-pipeline.h"
+#include "sensor-events.h"
+#include "wire-codec.h"
+#include "text-buffer.h"
+#include "metrics.h"
+#include "resume-ticket.h"
+#include "challenge.h"
+#include "revocation-list.h"
+#include "employee-directory.h"
+#include "admission.h"
 
 #include "FS.h"
 #include "SPIFFS.h"
 
 bool already_setup;
 
-WebServer server(80);
+http_server server;
 
 String internal_wifi_ssid;
 String internal_wifi_password;
@@ -28,19 +43,56 @@ mbedtls_ecdsa_context *server_ecdsa;
 String server_pub_key;
 String server_valid_until;
 String server_cert_signature;
+// The same cert as raw bytes, for binary handshake replies
+uint8_t server_cert[CERT_MAX_LEN];
+uint8_t server_cert_signature_bytes[WIRE_MAX_SIGNATURE];
+size_t server_cert_signature_len;
+// The parts of the JSON handshake reply that never change, written once by
+// load_config(); finish_handshake() fills in the rest into json_reply
+char handshake_reply_head[256];
+size_t handshake_reply_head_len;
+char handshake_reply_tail[192];
+size_t handshake_reply_tail_len;
+char json_reply[768];
+char stats_reply[2048];
+char metrics_reply[10240];
 String ca_pub;
+trust_anchor ca_anchor;
+String ntp_server;
 
-std::map<String, mbedtls_ecdh_context> sessions_ecdh;
-std::map<String, String> sessions_s_nonce;
+cert_cache verified_certs;
+
+// How long a phone has between /handshake and /authenticate
+const unsigned long DEFAULT_SESSION_TTL_MS = 30000;
+session_table sessions;
+unsigned long session_ttl_ms = DEFAULT_SESSION_TTL_MS;
+
+// Ephemeral keys generated ahead, owned by the crypto task once it runs
+key_pool session_keys;
+
+// Sealed tickets that let a phone skip the public key work next time
+ticket_keys tickets;
+
+// Signed ahead for one request check-ins through /checkin
+challenge_board challenges;
+
+// Cert ids the central server revoked, refreshed by the checkin task
+revocation_list revoked_certs;
+
+// Who may check in and who already did today, for an answer at the door
+// without waiting for the central server
+employee_directory employees;
+presence_map presence;
+
+// Rate limits in front of the requests that start ECC work
+admission_control admission;
 
 // Pin definitions
 const int SENSOR_PIN = 22;   // MH Infrared Obstacle Sensor OUT pin
 const int RED_LED_PIN = 19;  // Red LED pin
 const int BLUE_LED_PIN = 18; // Blue LED pin
 
-// Variables
-bool lastSensorState = HIGH;
-unsigned long lastDetectionTime = 0;
+// Detections closer together than this are the same person
 const unsigned long DEBOUNCE_DELAY = 2000;
 
 // LED timing variables
@@ -52,12 +104,15 @@ bool motionDetected = false;
 unsigned long motionStartTime = 0;
 const unsigned long MOTION_WAIT_TIMEOUT = 6000; // 6 seconds
 
-void hexToBytes(const char *hex, uint8_t *bytes, size_t len)
+// Debug print of a byte string, without building a String for it
+void print_hex(const uint8_t *data, size_t len)
 {
-    for (size_t i = 0; i < len; i++)
-    {
-        sscanf(hex + 2 * i, "%2hhx", &bytes[i]);
-    }
+    char hex[2 * 80];
+    if (len > 80)
+        len = 80;
+    hex_encode(data, len, hex);
+    Serial.write((const uint8_t *)hex, 2 * len);
+    Serial.println();
 }
 
 String bytesToHex(const uint8_t *data, size_t len)
@@ -156,187 +211,932 @@ void esp32_signup(String server_ip, String id, String token)
     Serial.println("server_cert_signature written");
 }
 
-void handle_handshake()
+// Decode a hex string field of exactly len bytes, false if missing or malformed
+bool json_hex(JsonVariantConst field, uint8_t bytes[], size_t len)
 {
-    if (server.method() != HTTP_POST)
+    const char *hex = field | "";
+    return hex_decode(hex, strlen(hex), bytes, len);
+}
+
+// Decode a hex SEC1 point in either format, false if malformed
+bool hex_point(const char *hex, size_t hex_len, uint8_t point[])
+{
+    size_t len = hex_len / 2;
+    if (len != POINT_LEN && len != COMPRESSED_POINT_LEN)
+        return false;
+    return hex_decode(hex, hex_len, point, len) && point_len(point[0]) == len;
+}
+
+bool json_point(JsonVariantConst field, uint8_t point[])
+{
+    const char *hex = field | "";
+    return hex_point(hex, strlen(hex), point);
+}
+
+// Decode a hex DER signature of at most WIRE_MAX_SIGNATURE bytes
+bool json_signature(JsonVariantConst field, uint8_t signature[], size_t &signature_len)
+{
+    const char *hex = field | "";
+    size_t hex_len = strlen(hex);
+    if (hex_len > 2 * WIRE_MAX_SIGNATURE)
+        return false;
+    signature_len = hex_len / 2;
+    return hex_decode(hex, hex_len, signature, signature_len);
+}
+
+// Fill the cert or cert_ref of request, return nullptr or the error to send
+const char *parse_cert_json(JsonDocument &doc, wire_handshake &request)
+{
+    request.has_cert_ref = doc.containsKey("cert_ref");
+    if (request.has_cert_ref)
     {
-        server.send(405, "text/plain", "Method Not Allowed");
-        return;
+        // The phone already presented this cert here and only sends its digest
+        if (!json_hex(doc["cert_ref"], request.cert_ref, 32))
+            return "{\"error\":\"Invalid cert_ref\"}";
     }
+    else
+    {
+        const char *id = doc["id"] | "";
+        const char *valid_until = doc["valid_until"] | "";
+        if (strlen(id) != 6 || strlen(valid_until) != 19 || !json_point(doc["pub"], request.pub))
+            return "{\"error\":\"Invalid cert\"}";
+
+        memcpy(request.id, id, 6);
+        memcpy(request.valid_until, valid_until, 19);
+        if (!json_signature(doc["signature"], request.signature, request.signature_len))
+            return "{\"error\":\"Invalid signature\"}";
+    }
+    return nullptr;
+}
 
-    String requestBody = server.arg("plain");
-    Serial.println(requestBody);
-
-    DynamicJsonDocument doc(4098);
-    DeserializationError error = deserializeJson(doc, requestBody);
+// Fill request from a JSON handshake, return nullptr or the error to send.
+// The strings in body are parsed in place, so body is clobbered.
+const char *parse_handshake_json(char *body, wire_handshake &request)
+{
+    StaticJsonDocument<256> doc;
+    DeserializationError error = deserializeJson(doc, body);
 
     if (error)
+        return "{\"error\":\"Invalid JSON\"}";
+    Serial.println("ok get");
+
+    const char *cert_error = parse_cert_json(doc, request);
+    if (cert_error != nullptr)
+        return cert_error;
+    if (!json_hex(doc["c_nonce"], request.c_nonce, 12) || !json_point(doc["session"], request.session))
+        return "{\"error\":\"Invalid session\"}";
+    return nullptr;
+}
+
+// Return false after answering 429 or 503 if the current request has to
+// wait, before anything of it is parsed
+bool admit_crypto_request()
+{
+    admission_verdict verdict = admit_request(admission, server.remote_ip, crypto_jobs_in_flight(), millis());
+    if (verdict == ADMIT)
+        return true;
+    if (verdict == SHED_CLIENT)
+        http_send(server, 429, "application/json", "{\"error\":\"Too many requests\"}");
+    else
+        http_send(server, 503, "application/json", "{\"error\":\"Busy\"}");
+    return false;
+}
+
+bool is_binary_request()
+{
+    return strcmp(server.content_type, WIRE_CONTENT_TYPE) == 0;
+}
+
+// Return false after answering 403 if the cert id is revoked
+bool check_revoked(const uint8_t id[])
+{
+    if (!is_revoked(revoked_certs, id))
+        return true;
+    revocation_counters.revoked++;
+    http_send(server, 403, "application/json", "{\"error\":\"Cert revoked\"}");
+    Serial.println("revoked cert");
+    return false;
+}
+
+// Fill the cert half of job from the full cert or cert_ref in request, the
+// crypto core checks the CA signature unless the cert cache vouches for it.
+// Revoked and expired certs are turned away first, before any hashing or
+// ECC. Return false after answering 403, or 409 if the cert_ref is unknown.
+bool resolve_cert(const wire_handshake &request, crypto_job &job)
+{
+    uint32_t now = wall_clock_now();
+    job.verify_cert = false;
+    if (request.has_cert_ref)
     {
-        server.send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
-        return;
+        // Cached certs were checked for expiry by the lookup
+        memcpy(job.digest, request.cert_ref, 32);
+        if (!lookup_cert_ref(verified_certs, job.digest, now, job.cert))
+        {
+            http_send(server, 409, "application/json", "{\"error\":\"Unknown cert_ref\"}");
+            Serial.println("cert_ref miss");
+            return false;
+        }
+        return check_revoked(job.cert);
     }
 
-    String id = doc["id"];
-    String valid_until = doc["valid_until"];
-    String pub = doc["pub"];
-    String signature = doc["signature"];
-    String c_nonce = doc["c_nonce"];
-    String other_session_key = doc["session"];
-    Serial.println("ok get");
+    if (!check_revoked(request.id))
+        return false;
 
-    uint8_t pub_bytes[65];
+    // Parsed once, the cert cache keeps the number
+    char valid_until[20];
+    memcpy(valid_until, request.valid_until, 19);
+    valid_until[19] = '\0';
+    job.valid_until = parse_timestamp(valid_until);
+    if (now != 0 && job.valid_until != 0 && now >= job.valid_until)
+    {
+        revocation_counters.expired++;
+        http_send(server, 403, "application/json", "{\"error\":\"Cert expired\"}");
+        Serial.println("expired cert");
+        return false;
+    }
 
-    Serial.println("nanh pub");
-    Serial.println(pub);
+    cert_bytes(request.id, request.pub, request.valid_until, job.cert);
+    cert_digest(job.cert, request.signature, request.signature_len, job.digest);
+    job.verify_cert = !lookup_cert(verified_certs, job.digest, now, job.cert);
+    if (job.verify_cert)
+    {
+        memcpy(job.cert_signature, request.signature, request.signature_len);
+        job.cert_signature_len = request.signature_len;
+    }
+    return true;
+}
 
-    hexToBytes(pub.c_str(), pub_bytes, 65);
-    uint8_t cert[90];
-    cert_bytes((uint8_t *)id.c_str(), pub_bytes, (uint8_t *)valid_until.c_str(), cert);
+void handle_handshake()
+{
+    if (!admit_crypto_request())
+        return;
 
-    uint8_t ca_pub_bytes[65];
-    hexToBytes(ca_pub.c_str(), ca_pub_bytes, 65);
+    wire_handshake request;
+    bool binary = is_binary_request();
+    if (!binary)
+        Serial.println(server.body);
 
-    uint8_t signature_bytes[80];
-    hexToBytes(signature.c_str(), signature_bytes, signature.length() / 2);
+    uint32_t start = metric_start();
+    const char *error = nullptr;
+    if (binary)
+    {
+        if (decode_handshake((const uint8_t *)server.body, server.body_len, request) != 0)
+            error = "{\"error\":\"Invalid request\"}";
+    }
+    else
+        error = parse_handshake_json(server.body, request);
+    metric_record(PHASE_PARSE, start);
 
-    if (verify(cert, 90, ca_pub_bytes, signature_bytes, signature.length() / 2) != 0)
+    if (error != nullptr)
     {
-        server.send(303, "application/json", "{\"status\":\"failed\"}");
-        Serial.println("failed verify");
+        http_send(server, 400, "application/json", error);
+        return;
+    }
 
+    crypto_job *job = crypto_job_alloc();
+    if (job == nullptr)
+    {
+        http_send(server, 503, "application/json", "{\"error\":\"Busy\"}");
         return;
     }
+    if (!resolve_cert(request, *job))
+    {
+        crypto_job_free(job);
+        return;
+    }
+
+    // The ECC work runs on the crypto core, finish_handshake() answers
+    job->kind = CRYPTO_HANDSHAKE;
+    job->binary = binary;
+    memcpy(job->c_nonce, request.c_nonce, 12);
+    memcpy(job->client_session, request.session, point_len(request.session[0]));
+    job->ticket = http_defer(server);
+    crypto_submit(job);
+}
+
+void finish_handshake(crypto_job &job)
+{
+    if (job.status != 0)
+    {
+        const char *failed = "{\"status\":\"failed\"}";
+        http_reply(server, job.ticket, 303, "application/json", failed, strlen(failed));
+        Serial.println("failed verify");
+        return;
+    }
+    if (job.verify_cert)
+        insert_cert(verified_certs, job.digest, job.cert, job.cert_signature_len, job.valid_until);
     Serial.println("verify cert ok ");
 
-    uint8_t s_nonce[12];
+    session_slot *session = insert_session(sessions, job.cert, millis());
+    if (session == nullptr)
+    {
+        const char *full = "{\"error\":\"Too many sessions\"}";
+        http_reply(server, job.ticket, 503, "application/json", full, strlen(full));
+        Serial.println("session table full");
+        return;
+    }
+    memcpy(session->client_pub, job.cert + 6, point_len(job.cert[6]));
+
+    uint8_t *s_nonce = session->s_nonce;
     for (int i = 0; i < 12; i++)
         s_nonce[i] = random(0, 256);
 
-    sessions_s_nonce[id] = bytesToHex(s_nonce, 12);
-
-    mbedtls_ecdh_context session_ctx;
-    gen_key(session_ctx);
-    uint8_t session_pub_bytes[65];
-    size_t session_pub_bytes_len;
-    get_public_bytes(session_ctx, session_pub_bytes, session_pub_bytes_len);
-    sessions_ecdh[id] = session_ctx;
+    // Move the key pair the crypto core took from the pool into the session
+    mbedtls_ecdh_free(&session->ecdh);
+    session->ecdh = job.ecdh;
+    mbedtls_ecdh_init(&job.ecdh);
     Serial.println("gen key, add seesion id ok  ");
-    Serial.println(bytesToHex(session_pub_bytes, 65));
+    print_hex(job.session_pub, point_len(job.session_pub[0]));
 
-    uint8_t sesion_bytes_buf[142];
-    uint8_t c_nonce_bytes[12];
-    hexToBytes(c_nonce.c_str(), c_nonce_bytes, 12);
-    uint8_t other_session_key_bytes[65];
-    hexToBytes(other_session_key.c_str(), other_session_key_bytes, 65);
-    session_bytes(c_nonce_bytes, other_session_key_bytes, session_pub_bytes, sesion_bytes_buf);
+    if (job.binary)
+    {
+        uint8_t reply[2 + CERT_MAX_LEN + 12 + POINT_LEN + 2 + 2 * WIRE_MAX_SIGNATURE];
+        size_t reply_len = encode_handshake_reply(server_cert, s_nonce, job.session_pub,
+                                                  job.session_signature, job.session_signature_len,
+                                                  server_cert_signature_bytes, server_cert_signature_len,
+                                                  reply, sizeof(reply));
+        if (reply_len == 0)
+            http_reply(server, job.ticket, 500, "application/json", "{}", 2);
+        else
+            http_reply(server, job.ticket, 200, WIRE_CONTENT_TYPE, (const char *)reply, reply_len);
+    }
+    else
+    {
+        text_writer reply;
+        init_text_writer(reply, json_reply, sizeof(json_reply));
+        write_text(reply, handshake_reply_head, handshake_reply_head_len);
+        write_hex(reply, s_nonce, 12);
+        write_text(reply, "\",\"session\":\"");
+        write_hex(reply, job.session_pub, point_len(job.session_pub[0]));
+        write_text(reply, "\", \"session_signature\":\"");
+        write_hex(reply, job.session_signature, job.session_signature_len);
+        write_text(reply, handshake_reply_tail, handshake_reply_tail_len);
+        if (reply.overflow)
+            http_reply(server, job.ticket, 500, "application/json", "{}", 2);
+        else
+            http_reply(server, job.ticket, 200, "application/json", reply.buf, reply.len);
+    }
+    Serial.println("sign send back  ");
+}
 
-    uint8_t session_signature[80];
-    size_t session_signature_len;
+// Fill request from a JSON authenticate, return nullptr or the error to send.
+// The strings in body are parsed in place, so body is clobbered.
+const char *parse_authenticate_json(char *body, wire_authenticate &request)
+{
+    StaticJsonDocument<128> doc;
+    DeserializationError error = deserializeJson(doc, body);
 
-    sign(*server_ecdsa, sesion_bytes_buf, 142, session_signature, session_signature_len);
+    if (error)
+        return "{\"error\":\"Invalid JSON\"}";
 
-    String data = "{\"id\":\"000002\", \"valid_until\":\"" + server_valid_until + "\",\"pub\":\"" + server_pub_key + "\", \"s_nonce\":\"" + bytesToHex(s_nonce, 12) + "\",\"session\":\"" + bytesToHex(session_pub_bytes, 65) + "\", \"session_signature\":\"" + bytesToHex(session_signature, session_signature_len) + "\", \"cert_signature\":\"" + server_cert_signature + "\"}";
-    server.send(200, "application/json", data);
-    Serial.println("sign send back  ");
+    Serial.println("authen get ok  ");
+
+    const char *id = doc["id"] | "";
+    if (strlen(id) != 6)
+        return "{\"error\":\"Invalid id\"}";
+    memcpy(request.id, id, 6);
+    if (!json_point(doc["session"], request.session))
+        return "{\"error\":\"Invalid session\"}";
+    if (!json_signature(doc["signature"], request.signature, request.signature_len))
+        return "{\"error\":\"Invalid signature\"}";
+    return nullptr;
 }
 
 void handle_authenticate()
 {
-    if (server.method() != HTTP_POST)
+    wire_authenticate request;
+    bool binary = is_binary_request();
+    if (!binary)
+        Serial.println(server.body);
+
+    uint32_t start = metric_start();
+    const char *error = nullptr;
+    if (binary)
+    {
+        if (decode_authenticate((const uint8_t *)server.body, server.body_len, request) != 0)
+            error = "{\"error\":\"Invalid request\"}";
+    }
+    else
+        error = parse_authenticate_json(server.body, request);
+    metric_record(PHASE_PARSE, start);
+
+    if (error != nullptr)
     {
-        server.send(405, "text/plain", "Method Not Allowed");
+        http_send(server, 400, "application/json", error);
         return;
     }
 
-    String requestBody = server.arg("plain");
-    Serial.println(requestBody);
+    session_slot *session = find_session(sessions, request.id, millis());
+    if (session == nullptr)
+    {
+        http_send(server, 404, "application/json", "{\"error\":\"Session not found\"}");
+        Serial.print("cannot get session id ");
 
-    DynamicJsonDocument doc(1024);
-    DeserializationError error = deserializeJson(doc, requestBody);
+        return;
+    }
 
-    if (error)
+    crypto_job *job = crypto_job_alloc();
+    if (job == nullptr)
     {
-        server.send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+        http_send(server, 503, "application/json", "{\"error\":\"Busy\"}");
         return;
     }
 
-    String id = doc["id"];
-    String signature = doc["signature"];
-    String pub = doc["pub"];
-    String other_session = doc["session"];
+    // The handshake answered in the point format of the phone's session key
+    uint8_t session_key_pub_bytes[POINT_LEN];
+    size_t session_key_pub_bytes_len;
+    get_public_bytes(session->ecdh, session_key_pub_bytes, session_key_pub_bytes_len, request.session[0] != 0x04);
 
-    Serial.println("authen get ok  ");
+    Serial.println("server session key");
+    print_hex(session_key_pub_bytes, session_key_pub_bytes_len);
 
-    uint8_t pub_bytes[65];
-    hexToBytes(pub.c_str(), pub_bytes, 65);
+    Serial.println("s_nonce");
+    print_hex(session->s_nonce, 12);
+
+    // The session must be signed by the key of the cert checked at /handshake
+    job->kind = CRYPTO_AUTHENTICATE;
+    memcpy(job->id, session->id, 6);
+    memcpy(job->s_nonce, session->s_nonce, 12);
+    memcpy(job->client_pub, session->client_pub, POINT_LEN);
+    job->session_message_len = session_bytes(session->s_nonce, request.session, session_key_pub_bytes,
+                                             job->session_message);
+    memcpy(job->signature, request.signature, request.signature_len);
+    job->signature_len = request.signature_len;
+    // The crypto task derives the resumption secret from the session key. An
+    // empty key would derive a wrong one; the session stays for a retry.
+    if (mbedtls_mpi_copy(&job->ecdh.d, &session->ecdh.d) != 0)
+    {
+        crypto_job_free(job);
+        http_send(server, 503, "application/json", "{\"error\":\"Busy\"}");
+        return;
+    }
+    job->ticket = http_defer(server);
+    crypto_submit(job);
+}
 
-    uint8_t other_session_bytes[65];
-    hexToBytes(other_session.c_str(), other_session_bytes, 65);
+void light_verdict(bool accepted)
+{
+    if (accepted)
+    {
+        motionDetected = false;
+        digitalWrite(RED_LED_PIN, LOW);
+        digitalWrite(BLUE_LED_PIN, HIGH);
+    }
+    else
+    {
+        digitalWrite(RED_LED_PIN, HIGH);
+        digitalWrite(BLUE_LED_PIN, LOW);
+    }
+    ledStartTime = millis();
+    ledActive = true;
+}
 
-    if (sessions_ecdh.find(id) == sessions_ecdh.end())
+// The central server is told in the background, its verdict comes back
+// through poll_checkin_verdict() in loop(). Once the directory is loaded
+// the LEDs answer right away from it instead.
+void admit_checkin(const uint8_t cert_id[])
+{
+    char id[7];
+    memcpy(id, cert_id, 6);
+    id[6] = '\0';
+    if (!enqueue_checkin(id, wall_clock_now()))
     {
-        server.send(404, "application/json", "{\"error\":\"Session not found\"}");
-        Serial.print("cannot get session id ");
+        Serial.println("check-in queue full, dropped");
+        return;
+    }
+    if (!employees.loaded)
+        return;
 
+    uint16_t employee = find_employee(employees, cert_id);
+    if (employee == 0)
+    {
+        directory_counters.refused++;
+        Serial.printf("%s is not in the directory\n", id);
+        light_verdict(false);
         return;
     }
+    directory_counters.accepted++;
+    if (mark_present(presence, employee, wall_clock_now()))
+    {
+        directory_counters.repeats++;
+        Serial.printf("employee %u already checked in today\n", employee);
+    }
+    light_verdict(true);
+}
 
-    String &session_s_nonce = sessions_s_nonce[id];
+// Answer a verified /authenticate or /checkin with a resume ticket and
+// admit the check-in
+void admit_session(crypto_job &job)
+{
+    // Without a synced clock there is no expiry to put in a ticket
+    uint32_t now = wall_clock_now();
+    uint8_t resume_ticket[TICKET_LEN];
+    uint32_t expires = 0;
+    if (now != 0)
+    {
+        expires = now + TICKET_LIFETIME_S;
+        seal_ticket(tickets, job.id, expires, job.resumption_secret, resume_ticket);
+    }
+    memset(job.resumption_secret, 0, sizeof(job.resumption_secret));
 
-    Serial.println("s_nonce");
-    Serial.println(session_s_nonce);
+    if (job.binary)
+    {
+        uint8_t reply[2 + 4 + 1 + TICKET_LEN];
+        size_t reply_len = encode_authenticate_reply(expires, now != 0 ? resume_ticket : nullptr,
+                                                     reply, sizeof(reply));
+        if (reply_len == 0)
+            http_reply(server, job.ticket, 500, "application/json", "{}", 2);
+        else
+            http_reply(server, job.ticket, 200, WIRE_CONTENT_TYPE, (const char *)reply, reply_len);
+    }
+    else
+    {
+        text_writer reply;
+        init_text_writer(reply, json_reply, sizeof(json_reply));
+        write_text(reply, "{\"status\":\"succesfull\"");
+        if (now != 0)
+        {
+            write_text(reply, ",\"ticket\":\"");
+            write_hex(reply, resume_ticket, TICKET_LEN);
+            write_text(reply, "\",\"ticket_expires\":");
+            write_uint(reply, expires);
+        }
+        write_text(reply, "}");
+        http_reply(server, job.ticket, 200, "application/json", reply.buf, reply.len);
+    }
+
+    // valid user
+    Serial.println("User authenticated successfully");
+    admit_checkin(job.id);
+}
 
-    uint8_t s_nonce_bytes[12];
-    hexToBytes(session_s_nonce.c_str(), s_nonce_bytes, 12);
+void finish_authenticate(crypto_job &job)
+{
+    if (job.status != 0)
+    {
+        Serial.print("verify session failed");
 
-    mbedtls_ecdh_context &session_ctx = sessions_ecdh[id];
-    uint8_t session_key_pub_bytes[65];
-    size_t session_key_pub_bytes_len;
-    get_public_bytes(session_ctx, session_key_pub_bytes, session_key_pub_bytes_len);
+        const char *invalid = "{\"error\":\"Invalid signature\"}";
+        http_reply(server, job.ticket, 403, "application/json", invalid, strlen(invalid));
+        return;
+    }
 
-    Serial.println("server session key");
-    Serial.println(bytesToHex(session_key_pub_bytes, 65));
+    // A new handshake of the same phone may have replaced the session while
+    // the signature was checked, only the one that was signed counts
+    session_slot *session = find_session(sessions, job.id, millis());
+    if (session == nullptr || memcmp(session->s_nonce, job.s_nonce, 12) != 0)
+    {
+        const char *gone = "{\"error\":\"Session not found\"}";
+        http_reply(server, job.ticket, 404, "application/json", gone, strlen(gone));
+        return;
+    }
 
-    Serial.println("s_nonce");
-    Serial.println(session_s_nonce);
+    remove_session(sessions, session);
+    admit_session(job);
+}
 
-    uint8_t session_message_bytes[142];
-    session_bytes(s_nonce_bytes, other_session_bytes, session_key_pub_bytes, session_message_bytes);
+// Fill request from a JSON resume, return nullptr or the error to send
+const char *parse_resume_json(char *body, wire_resume &request)
+{
+    StaticJsonDocument<128> doc;
+    DeserializationError error = deserializeJson(doc, body);
 
-    uint8_t signature_bytes[80];
-    hexToBytes(signature.c_str(), signature_bytes, signature.length() / 2);
+    if (error)
+        return "{\"error\":\"Invalid JSON\"}";
+    if (!json_hex(doc["ticket"], request.ticket, WIRE_TICKET_LEN) || !json_hex(doc["proof"], request.proof, 32))
+        return "{\"error\":\"Invalid ticket\"}";
+    request.timestamp = doc["timestamp"] | 0;
+    return nullptr;
+}
+
+// A returning phone shows its ticket and a MAC under the secret inside it,
+// no public key work at all
+void handle_resume()
+{
+    wire_resume request;
+    bool binary = is_binary_request();
 
-    if (verify(session_message_bytes, 142, pub_bytes, signature_bytes, signature.length() / 2) != 0)
+    uint32_t start = metric_start();
+    const char *error = nullptr;
+    if (binary)
     {
-        Serial.print("verify session failed");
+        if (decode_resume((const uint8_t *)server.body, server.body_len, request) != 0)
+            error = "{\"error\":\"Invalid request\"}";
+    }
+    else
+        error = parse_resume_json(server.body, request);
 
-        server.send(403, "application/json", "{\"error\":\"Invalid signature\"}");
+    if (error != nullptr)
+    {
+        http_send(server, 400, "application/json", error);
         return;
     }
 
-    server.send(200, "application/json", "{\"status\":\"succesfull\"}");
+    uint8_t id[6];
+    int status = check_resume(tickets, request.ticket, request.timestamp, request.proof, wall_clock_now(), id);
+    metric_record(PHASE_RESUME, start);
+    if (status != 0)
+    {
+        // The phone falls back to /handshake
+        http_send(server, 401, "application/json", "{\"error\":\"Resume refused\"}");
+        return;
+    }
+    // A ticket outlives a revocation, the id does not
+    if (!check_revoked(id))
+        return;
 
-    // valid user
-    Serial.println("User authenticated successfully");
+    http_send(server, 200, "application/json", "{\"status\":\"succesfull\"}");
+    Serial.println("User resumed successfully");
+    admit_checkin(id);
+}
 
+// The current challenge as the handshake reply would carry the session, in
+// the wire codec if the phone accepts it
+void handle_challenge()
+{
+    challenge *c = current_challenge(challenges, millis());
+    if (c == nullptr)
+    {
+        http_send(server, 503, "application/json", "{\"error\":\"No challenge yet\"}");
+        return;
+    }
+    uint32_t expires_in = (c->issued_at + CHALLENGE_MAX_AGE_MS - millis()) / 1000;
 
-    HTTPClient http;
-    String url = "http://" + central_server_ip + "/checkin";
-    Serial.println("signup at");
-    Serial.println(url);
-    http.begin(url);
-    http.addHeader("Content-Type", "application/json");
-    String postData = "{\"cert_id\": \"" + id + "\"}";
-    int httpResponseCode = http.POST(postData);
-    if (httpResponseCode == 200)
+    if (strstr(server.accept, WIRE_CONTENT_TYPE) != nullptr)
     {
-        Serial.printf("told central server ok");
-        motionDetected = false;
-    } else {
-        Serial.printf("central server said fake user");
-        ;
-    } 
+        uint8_t reply[2 + CERT_MAX_LEN + 12 + POINT_LEN + 2 + 2 + 2 * WIRE_MAX_SIGNATURE];
+        size_t reply_len = encode_challenge_reply(server_cert, c->nonce, c->pub, expires_in,
+                                                  c->signature, c->signature_len,
+                                                  server_cert_signature_bytes, server_cert_signature_len,
+                                                  reply, sizeof(reply));
+        if (reply_len == 0)
+            http_send(server, 500, "application/json", "{}");
+        else
+            http_send(server, 200, WIRE_CONTENT_TYPE, (const char *)reply, reply_len);
+        return;
+    }
 
+    text_writer reply;
+    init_text_writer(reply, json_reply, sizeof(json_reply));
+    write_text(reply, handshake_reply_head, handshake_reply_head_len);
+    write_hex(reply, c->nonce, 12);
+    write_text(reply, "\",\"session\":\"");
+    write_hex(reply, c->pub, POINT_LEN);
+    write_text(reply, "\",\"expires_in\":");
+    write_uint(reply, expires_in);
+    write_text(reply, ",\"challenge_signature\":\"");
+    write_hex(reply, c->signature, c->signature_len);
+    write_text(reply, handshake_reply_tail, handshake_reply_tail_len);
+    if (reply.overflow)
+        http_send(server, 500, "application/json", "{}");
+    else
+        http_send(server, 200, "application/json", reply.buf, reply.len);
+}
+
+// Fill request from a JSON checkin, return nullptr or the error to send.
+// The strings in body are parsed in place, so body is clobbered.
+const char *parse_checkin_json(char *body, wire_checkin &request)
+{
+    StaticJsonDocument<256> doc;
+    DeserializationError error = deserializeJson(doc, body);
+
+    if (error)
+        return "{\"error\":\"Invalid JSON\"}";
+
+    const char *cert_error = parse_cert_json(doc, request.hello);
+    if (cert_error != nullptr)
+        return cert_error;
+    if (!json_hex(doc["s_nonce"], request.hello.c_nonce, 12) || !json_point(doc["session"], request.hello.session))
+        return "{\"error\":\"Invalid session\"}";
+    if (!json_signature(doc["session_signature"], request.session_signature, request.session_signature_len))
+        return "{\"error\":\"Invalid signature\"}";
+    return nullptr;
+}
+
+// One request check-in: the cert of /handshake and the session signature of
+// /authenticate, signed over a challenge from GET /challenge
+void handle_checkin()
+{
+    if (!admit_crypto_request())
+        return;
+
+    wire_checkin request;
+    bool binary = is_binary_request();
+
+    uint32_t start = metric_start();
+    const char *error = nullptr;
+    if (binary)
+    {
+        if (decode_checkin((const uint8_t *)server.body, server.body_len, request) != 0)
+            error = "{\"error\":\"Invalid request\"}";
+    }
+    else
+        error = parse_checkin_json(server.body, request);
+    metric_record(PHASE_PARSE, start);
+
+    if (error != nullptr)
+    {
+        http_send(server, 400, "application/json", error);
+        return;
+    }
+
+    // Unknown or replayed challenges get 409, the phone fetches a new one
+    challenge *c = find_challenge(challenges, request.hello.c_nonce, millis());
+    if (c == nullptr)
+    {
+        http_send(server, 409, "application/json", "{\"error\":\"Unknown challenge\"}");
+        return;
+    }
+    if (challenge_seen(*c, request.hello.session))
+    {
+        challenges.replayed++;
+        http_send(server, 409, "application/json", "{\"error\":\"Challenge already used\"}");
+        return;
+    }
+
+    crypto_job *job = crypto_job_alloc();
+    if (job == nullptr)
+    {
+        http_send(server, 503, "application/json", "{\"error\":\"Busy\"}");
+        return;
+    }
+    if (!resolve_cert(request.hello, *job))
+    {
+        crypto_job_free(job);
+        return;
+    }
+
+    // The session must be signed by the key of the cert it came with
+    job->kind = CRYPTO_CHECKIN;
+    job->binary = binary;
+    memcpy(job->id, job->cert, 6);
+    memcpy(job->s_nonce, c->nonce, 12);
+    memcpy(job->client_pub, job->cert + 6, point_len(job->cert[6]));
+    job->session_message_len = session_bytes(c->nonce, request.hello.session, c->pub, job->session_message);
+    memcpy(job->signature, request.session_signature, request.session_signature_len);
+    job->signature_len = request.session_signature_len;
+    if (mbedtls_mpi_copy(&job->ecdh.d, &c->ecdh.d) != 0)
+    {
+        crypto_job_free(job);
+        http_send(server, 503, "application/json", "{\"error\":\"Busy\"}");
+        return;
+    }
+    job->ticket = http_defer(server);
+    crypto_submit(job);
+}
+
+void finish_checkin(crypto_job &job)
+{
+    if (job.status != 0)
+    {
+        Serial.println("checkin verify failed");
+        const char *invalid = "{\"error\":\"Invalid signature\"}";
+        http_reply(server, job.ticket, 403, "application/json", invalid, strlen(invalid));
+        return;
+    }
+    if (job.verify_cert)
+        insert_cert(verified_certs, job.digest, job.cert, job.cert_signature_len, job.valid_until);
+
+    // Two copies of the same request may have been verified side by side,
+    // only the first one counts
+    challenge *c = find_challenge(challenges, job.s_nonce, millis());
+    if (c == nullptr)
+    {
+        const char *gone = "{\"error\":\"Unknown challenge\"}";
+        http_reply(server, job.ticket, 409, "application/json", gone, strlen(gone));
+        return;
+    }
+    if (!mark_challenge_seen(*c, job.session_message + 12))
+    {
+        challenges.replayed++;
+        const char *used = "{\"error\":\"Challenge already used\"}";
+        http_reply(server, job.ticket, 409, "application/json", used, strlen(used));
+        return;
+    }
+    challenges.answered++;
+    admit_session(job);
+}
+
+// Sign the next challenge on the crypto core once the current one is due,
+// never taking the last free job from a request
+void rotate_challenge()
+{
+    if (!already_setup || !challenge_due(challenges, millis()) ||
+        crypto_jobs_in_flight() >= CRYPTO_PIPELINE_DEPTH - 1)
+        return;
+
+    crypto_job *job = crypto_job_alloc();
+    job->kind = CRYPTO_CHALLENGE;
+    for (int i = 0; i < 12; i++)
+        job->s_nonce[i] = random(0, 256);
+    challenges.rotating = true;
+    crypto_submit(job);
+}
+
+void finish_challenge(crypto_job &job)
+{
+    if (job.status != 0)
+    {
+        challenges.rotating = false;
+        return;
+    }
+    publish_challenge(challenges, job.s_nonce, job.ecdh, job.session_pub,
+                      job.session_signature, job.session_signature_len, millis());
+}
+
+void show_checkin_verdict(const checkin_verdict &verdict)
+{
+    if (verdict.accepted)
+        Serial.printf("told central server ok %s\n", verdict.cert_id);
+    else
+        Serial.printf("central server said fake user %s\n", verdict.cert_id);
+
+    // admit_checkin() already lit the LEDs from the directory, the server
+    // only changes them when it disagrees
+    if (employees.loaded)
+    {
+        bool ours = find_employee(employees, (const uint8_t *)verdict.cert_id) != 0;
+        if (ours == verdict.accepted)
+            return;
+        directory_counters.overruled++;
+    }
+    light_verdict(verdict.accepted);
+}
+
+// append prefix and a counter, the pieces handle_stats() is made of
+void write_stat(text_writer &out, const char *prefix, uint32_t value)
+{
+    write_text(out, prefix);
+    write_uint(out, value);
+}
+
+void handle_stats()
+{
+    uint32_t lookups = verified_certs.hits + verified_certs.misses;
+    uint32_t hit_permille = lookups == 0 ? 0 : (uint64_t)verified_certs.hits * 1000 / lookups;
+    char hit_rate[5] = {(char)('0' + hit_permille / 1000), '.', (char)('0' + hit_permille / 100 % 10),
+                        (char)('0' + hit_permille / 10 % 10), (char)('0' + hit_permille % 10)};
+
+    text_writer out;
+    init_text_writer(out, stats_reply, sizeof(stats_reply));
+    write_stat(out, "{\"cert_cache\":{\"hits\":", verified_certs.hits);
+    write_stat(out, ",\"misses\":", verified_certs.misses);
+    write_text(out, ",\"hit_rate\":");
+    write_text(out, hit_rate, sizeof(hit_rate));
+    write_stat(out, ",\"ref_hits\":", verified_certs.ref_hits);
+    write_stat(out, ",\"bytes_saved\":", verified_certs.bytes_saved);
+    write_stat(out, "},\"sessions\":{\"live\":", sessions.live);
+    write_stat(out, ",\"expired\":", sessions.expired);
+    write_stat(out, ",\"rejected\":", sessions.rejected);
+    write_stat(out, "},\"tickets\":{\"issued\":", tickets.issued);
+    write_stat(out, ",\"resumed\":", tickets.resumed);
+    write_stat(out, ",\"bad\":", tickets.bad);
+    write_stat(out, ",\"expired\":", tickets.expired);
+    write_stat(out, ",\"stale\":", tickets.stale);
+    write_stat(out, ",\"replayed\":", tickets.replayed);
+    write_stat(out, "},\"challenges\":{\"published\":", challenges.published);
+    write_stat(out, ",\"answered\":", challenges.answered);
+    write_stat(out, ",\"unknown\":", challenges.unknown);
+    write_stat(out, ",\"replayed\":", challenges.replayed);
+    write_stat(out, "},\"revocation\":{\"version\":", revoked_certs.version);
+    write_stat(out, ",\"ids\":", revoked_certs.count);
+    write_stat(out, ",\"syncs\":", revocation_counters.syncs);
+    write_stat(out, ",\"revoked\":", revocation_counters.revoked);
+    write_stat(out, ",\"expired\":", revocation_counters.expired);
+    write_stat(out, ",\"bloom_false_positives\":", revocation_counters.bloom_false_positives);
+    write_stat(out, ",\"overflows\":", revocation_counters.overflows);
+    write_stat(out, "},\"directory\":{\"version\":", employees.version);
+    write_stat(out, ",\"employees\":", employees.count);
+    write_stat(out, ",\"present\":", present_count(presence));
+    write_stat(out, ",\"snapshots\":", directory_counters.snapshots);
+    write_stat(out, ",\"deltas\":", directory_counters.deltas);
+    write_stat(out, ",\"accepted\":", directory_counters.accepted);
+    write_stat(out, ",\"refused\":", directory_counters.refused);
+    write_stat(out, ",\"repeats\":", directory_counters.repeats);
+    write_stat(out, ",\"overruled\":", directory_counters.overruled);
+    write_stat(out, ",\"overflows\":", directory_counters.overflows);
+    write_stat(out, "},\"key_pool\":{\"depth\":", session_keys.depth);
+    write_stat(out, ",\"hits\":", session_keys.hits);
+    write_stat(out, ",\"misses\":", session_keys.misses);
+    write_stat(out, "},\"sensor\":{\"edges\":", sensor_counters.edges);
+    write_stat(out, ",\"overflows\":", sensor_counters.overflows);
+    write_stat(out, ",\"detections\":", sensor_counters.detections);
+    write_stat(out, ",\"bounces\":", sensor_counters.bounces);
+    write_stat(out, "},\"crypto\":{\"in_flight\":", crypto_jobs_in_flight());
+    write_stat(out, ",\"submitted\":", crypto_counters.submitted);
+    write_stat(out, ",\"completed\":", crypto_counters.completed);
+    write_stat(out, ",\"busy\":", crypto_counters.busy);
+    write_stat(out, ",\"batches\":", crypto_counters.batches);
+    write_stat(out, ",\"batched_certs\":", crypto_counters.batched_certs);
+    write_stat(out, "},\"admission\":{\"admitted\":", admission.admitted);
+    write_stat(out, ",\"shed_client\":", admission.shed_client);
+    write_stat(out, ",\"shed_global\":", admission.shed_global);
+    write_stat(out, ",\"shed_busy\":", admission.shed_busy);
+    write_stat(out, "},\"checkin\":{\"queued\":", checkin_queue_depth());
+    write_stat(out, ",\"requests\":", checkin_counters.requests);
+    write_stat(out, ",\"accepted\":", checkin_counters.accepted);
+    write_stat(out, ",\"rejected\":", checkin_counters.rejected);
+    write_stat(out, ",\"retries\":", checkin_counters.retries);
+    write_stat(out, ",\"dropped\":", checkin_counters.dropped);
+    write_stat(out, ",\"retried_events\":", checkin_counters.retried_events);
+    write_stat(out, ",\"unknown\":", checkin_counters.unknown);
+    write_stat(out, "},\"journal\":{\"pending\":", journal_pending());
+    write_stat(out, ",\"appended\":", journal_counters.appended);
+    write_stat(out, ",\"replayed\":", journal_counters.replayed);
+    write_stat(out, ",\"corrupt\":", journal_counters.corrupt);
+    write_stat(out, ",\"overwritten\":", journal_counters.overwritten);
+    write_stat(out, "},\"http\":{\"open\":", http_open_connections(server));
+    write_stat(out, ",\"accepted\":", server.accepted);
+    write_stat(out, ",\"requests\":", server.requests);
+    write_stat(out, ",\"reused\":", server.reused);
+    write_stat(out, ",\"timed_out\":", server.timed_out);
+    write_stat(out, ",\"rejected\":", server.rejected);
+    write_stat(out, ",\"evicted\":", server.evicted);
+    write_text(out, "}}");
+    http_send(server, 200, "application/json", out.buf, out.len);
+}
+
+// One Prometheus sample, label may be nullptr
+void write_sample(text_writer &out, const char *name, const char *label, const char *label_value, uint32_t value)
+{
+    write_text(out, name);
+    if (label != nullptr)
+    {
+        write_text(out, "{");
+        write_text(out, label);
+        write_text(out, "=\"");
+        write_text(out, label_value);
+        write_text(out, "\"}");
+    }
+    write_text(out, " ");
+    write_uint(out, value);
+    write_text(out, "\n");
+}
+
+void handle_metrics()
+{
+    text_writer out;
+    init_text_writer(out, metrics_reply, sizeof(metrics_reply));
+    write_metrics(out);
+
+    write_text(out, "# TYPE sensor_http_requests_total counter\n");
+    for (size_t i = 0; i < server.route_count; i++)
+        write_sample(out, "sensor_http_requests_total", "path", server.routes[i].path, server.routes[i].requests);
+    write_text(out, "# TYPE sensor_http_errors_total counter\n");
+    for (size_t i = 0; i < server.route_count; i++)
+        write_sample(out, "sensor_http_errors_total", "path", server.routes[i].path, server.routes[i].errors);
+    write_text(out, "# TYPE sensor_http_rejected_total counter\n");
+    write_sample(out, "sensor_http_rejected_total", nullptr, nullptr, server.rejected);
+    write_text(out, "# TYPE sensor_http_timed_out_total counter\n");
+    write_sample(out, "sensor_http_timed_out_total", nullptr, nullptr, server.timed_out);
+    write_text(out, "# TYPE sensor_checkin_dropped_total counter\n");
+    write_sample(out, "sensor_checkin_dropped_total", nullptr, nullptr, checkin_counters.dropped);
+
+    write_text(out, "# TYPE sensor_tickets_issued_total counter\n");
+    write_sample(out, "sensor_tickets_issued_total", nullptr, nullptr, tickets.issued);
+    write_text(out, "# TYPE sensor_resumes_total counter\n");
+    write_sample(out, "sensor_resumes_total", "result", "ok", tickets.resumed);
+    write_sample(out, "sensor_resumes_total", "result", "bad", tickets.bad);
+    write_sample(out, "sensor_resumes_total", "result", "expired", tickets.expired);
+    write_sample(out, "sensor_resumes_total", "result", "stale", tickets.stale);
+    write_sample(out, "sensor_resumes_total", "result", "replayed", tickets.replayed);
+
+    write_text(out, "# TYPE sensor_admission_total counter\n");
+    write_sample(out, "sensor_admission_total", "result", "admitted", admission.admitted);
+    write_sample(out, "sensor_admission_total", "result", "shed_client", admission.shed_client);
+    write_sample(out, "sensor_admission_total", "result", "shed_global", admission.shed_global);
+    write_sample(out, "sensor_admission_total", "result", "shed_busy", admission.shed_busy);
+
+    write_text(out, "# TYPE sensor_certs_refused_total counter\n");
+    write_sample(out, "sensor_certs_refused_total", "reason", "revoked", revocation_counters.revoked);
+    write_sample(out, "sensor_certs_refused_total", "reason", "expired", revocation_counters.expired);
+
+    write_text(out, "# TYPE sensor_challenges_published_total counter\n");
+    write_sample(out, "sensor_challenges_published_total", nullptr, nullptr, challenges.published);
+    write_text(out, "# TYPE sensor_checkins_one_round_total counter\n");
+    write_sample(out, "sensor_checkins_one_round_total", "result", "ok", challenges.answered);
+    write_sample(out, "sensor_checkins_one_round_total", "result", "unknown", challenges.unknown);
+    write_sample(out, "sensor_checkins_one_round_total", "result", "replayed", challenges.replayed);
+
+    write_text(out, "# TYPE sensor_queue_depth gauge\n");
+    write_sample(out, "sensor_queue_depth", "queue", "http", http_open_connections(server));
+    write_sample(out, "sensor_queue_depth", "queue", "crypto", crypto_jobs_in_flight());
+    write_sample(out, "sensor_queue_depth", "queue", "sessions", sessions.live);
+    write_sample(out, "sensor_queue_depth", "queue", "key_pool", session_keys.depth);
+    write_sample(out, "sensor_queue_depth", "queue", "checkin", checkin_queue_depth());
+    write_sample(out, "sensor_queue_depth", "queue", "journal", journal_pending());
+
+    write_text(out, "# TYPE sensor_heap_free_bytes gauge\n");
+    write_sample(out, "sensor_heap_free_bytes", nullptr, nullptr, ESP.getFreeHeap());
+    write_text(out, "# TYPE sensor_heap_min_free_bytes gauge\n");
+    write_sample(out, "sensor_heap_min_free_bytes", nullptr, nullptr, ESP.getMinFreeHeap());
+    write_text(out, "# TYPE sensor_heap_largest_block_bytes gauge\n");
+    write_sample(out, "sensor_heap_largest_block_bytes", nullptr, nullptr, ESP.getMaxAllocHeap());
+
+    if (out.overflow)
+        http_send(server, 500, "text/plain", "metrics do not fit");
+    else
+        http_send(server, 200, "text/plain; version=0.0.4", out.buf, out.len);
 }
 
 void load_config()
@@ -381,6 +1181,8 @@ void load_config()
     sensor_id = doc["sensor_id"].as<String>();
     central_server_ip = doc["central_server_ip"].as<String>();
     server_valid_until = doc["valid_until"].as<String>();
+    ntp_server = doc["ntp_server"] | "pool.ntp.org";
+    session_ttl_ms = doc["session_ttl_ms"] | DEFAULT_SESSION_TTL_MS;
 
     File server_private_key_file = SPIFFS.open("/server.pem");
     if (!server_private_key_file)
@@ -400,6 +1202,7 @@ void load_config()
         return;
     }
     server_cert_signature = server_cert_signature_file.readString();
+    server_cert_signature.trim();
 
     File server_pub_file = SPIFFS.open("/server.pub");
     if (!server_pub_file)
@@ -408,6 +1211,43 @@ void load_config()
         return;
     }
     server_pub_key = server_pub_file.readString();
+    server_pub_key.trim();
+
+    // The cert was issued to sensor_id at signup
+    uint8_t server_pub_bytes[POINT_LEN] = {0x04};
+    if (!hex_point(server_pub_key.c_str(), server_pub_key.length(), server_pub_bytes))
+        Serial.println("server.pub malformed");
+    if (sensor_id.length() == 6 && server_valid_until.length() == 19)
+        cert_bytes((const uint8_t *)sensor_id.c_str(), server_pub_bytes,
+                   (const uint8_t *)server_valid_until.c_str(), server_cert);
+    else
+        Serial.println("sensor_id or valid_until malformed, binary handshakes will fail");
+    server_cert_signature_len = server_cert_signature.length() / 2;
+    if (server_cert_signature_len > WIRE_MAX_SIGNATURE)
+        server_cert_signature_len = 0;
+    if (!hex_decode(server_cert_signature.c_str(), server_cert_signature.length(),
+                    server_cert_signature_bytes, server_cert_signature_len))
+        server_cert_signature_len = 0;
+
+    text_writer head;
+    init_text_writer(head, handshake_reply_head, sizeof(handshake_reply_head));
+    write_text(head, "{\"id\":\"");
+    write_text(head, sensor_id.c_str());
+    write_text(head, "\", \"valid_until\":\"");
+    write_text(head, server_valid_until.c_str());
+    write_text(head, "\",\"pub\":\"");
+    write_text(head, server_pub_key.c_str());
+    write_text(head, "\", \"s_nonce\":\"");
+    handshake_reply_head_len = head.len;
+
+    text_writer tail;
+    init_text_writer(tail, handshake_reply_tail, sizeof(handshake_reply_tail));
+    write_text(tail, "\", \"cert_signature\":\"");
+    write_text(tail, server_cert_signature.c_str());
+    write_text(tail, "\"}");
+    handshake_reply_tail_len = tail.len;
+    if (head.overflow || tail.overflow)
+        Serial.println("server cert too long, JSON handshakes will fail");
 
     File ca_pub_file = SPIFFS.open("/ca.pub");
     if (!ca_pub_file)
@@ -416,6 +1256,16 @@ void load_config()
         return;
     }
     ca_pub = ca_pub_file.readString();
+    ca_pub.trim();
+
+    uint8_t ca_pub_bytes[POINT_LEN];
+    if (!hex_point(ca_pub.c_str(), ca_pub.length(), ca_pub_bytes) ||
+        load_trust_anchor(ca_anchor, ca_pub_bytes) != 0)
+    {
+        Serial.println("Failed to load CA trust anchor");
+        return;
+    }
+    Serial.println("CA trust anchor ready");
 }
 
 void setup_wifi()
@@ -432,6 +1282,8 @@ void setup_wifi()
             Serial.print(".");
         }
 
+        init_wall_clock(ntp_server.c_str());
+
         // Broadcast public hotspot
         WiFi.softAP(public_wifi_ssid, public_wifi_password);
         delay(100);
@@ -448,13 +1300,7 @@ void setup_wifi()
 
 void handle_setup()
 {
-    if (server.method() != HTTP_POST)
-    {
-        server.send(405, "text/plain", "Method Not Allowed");
-        return;
-    }
-
-    String requestBody = server.arg("plain");
+    const char *requestBody = server.body;
     Serial.println("Set up with config");
     Serial.println(requestBody);
 
@@ -463,7 +1309,7 @@ void handle_setup()
 
     if (error)
     {
-        server.send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+        http_send(server, 400, "application/json", "{\"error\":\"Invalid JSON\"}");
         return;
     }
 
@@ -474,6 +1320,8 @@ void handle_setup()
     String public_wifi_password_to_use = doc["public_wifi_password"].as<String>();
     String sensor_id_to_use = doc["sensor_id"].as<String>();
     String setup_token = doc["setup_token"].as<String>();
+    String ntp_server_to_use = doc["ntp_server"] | "pool.ntp.org";
+    unsigned long session_ttl_ms_to_use = doc["session_ttl_ms"] | DEFAULT_SESSION_TTL_MS;
 
     WiFi.mode(WIFI_STA);
     // Connect to internal WiFi network
@@ -496,7 +1344,9 @@ void handle_setup()
         "\", \"public_wifi_password\": \"" + public_wifi_password_to_use +
         "\", \"sensor_id\": \"" + sensor_id_to_use +
         "\", \"valid_until\": \"" + server_valid_until +
-        "\"}";
+        "\", \"ntp_server\": \"" + ntp_server_to_use +
+        "\", \"session_ttl_ms\": " + String(session_ttl_ms_to_use) +
+        "}";
 
     File config_file = SPIFFS.open("/config.json", FILE_WRITE);
     config_file.print(config_data);
@@ -508,11 +1358,16 @@ void serve_routes()
 {
     if (!already_setup)
     {
-        server.on("/setup", HTTP_POST, handle_setup);
+        http_on(server, "/setup", HTTP_METHOD_POST, handle_setup);
     }
-    server.on("/handshake", HTTP_POST, handle_handshake);
-    server.on("/authenticate", HTTP_POST, handle_authenticate);
-    server.begin();
+    http_on(server, "/handshake", HTTP_METHOD_POST, handle_handshake);
+    http_on(server, "/authenticate", HTTP_METHOD_POST, handle_authenticate);
+    http_on(server, "/resume", HTTP_METHOD_POST, handle_resume);
+    http_on(server, "/challenge", HTTP_METHOD_GET, handle_challenge);
+    http_on(server, "/checkin", HTTP_METHOD_POST, handle_checkin);
+    http_on(server, "/stats", HTTP_METHOD_GET, handle_stats);
+    http_on(server, "/metrics", HTTP_METHOD_GET, handle_metrics);
+    http_begin(server, 80);
     Serial.println("Server ready.");
 }
 
@@ -530,15 +1385,30 @@ void setup()
     init_crypto_random_engine();
 
     load_config();
+    init_session_table(sessions, session_ttl_ms);
+    init_key_pool(session_keys);
+    init_ticket_keys(tickets, millis());
+    init_challenges(challenges);
+    clear_revocations(revoked_certs, 0);
+    clear_directory(employees);
+    clear_presence(presence);
+    init_admission(admission, millis());
 
     setup_wifi();
 
+    if (already_setup)
+    {
+        start_crypto_pipeline(ca_anchor, server_ecdsa, session_keys);
+        start_checkin_worker(central_server_ip);
+    }
+
     serve_routes();
 
     // Initialize pins
     pinMode(SENSOR_PIN, INPUT);
     pinMode(RED_LED_PIN, OUTPUT);
     pinMode(BLUE_LED_PIN, OUTPUT);
+    start_sensor_capture(SENSOR_PIN, DEBOUNCE_DELAY);
 
     // Turn off both LEDs at startup
     digitalWrite(RED_LED_PIN, LOW);
@@ -552,27 +1422,50 @@ void setup()
 
 void loop()
 {
-    server.handleClient();
-
-    bool currentSensorState = digitalRead(SENSOR_PIN);
+    http_poll(server, millis());
 
-    // Detect motion (HIGH to LOW transition)
-    if (lastSensorState == HIGH && currentSensorState == LOW)
+    static unsigned long lastSessionSweep = 0;
+    if (millis() - lastSessionSweep > 1000)
     {
-        // Debounce check
-        if (millis() - lastDetectionTime > DEBOUNCE_DELAY)
-        {
-            Serial.println("🚨 MOTION DETECTED! Waiting for HTTP request...");
-            Serial.println("⏰ 6-second window started - send your curl request now!");
+        expire_sessions(sessions, millis());
+        rotate_ticket_keys(tickets, millis());
+        lastSessionSweep = millis();
+    }
 
-            motionDetected = true;
-            motionStartTime = millis();
-            lastDetectionTime = millis();
-        }
+    crypto_job *job;
+    while ((job = crypto_poll()) != nullptr)
+    {
+        if (job->kind == CRYPTO_HANDSHAKE)
+            finish_handshake(*job);
+        else if (job->kind == CRYPTO_AUTHENTICATE)
+            finish_authenticate(*job);
+        else if (job->kind == CRYPTO_CHALLENGE)
+            finish_challenge(*job);
+        else
+            finish_checkin(*job);
+        crypto_job_free(job);
     }
+    rotate_challenge();
+
+    checkin_verdict verdict;
+    while (poll_checkin_verdict(verdict))
+        show_checkin_verdict(verdict);
+    if (poll_revocations(revoked_certs))
+        Serial.printf("revocation list v%u, %u ids\n", (unsigned)revoked_certs.version, revoked_certs.count);
+    if (poll_directory(employees))
+        Serial.printf("directory v%u, %u employees\n", (unsigned)employees.version, employees.count);
+
+    // Edges are captured by interrupt and debounced here, the window starts
+    // when the edge happened even if a handshake kept loop() busy
+    unsigned long detectedAt;
+    if (poll_motion(detectedAt))
+    {
+        Serial.println("🚨 MOTION DETECTED! Waiting for HTTP request...");
+        Serial.println("⏰ 6-second window started - send your curl request now!");
 
-    // Update last sensor state
-    lastSensorState = currentSensorState;
+        motionDetected = true;
+        motionStartTime = detectedAt;
+    }
 
     // Check if motion detected and timeout reached
     if (motionDetected)
@@ -586,7 +1479,7 @@ void loop()
             int remaining = (MOTION_WAIT_TIMEOUT - elapsed) / 1000;
             if (remaining >= 0)
             {
-                Serial.println("⏳ Waiting for request... " + String(remaining) + " seconds remaining");
+                Serial.printf("⏳ Waiting for request... %d seconds remaining\n", remaining);
             }
 
             lastCountdown = millis();
@@ -0,0 +1,96 @@
+#include "metrics.h"
+
+#include <Arduino.h>
+
+const uint32_t metric_bucket_us[METRIC_BUCKETS] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000,
+};
+
+metric_histogram phase_latency[PHASE_COUNT];
+
+static const char *phase_names[PHASE_COUNT] = {
+    "parse", "cert_verify", "ecdh_keygen", "session_sign", "session_verify", "central_post", "resume",
+    "cert_batch",
+};
+
+uint32_t metric_start()
+{
+    return ESP.getCycleCount();
+}
+
+void metric_record(metric_phase phase, uint32_t start)
+{
+    // Unsigned difference survives one wrap, about 17 s at 240 MHz
+    uint32_t us = (ESP.getCycleCount() - start) / getCpuFrequencyMhz();
+
+    int bucket = 0;
+    while (bucket < METRIC_BUCKETS && us > metric_bucket_us[bucket])
+        bucket++;
+
+    metric_histogram &histogram = phase_latency[phase];
+    histogram.counts[bucket]++;
+    histogram.sum_us += us;
+}
+
+// le label value in seconds, the bounds are all whole microseconds
+static void write_seconds(text_writer &out, uint64_t total_us)
+{
+    char digits[6];
+    write_uint(out, total_us / 1000000);
+    uint32_t us = total_us % 1000000;
+    if (us == 0)
+        return;
+
+    int len = 6;
+    while (us % 10 == 0)
+    {
+        us /= 10;
+        len--;
+    }
+    for (int i = len - 1; i >= 0; i--)
+    {
+        digits[i] = '0' + us % 10;
+        us /= 10;
+    }
+    write_text(out, ".");
+    write_text(out, digits, len);
+}
+
+void write_metrics(text_writer &out)
+{
+    write_text(out, "# HELP sensor_phase_seconds Time spent in each step of a check-in\n"
+                    "# TYPE sensor_phase_seconds histogram\n");
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        // Read while the owning task may be recording, a scrape can be one
+        // sample behind in some bucket; the count is summed from the
+        // buckets so the two always agree
+        const metric_histogram &histogram = phase_latency[phase];
+
+        uint32_t cumulative = 0;
+        for (int bucket = 0; bucket <= METRIC_BUCKETS; bucket++)
+        {
+            cumulative += histogram.counts[bucket];
+            write_text(out, "sensor_phase_seconds_bucket{phase=\"");
+            write_text(out, phase_names[phase]);
+            write_text(out, "\",le=\"");
+            if (bucket < METRIC_BUCKETS)
+                write_seconds(out, metric_bucket_us[bucket]);
+            else
+                write_text(out, "+Inf");
+            write_text(out, "\"} ");
+            write_uint(out, cumulative);
+            write_text(out, "\n");
+        }
+
+        write_text(out, "sensor_phase_seconds_sum{phase=\"");
+        write_text(out, phase_names[phase]);
+        write_text(out, "\"} ");
+        write_seconds(out, histogram.sum_us);
+        write_text(out, "\nsensor_phase_seconds_count{phase=\"");
+        write_text(out, phase_names[phase]);
+        write_text(out, "\"} ");
+        write_uint(out, cumulative);
+        write_text(out, "\n");
+    }
+}
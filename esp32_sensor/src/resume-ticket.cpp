@@ -0,0 +1,168 @@
+#include "resume-ticket.h"
+
+#include <string.h>
+#include "mbedtls/platform_util.h"
+#include "wire-codec.h"
+
+static_assert(TICKET_LEN == WIRE_TICKET_LEN, "wire-codec.h and resume-ticket.h disagree");
+
+static const size_t SEALED_LEN = 6 + 4 + TICKET_SECRET_LEN;
+
+static void put_u32(uint8_t out[], uint32_t value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+static uint32_t get_u32(const uint8_t in[])
+{
+    return (uint32_t)in[0] << 24 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 8 | in[3];
+}
+
+static void make_key(ticket_key &key, uint8_t id)
+{
+    uint8_t secret[32];
+    crypto_backend::fill_random(secret, sizeof(secret));
+
+    if (key.loaded)
+        crypto_backend::gcm_free(key.gcm);
+    crypto_backend::gcm_init(key.gcm);
+    crypto_backend::gcm_setkey(key.gcm, secret);
+    mbedtls_platform_zeroize(secret, sizeof(secret));
+    key.id = id;
+    key.loaded = true;
+}
+
+void init_ticket_keys(ticket_keys &keys, unsigned long now)
+{
+    memset(&keys, 0, sizeof(keys));
+    make_key(keys.keys[0], 0);
+    keys.current = 0;
+    keys.rotated_at = now;
+}
+
+void rotate_ticket_keys(ticket_keys &keys, unsigned long now)
+{
+    if (now - keys.rotated_at < TICKET_KEY_ROTATE_MS)
+        return;
+
+    uint8_t next = keys.current ^ 1;
+    make_key(keys.keys[next], keys.keys[keys.current].id + 1);
+    keys.current = next;
+    keys.rotated_at = now;
+}
+
+void seal_ticket(ticket_keys &keys, const uint8_t id[], uint32_t expires,
+                 const uint8_t secret[], uint8_t ticket[])
+{
+    ticket_key &key = keys.keys[keys.current];
+
+    uint8_t plain[SEALED_LEN];
+    memcpy(plain, id, 6);
+    put_u32(plain + 6, expires);
+    memcpy(plain + 10, secret, TICKET_SECRET_LEN);
+
+    // Random nonces are fine for the few thousand tickets one key seals
+    ticket[0] = key.id;
+    crypto_backend::fill_random(ticket + 1, 12);
+    crypto_backend::gcm_seal(key.gcm, ticket + 1, ticket, 1,
+                             plain, SEALED_LEN, ticket + 13, ticket + 13 + SEALED_LEN);
+    mbedtls_platform_zeroize(plain, sizeof(plain));
+    keys.issued++;
+}
+
+void resume_proof(const uint8_t secret[], uint32_t timestamp, const uint8_t ticket[], uint8_t proof[])
+{
+    uint8_t stamp[4];
+    put_u32(stamp, timestamp);
+
+    hmac_sha256_context<crypto_backend> ctx;
+    hmac_sha256_start(ctx, secret, TICKET_SECRET_LEN);
+    hmac_sha256_update(ctx, (const uint8_t *)"resume", 6);
+    hmac_sha256_update(ctx, stamp, 4);
+    hmac_sha256_update(ctx, ticket, TICKET_LEN);
+    hmac_sha256_finish(ctx, proof);
+}
+
+static bool same_proof(const uint8_t a[], const uint8_t b[])
+{
+    uint8_t diff = 0;
+    for (int i = 0; i < 32; i++)
+        diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+// return false if this ticket was already presented with this timestamp,
+// otherwise remember it. A phone resuming again signs a new timestamp; a
+// slot is only needed until its timestamp falls out of the window.
+static bool remember_use(ticket_keys &keys, const uint8_t nonce[], uint32_t timestamp, uint32_t now)
+{
+    resume_replay *oldest = &keys.replays[0];
+    for (int i = 0; i < RESUME_REPLAY_SLOTS; i++)
+    {
+        resume_replay &slot = keys.replays[i];
+        if (slot.timestamp == timestamp && memcmp(slot.nonce, nonce, 12) == 0)
+            return false;
+        if (slot.timestamp < oldest->timestamp)
+            oldest = &slot;
+    }
+
+    // Every slot still guards a resume in the window, refusing is the safe side
+    if (oldest->timestamp + RESUME_WINDOW_S >= now)
+        return false;
+    memcpy(oldest->nonce, nonce, 12);
+    oldest->timestamp = timestamp;
+    return true;
+}
+
+int check_resume(ticket_keys &keys, const uint8_t ticket[], uint32_t timestamp,
+                 const uint8_t proof[], uint32_t now, uint8_t id[])
+{
+    ticket_key *key = nullptr;
+    for (int i = 0; i < 2; i++)
+    {
+        if (keys.keys[i].loaded && keys.keys[i].id == ticket[0])
+            key = &keys.keys[i];
+    }
+
+    uint8_t plain[SEALED_LEN];
+    if (key == nullptr ||
+        crypto_backend::gcm_open(key->gcm, ticket + 1, ticket, 1,
+                                 ticket + 13, SEALED_LEN, ticket + 13 + SEALED_LEN, plain) != 0)
+    {
+        keys.bad++;
+        return -1;
+    }
+
+    uint32_t expires = get_u32(plain + 6);
+    uint8_t expected[32];
+    resume_proof(plain + 10, timestamp, ticket, expected);
+    mbedtls_platform_zeroize(plain + 10, TICKET_SECRET_LEN);
+
+    if (now == 0 || expires <= now)
+    {
+        keys.expired++;
+        return -1;
+    }
+    if (timestamp + RESUME_WINDOW_S < now || timestamp > now + RESUME_WINDOW_S)
+    {
+        keys.stale++;
+        return -1;
+    }
+    if (!same_proof(expected, proof))
+    {
+        keys.bad++;
+        return -1;
+    }
+    if (!remember_use(keys, ticket + 1, timestamp, now))
+    {
+        keys.replayed++;
+        return -1;
+    }
+
+    memcpy(id, plain, 6);
+    keys.resumed++;
+    return 0;
+}
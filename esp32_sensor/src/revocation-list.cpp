@@ -0,0 +1,89 @@
+#include "revocation-list.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+revocation_stats revocation_counters;
+
+// FNV-1a over the id, split in two halves for double hashing
+static uint64_t id_hash(const uint8_t id[])
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 6; i++)
+    {
+        h ^= id[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint32_t bloom_bit(uint64_t h, int i)
+{
+    uint32_t h1 = h;
+    uint32_t h2 = (h >> 32) | 1;
+    return (h1 + i * h2) % REVOCATION_BLOOM_BITS;
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+    return memcmp(a, b, 6);
+}
+
+void clear_revocations(revocation_list &list, uint32_t version)
+{
+    list.count = 0;
+    list.version = version;
+    memset(list.bloom, 0, sizeof(list.bloom));
+}
+
+bool add_revocation(revocation_list &list, const uint8_t id[])
+{
+    if (list.count == REVOCATION_MAX)
+        return false;
+    memcpy(list.ids[list.count++], id, 6);
+    return true;
+}
+
+void index_revocations(revocation_list &list)
+{
+    qsort(list.ids, list.count, 6, compare_ids);
+
+    size_t unique = 0;
+    for (size_t i = 0; i < list.count; i++)
+    {
+        if (unique > 0 && memcmp(list.ids[unique - 1], list.ids[i], 6) == 0)
+            continue;
+        memmove(list.ids[unique++], list.ids[i], 6);
+    }
+    list.count = unique;
+
+    memset(list.bloom, 0, sizeof(list.bloom));
+    for (size_t i = 0; i < list.count; i++)
+    {
+        uint64_t h = id_hash(list.ids[i]);
+        for (int k = 0; k < REVOCATION_BLOOM_HASHES; k++)
+        {
+            uint32_t bit = bloom_bit(h, k);
+            list.bloom[bit / 8] |= 1 << (bit % 8);
+        }
+    }
+}
+
+bool is_revoked(const revocation_list &list, const uint8_t id[])
+{
+    if (list.count == 0)
+        return false;
+
+    uint64_t h = id_hash(id);
+    for (int k = 0; k < REVOCATION_BLOOM_HASHES; k++)
+    {
+        uint32_t bit = bloom_bit(h, k);
+        if ((list.bloom[bit / 8] & (1 << (bit % 8))) == 0)
+            return false;
+    }
+
+    if (bsearch(id, list.ids, list.count, 6, compare_ids) != nullptr)
+        return true;
+    revocation_counters.bloom_false_positives++;
+    return false;
+}
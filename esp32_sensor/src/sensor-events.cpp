@@ -0,0 +1,71 @@
+#include "sensor-events.h"
+
+#include <Arduino.h>
+#include "spsc-queue.h"
+
+sensor_stats sensor_counters;
+
+static spsc_queue<sensor_edge, SENSOR_RING_SIZE> edges;
+static int sensor_pin;
+static uint32_t debounce_us;
+
+// Drain side state, loop task only
+static uint8_t last_level;
+static uint32_t last_edge_us;
+static uint32_t last_detection_us;
+static bool detected_before;
+
+static void IRAM_ATTR sensor_isr()
+{
+    sensor_edge edge;
+    edge.at_us = micros();
+    edge.level = digitalRead(sensor_pin);
+
+    sensor_counters.edges++;
+    if (!spsc_push(edges, edge))
+        sensor_counters.overflows++;
+}
+
+void start_sensor_capture(int pin, unsigned long debounce_ms)
+{
+    sensor_pin = pin;
+    debounce_us = debounce_ms * 1000;
+    last_level = digitalRead(pin);
+    last_edge_us = micros();
+    attachInterrupt(digitalPinToInterrupt(pin), sensor_isr, CHANGE);
+}
+
+bool poll_motion(unsigned long &detected_ms)
+{
+    bool detected = false;
+    sensor_edge edge;
+    while (spsc_pop(edges, edge))
+    {
+        // Two edges can collapse into one level read, keep real changes only
+        if (edge.level == last_level)
+            continue;
+
+        bool settled = edge.at_us - last_edge_us >= SENSOR_SETTLE_US;
+        last_level = edge.level;
+        last_edge_us = edge.at_us;
+
+        // Motion is HIGH to LOW
+        if (edge.level != LOW)
+            continue;
+
+        if (!settled || (detected_before && edge.at_us - last_detection_us < debounce_us))
+        {
+            sensor_counters.bounces++;
+            continue;
+        }
+
+        // Back-date to when the edge happened, not when it was drained; if
+        // the drain was so late that two got through, the newer one counts
+        detected_ms = millis() - (micros() - edge.at_us) / 1000;
+        detected = true;
+        last_detection_us = edge.at_us;
+        detected_before = true;
+        sensor_counters.detections++;
+    }
+    return detected;
+}
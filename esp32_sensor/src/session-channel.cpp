@@ -0,0 +1,166 @@
+#include "session-channel.h"
+
+#include <string.h>
+#include "mbedtls/platform_util.h"
+
+static void put_u64(uint8_t out[], uint64_t value)
+{
+    for (int i = 7; i >= 0; i--)
+    {
+        out[i] = value;
+        value >>= 8;
+    }
+}
+
+static uint64_t get_u64(const uint8_t in[])
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+        value = value << 8 | in[i];
+    return value;
+}
+
+static void make_nonce(const channel_direction &dir, uint64_t seq, uint8_t nonce[])
+{
+    memcpy(nonce, dir.salt, 4);
+    put_u64(nonce + 4, seq);
+}
+
+static void key_direction(channel_direction &dir, const uint8_t key[], const uint8_t salt[])
+{
+    crypto_backend::gcm_setkey(dir.gcm, key);
+    memcpy(dir.salt, salt, 4);
+    dir.next_seq = 0;
+}
+
+void init_session_channel(session_channel &ch)
+{
+    ch.ready = false;
+    crypto_backend::gcm_init(ch.send.gcm);
+    crypto_backend::gcm_init(ch.receive.gcm);
+}
+
+void open_session_channel(session_channel &ch, const uint8_t keys[], bool sensor)
+{
+    const uint8_t *phone_key = keys;
+    const uint8_t *sensor_key = keys + 32;
+    const uint8_t *phone_salt = keys + 64;
+    const uint8_t *sensor_salt = keys + 68;
+
+    close_session_channel(ch);
+    key_direction(ch.send, sensor ? sensor_key : phone_key, sensor ? sensor_salt : phone_salt);
+    key_direction(ch.receive, sensor ? phone_key : sensor_key, sensor ? phone_salt : sensor_salt);
+    ch.ready = true;
+}
+
+void close_session_channel(session_channel &ch)
+{
+    if (!ch.ready)
+        return;
+    // Freeing wipes the key schedules, the contexts are ready to key again
+    crypto_backend::gcm_free(ch.send.gcm);
+    crypto_backend::gcm_free(ch.receive.gcm);
+    crypto_backend::gcm_init(ch.send.gcm);
+    crypto_backend::gcm_init(ch.receive.gcm);
+    ch.ready = false;
+}
+
+size_t channel_seal(session_channel &ch,
+                    const uint8_t *aad, size_t aad_len,
+                    const uint8_t *plaintext, size_t len,
+                    uint8_t message[])
+{
+    if (!ch.ready || ch.send.next_seq == UINT64_MAX)
+        return 0;
+
+    uint64_t seq = ch.send.next_seq++;
+    uint8_t nonce[12];
+    make_nonce(ch.send, seq, nonce);
+    put_u64(message, seq);
+    if (crypto_backend::gcm_seal(ch.send.gcm, nonce, aad, aad_len, plaintext, len,
+                                 message + CHANNEL_HEADER_LEN, message + CHANNEL_HEADER_LEN + len) != 0)
+        return 0;
+    return len + CHANNEL_OVERHEAD;
+}
+
+int channel_open(session_channel &ch,
+                 const uint8_t *aad, size_t aad_len,
+                 const uint8_t message[], size_t message_len,
+                 uint8_t plaintext[])
+{
+    if (!ch.ready || message_len < CHANNEL_OVERHEAD)
+        return -1;
+
+    uint64_t seq = get_u64(message);
+    if (seq < ch.receive.next_seq || seq == UINT64_MAX)
+        return -1;
+
+    size_t len = message_len - CHANNEL_OVERHEAD;
+    uint8_t nonce[12];
+    make_nonce(ch.receive, seq, nonce);
+    if (crypto_backend::gcm_open(ch.receive.gcm, nonce, aad, aad_len,
+                                 message + CHANNEL_HEADER_LEN, len,
+                                 message + CHANNEL_HEADER_LEN + len, plaintext) != 0)
+    {
+        mbedtls_platform_zeroize(plaintext, len);
+        return -1;
+    }
+    ch.receive.next_seq = seq + 1;
+    return 0;
+}
+
+int channel_seal_start(session_channel &ch, const uint8_t *aad, size_t aad_len,
+                       uint8_t header[])
+{
+    if (!ch.ready || ch.send.next_seq == UINT64_MAX)
+        return -1;
+
+    // The seq is used up even if the message is never finished, a nonce
+    // must not come back
+    ch.send.stream_seq = ch.send.next_seq++;
+    uint8_t nonce[12];
+    make_nonce(ch.send, ch.send.stream_seq, nonce);
+    put_u64(header, ch.send.stream_seq);
+    return crypto_backend::gcm_start(ch.send.gcm, true, nonce, aad, aad_len);
+}
+
+int channel_seal_update(session_channel &ch, const uint8_t *in, size_t len, uint8_t *out)
+{
+    return crypto_backend::gcm_update(ch.send.gcm, in, len, out);
+}
+
+int channel_seal_finish(session_channel &ch, uint8_t tag[])
+{
+    return crypto_backend::gcm_finish_seal(ch.send.gcm, tag);
+}
+
+int channel_open_start(session_channel &ch, const uint8_t *aad, size_t aad_len,
+                       const uint8_t header[])
+{
+    if (!ch.ready)
+        return -1;
+
+    uint64_t seq = get_u64(header);
+    if (seq < ch.receive.next_seq || seq == UINT64_MAX)
+        return -1;
+
+    ch.receive.stream_seq = seq;
+    uint8_t nonce[12];
+    make_nonce(ch.receive, seq, nonce);
+    return crypto_backend::gcm_start(ch.receive.gcm, false, nonce, aad, aad_len);
+}
+
+int channel_open_update(session_channel &ch, const uint8_t *in, size_t len, uint8_t *out)
+{
+    return crypto_backend::gcm_update(ch.receive.gcm, in, len, out);
+}
+
+int channel_open_finish(session_channel &ch, const uint8_t tag[])
+{
+    if (crypto_backend::gcm_finish_open(ch.receive.gcm, tag) != 0)
+        return -1;
+    // Only an authentic message moves the window
+    if (ch.receive.stream_seq >= ch.receive.next_seq)
+        ch.receive.next_seq = ch.receive.stream_seq + 1;
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "session-table.h"
+
+#include <string.h>
+
+static uint32_t hash_id(const uint8_t id[])
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 6; i++)
+    {
+        hash ^= id[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool is_expired(const session_table &table, const session_slot &slot, unsigned long now)
+{
+    return now - slot.created_at >= table.ttl_ms;
+}
+
+static void free_slot(session_table &table, session_slot &slot)
+{
+    mbedtls_ecdh_free(&slot.ecdh);
+    slot.state = SLOT_DELETED;
+    table.live--;
+
+    // Nothing left to probe past, drop the tombstones so lookups stay short
+    if (table.live == 0)
+    {
+        for (int i = 0; i < SESSION_TABLE_SIZE; i++)
+            table.slots[i].state = SLOT_EMPTY;
+    }
+}
+
+void init_session_table(session_table &table, unsigned long ttl_ms)
+{
+    memset(&table, 0, sizeof(table));
+    table.ttl_ms = ttl_ms;
+    for (int i = 0; i < SESSION_TABLE_SIZE; i++)
+        table.slots[i].state = SLOT_EMPTY;
+}
+
+session_slot *insert_session(session_table &table, const uint8_t id[], unsigned long now)
+{
+    uint32_t index = hash_id(id) & (SESSION_TABLE_SIZE - 1);
+    session_slot *free_slot_found = nullptr;
+
+    for (int probe = 0; probe < SESSION_TABLE_SIZE; probe++)
+    {
+        session_slot &slot = table.slots[(index + probe) & (SESSION_TABLE_SIZE - 1)];
+
+        if (slot.state == SLOT_EMPTY)
+        {
+            if (free_slot_found == nullptr)
+                free_slot_found = &slot;
+            break;
+        }
+
+        if (slot.state == SLOT_USED)
+        {
+            if (memcmp(slot.id, id, 6) == 0)
+            {
+                // Phone started over, the old handshake is dead
+                mbedtls_ecdh_free(&slot.ecdh);
+                mbedtls_ecdh_init(&slot.ecdh);
+                slot.created_at = now;
+                return &slot;
+            }
+            if (!is_expired(table, slot, now))
+                continue;
+
+            table.expired++;
+            free_slot(table, slot);
+        }
+
+        if (free_slot_found == nullptr)
+            free_slot_found = &slot;
+    }
+
+    if (free_slot_found == nullptr)
+    {
+        table.rejected++;
+        return nullptr;
+    }
+
+    memcpy(free_slot_found->id, id, 6);
+    free_slot_found->state = SLOT_USED;
+    free_slot_found->created_at = now;
+    mbedtls_ecdh_init(&free_slot_found->ecdh);
+    table.live++;
+    return free_slot_found;
+}
+
+session_slot *find_session(session_table &table, const uint8_t id[], unsigned long now)
+{
+    uint32_t index = hash_id(id) & (SESSION_TABLE_SIZE - 1);
+
+    for (int probe = 0; probe < SESSION_TABLE_SIZE; probe++)
+    {
+        session_slot &slot = table.slots[(index + probe) & (SESSION_TABLE_SIZE - 1)];
+
+        if (slot.state == SLOT_EMPTY)
+            return nullptr;
+        if (slot.state != SLOT_USED || memcmp(slot.id, id, 6) != 0)
+            continue;
+
+        if (is_expired(table, slot, now))
+        {
+            table.expired++;
+            free_slot(table, slot);
+            return nullptr;
+        }
+        return &slot;
+    }
+    return nullptr;
+}
+
+void remove_session(session_table &table, session_slot *slot)
+{
+    if (slot->state == SLOT_USED)
+        free_slot(table, *slot);
+}
+
+void expire_sessions(session_table &table, unsigned long now)
+{
+    for (int i = 0; i < SESSION_TABLE_SIZE; i++)
+    {
+        session_slot &slot = table.slots[i];
+        if (slot.state == SLOT_USED && is_expired(table, slot, now))
+        {
+            table.expired++;
+            free_slot(table, slot);
+        }
+    }
+}
@@ -0,0 +1,109 @@
+#include "text-buffer.h"
+
+#include <string.h>
+
+// 0xFF for anything that is not a hex digit
+static uint8_t hex_value[256];
+static bool hex_table_ready;
+
+static void build_hex_table()
+{
+    memset(hex_value, 0xFF, sizeof(hex_value));
+    for (int i = 0; i < 10; i++)
+        hex_value['0' + i] = i;
+    for (int i = 0; i < 6; i++)
+    {
+        hex_value['A' + i] = 10 + i;
+        hex_value['a' + i] = 10 + i;
+    }
+    hex_table_ready = true;
+}
+
+bool hex_decode(const char *hex, size_t hex_len, uint8_t bytes[], size_t len)
+{
+    if (!hex_table_ready)
+        build_hex_table();
+    if (hex == nullptr || hex_len != 2 * len)
+        return false;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        uint8_t high = hex_value[(uint8_t)hex[2 * i]];
+        uint8_t low = hex_value[(uint8_t)hex[2 * i + 1]];
+        if ((high | low) & 0xF0)
+            return false;
+        bytes[i] = (high << 4) | low;
+    }
+    return true;
+}
+
+void hex_encode(const uint8_t bytes[], size_t len, char hex[])
+{
+    static const char digits[] = "0123456789ABCDEF";
+    for (size_t i = 0; i < len; i++)
+    {
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 0x0F];
+    }
+}
+
+void init_text_writer(text_writer &writer, char buf[], size_t size)
+{
+    writer.buf = buf;
+    writer.size = size;
+    writer.len = 0;
+    writer.overflow = size == 0;
+    if (size > 0)
+        buf[0] = '\0';
+}
+
+// return true if len more characters and the nul still fit
+static bool reserve(text_writer &writer, size_t len)
+{
+    if (writer.overflow || writer.len + len >= writer.size)
+    {
+        writer.overflow = true;
+        return false;
+    }
+    return true;
+}
+
+void write_text(text_writer &writer, const char *text, size_t text_len)
+{
+    if (!reserve(writer, text_len))
+        return;
+    memcpy(writer.buf + writer.len, text, text_len);
+    writer.len += text_len;
+    writer.buf[writer.len] = '\0';
+}
+
+void write_text(text_writer &writer, const char *text)
+{
+    write_text(writer, text, strlen(text));
+}
+
+void write_hex(text_writer &writer, const uint8_t bytes[], size_t len)
+{
+    if (!reserve(writer, 2 * len))
+        return;
+    hex_encode(bytes, len, writer.buf + writer.len);
+    writer.len += 2 * len;
+    writer.buf[writer.len] = '\0';
+}
+
+void write_uint(text_writer &writer, uint32_t value)
+{
+    char digits[10];
+    size_t count = 0;
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    if (!reserve(writer, count))
+        return;
+    while (count > 0)
+        writer.buf[writer.len++] = digits[--count];
+    writer.buf[writer.len] = '\0';
+}
@@ -0,0 +1,64 @@
+#include "wall-clock.h"
+
+#include <Arduino.h>
+#include <time.h>
+
+// Anything before this means SNTP has not answered yet
+const time_t CLOCK_SYNCED_AFTER = 1700000000;
+
+void init_wall_clock(const char *ntp_server)
+{
+    configTime(0, 0, ntp_server);
+}
+
+uint32_t wall_clock_now()
+{
+    time_t now = time(nullptr);
+    if (now < CLOCK_SYNCED_AFTER)
+        return 0;
+    return (uint32_t)now;
+}
+
+static bool read_digits(const char *text, int count, int &value)
+{
+    value = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (text[i] < '0' || text[i] > '9')
+            return false;
+        value = value * 10 + (text[i] - '0');
+    }
+    return true;
+}
+
+// days since 1970-01-01 of a proleptic Gregorian date
+static int32_t days_from_civil(int y, int m, int d)
+{
+    y -= m <= 2;
+    int32_t era = (y >= 0 ? y : y - 399) / 400;
+    uint32_t yoe = (uint32_t)(y - era * 400);
+    uint32_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int32_t)doe - 719468;
+}
+
+uint32_t parse_timestamp(const char *text)
+{
+    int year, month, day, hour, minute, second;
+    if (!read_digits(text, 4, year) || text[4] != '-' ||
+        !read_digits(text + 5, 2, month) || text[7] != '-' ||
+        !read_digits(text + 8, 2, day) || text[10] != ' ' ||
+        !read_digits(text + 11, 2, hour) || text[13] != ':' ||
+        !read_digits(text + 14, 2, minute) || text[16] != ':' ||
+        !read_digits(text + 17, 2, second))
+        return 0;
+
+    if (month < 1 || month > 12 || day < 1 || day > 31 ||
+        hour > 23 || minute > 59 || second > 60)
+        return 0;
+
+    int32_t days = days_from_civil(year, month, day);
+    if (days < 0)
+        return 0;
+    return (uint32_t)days * 86400 + hour * 3600 + minute * 60 + second;
+}
@@ -0,0 +1,222 @@
+#include "wire-codec.h"
+
+#include <string.h>
+
+// Reads fields off the front of a body, failing once it runs short
+struct wire_reader
+{
+    const uint8_t *p;
+    size_t left;
+    bool ok;
+};
+
+static void take(wire_reader &in, uint8_t out[], size_t len)
+{
+    if (!in.ok || in.left < len)
+    {
+        in.ok = false;
+        return;
+    }
+    memcpy(out, in.p, len);
+    in.p += len;
+    in.left -= len;
+}
+
+static void take_signature(wire_reader &in, uint8_t out[], size_t &len)
+{
+    uint8_t sig_len = 0;
+    take(in, &sig_len, 1);
+    if (sig_len > WIRE_MAX_SIGNATURE)
+        in.ok = false;
+    len = sig_len;
+    take(in, out, len);
+}
+
+static size_t point_size(uint8_t prefix)
+{
+    if (prefix == 0x04)
+        return 65;
+    if (prefix == 0x02 || prefix == 0x03)
+        return 33;
+    return 0;
+}
+
+// a SEC1 point, its prefix tells the length
+static void take_point(wire_reader &in, uint8_t out[])
+{
+    take(in, out, 1);
+    size_t len = in.ok ? point_size(out[0]) : 0;
+    if (len == 0)
+        in.ok = false;
+    else
+        take(in, out + 1, len - 1);
+}
+
+// check the version and type bytes
+static bool take_header(wire_reader &in, uint8_t &type)
+{
+    uint8_t header[2];
+    take(in, header, 2);
+    type = header[1];
+    return in.ok && header[0] == WIRE_VERSION;
+}
+
+// the cert or cert_ref, nonce and session shared by handshake and checkin
+static bool take_hello(wire_reader &in, uint8_t type, uint8_t full_type, uint8_t ref_type,
+                       wire_handshake &request)
+{
+    if (type == full_type)
+    {
+        request.has_cert_ref = false;
+        take(in, request.id, 6);
+        take_point(in, request.pub);
+        take(in, request.valid_until, 19);
+        take_signature(in, request.signature, request.signature_len);
+    }
+    else if (type == ref_type)
+    {
+        request.has_cert_ref = true;
+        take(in, request.cert_ref, 32);
+    }
+    else
+        return false;
+
+    take(in, request.c_nonce, 12);
+    take_point(in, request.session);
+    return in.ok;
+}
+
+int decode_handshake(const uint8_t body[], size_t body_len, wire_handshake &request)
+{
+    wire_reader in = {body, body_len, true};
+    uint8_t type;
+    if (!take_header(in, type) || !take_hello(in, type, WIRE_HANDSHAKE, WIRE_HANDSHAKE_REF, request))
+        return -1;
+    return in.left == 0 ? 0 : -1;
+}
+
+int decode_authenticate(const uint8_t body[], size_t body_len, wire_authenticate &request)
+{
+    wire_reader in = {body, body_len, true};
+    uint8_t type;
+    if (!take_header(in, type) || type != WIRE_AUTHENTICATE)
+        return -1;
+
+    take(in, request.id, 6);
+    take_point(in, request.session);
+    take_signature(in, request.signature, request.signature_len);
+    return in.ok && in.left == 0 ? 0 : -1;
+}
+
+int decode_resume(const uint8_t body[], size_t body_len, wire_resume &request)
+{
+    wire_reader in = {body, body_len, true};
+    uint8_t type;
+    if (!take_header(in, type) || type != WIRE_RESUME)
+        return -1;
+
+    uint8_t timestamp[4] = {0};
+    take(in, request.ticket, WIRE_TICKET_LEN);
+    take(in, timestamp, 4);
+    take(in, request.proof, 32);
+    request.timestamp = (uint32_t)timestamp[0] << 24 | (uint32_t)timestamp[1] << 16 |
+                        (uint32_t)timestamp[2] << 8 | timestamp[3];
+    return in.ok && in.left == 0 ? 0 : -1;
+}
+
+int decode_checkin(const uint8_t body[], size_t body_len, wire_checkin &request)
+{
+    wire_reader in = {body, body_len, true};
+    uint8_t type;
+    if (!take_header(in, type) || !take_hello(in, type, WIRE_CHECKIN, WIRE_CHECKIN_REF, request.hello))
+        return -1;
+
+    take_signature(in, request.session_signature, request.session_signature_len);
+    return in.ok && in.left == 0 ? 0 : -1;
+}
+
+size_t encode_handshake_reply(const uint8_t cert[],
+                              const uint8_t s_nonce[],
+                              const uint8_t session[],
+                              const uint8_t session_signature[], size_t session_signature_len,
+                              const uint8_t cert_signature[], size_t cert_signature_len,
+                              uint8_t out[], size_t out_size)
+{
+    size_t cert_len = 6 + point_size(cert[6]) + 19;
+    size_t session_len = point_size(session[0]);
+    size_t len = 2 + cert_len + 12 + session_len + 1 + session_signature_len + 1 + cert_signature_len;
+    if (cert_len == 25 || session_len == 0 || len > out_size ||
+        session_signature_len > WIRE_MAX_SIGNATURE || cert_signature_len > WIRE_MAX_SIGNATURE)
+        return 0;
+
+    uint8_t *p = out;
+    *p++ = WIRE_VERSION;
+    *p++ = WIRE_HANDSHAKE_REPLY;
+    memcpy(p, cert, cert_len);
+    p += cert_len;
+    memcpy(p, s_nonce, 12);
+    p += 12;
+    memcpy(p, session, session_len);
+    p += session_len;
+    *p++ = session_signature_len;
+    memcpy(p, session_signature, session_signature_len);
+    p += session_signature_len;
+    *p++ = cert_signature_len;
+    memcpy(p, cert_signature, cert_signature_len);
+    return len;
+}
+
+size_t encode_challenge_reply(const uint8_t cert[],
+                              const uint8_t nonce[],
+                              const uint8_t session[],
+                              uint16_t expires_in,
+                              const uint8_t challenge_signature[], size_t challenge_signature_len,
+                              const uint8_t cert_signature[], size_t cert_signature_len,
+                              uint8_t out[], size_t out_size)
+{
+    size_t cert_len = 6 + point_size(cert[6]) + 19;
+    size_t session_len = point_size(session[0]);
+    size_t len = 2 + cert_len + 12 + session_len + 2 + 1 + challenge_signature_len + 1 + cert_signature_len;
+    if (cert_len == 25 || session_len == 0 || len > out_size ||
+        challenge_signature_len > WIRE_MAX_SIGNATURE || cert_signature_len > WIRE_MAX_SIGNATURE)
+        return 0;
+
+    uint8_t *p = out;
+    *p++ = WIRE_VERSION;
+    *p++ = WIRE_CHALLENGE_REPLY;
+    memcpy(p, cert, cert_len);
+    p += cert_len;
+    memcpy(p, nonce, 12);
+    p += 12;
+    memcpy(p, session, session_len);
+    p += session_len;
+    *p++ = expires_in >> 8;
+    *p++ = expires_in;
+    *p++ = challenge_signature_len;
+    memcpy(p, challenge_signature, challenge_signature_len);
+    p += challenge_signature_len;
+    *p++ = cert_signature_len;
+    memcpy(p, cert_signature, cert_signature_len);
+    return len;
+}
+
+size_t encode_authenticate_reply(uint32_t expires, const uint8_t ticket[],
+                                 uint8_t out[], size_t out_size)
+{
+    size_t ticket_len = ticket == nullptr ? 0 : WIRE_TICKET_LEN;
+    size_t len = 2 + 4 + 1 + ticket_len;
+    if (len > out_size)
+        return 0;
+
+    uint8_t *p = out;
+    *p++ = WIRE_VERSION;
+    *p++ = WIRE_AUTHENTICATE_REPLY;
+    *p++ = expires >> 24;
+    *p++ = expires >> 16;
+    *p++ = expires >> 8;
+    *p++ = expires;
+    *p++ = ticket_len;
+    if (ticket != nullptr)
+        memcpy(p, ticket, ticket_len);
+    return len;
+}
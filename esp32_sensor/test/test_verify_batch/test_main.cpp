@@ -0,0 +1,415 @@
+// verify_batch against mbedtls_ecdsa_verify on the build machine, with the
+// system mbedtls through the host shim:
+//
+//   pio test -e native_test
+//
+// Every signature is DER encoded here from its r and s, so the reference
+// checks exactly the values the batch parses back out. Besides signatures
+// from mbedtls_ecdsa_sign, keys are crafted so that u1*G and u2*Q are the
+// same point or opposite ones, the case check_sum_x hands to mbedtls.
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+#include "ecdsa.h"
+#include "crypto-backend.h"
+#include "crypto-random-engine.h"
+#include "mbedtls/asn1write.h"
+
+#define OK(call) TEST_ASSERT_EQUAL_INT(0, (call))
+
+struct signed_message
+{
+    uint8_t message[32];
+    mbedtls_ecdsa_context key; // d and Q; grp stays empty like gen_signature_key's
+    uint8_t pub[POINT_LEN];
+    size_t pub_len;
+    mbedtls_mpi r;
+    mbedtls_mpi s;
+    uint8_t signature[MBEDTLS_ECDSA_MAX_LEN];
+    size_t signature_len;
+    bool ca;        // sent with pub_bytes nullptr, key must be the anchor's
+    bool malformed; // signature is not DER, there is nothing to compare
+};
+
+static trust_anchor anchor;
+static mbedtls_ecdsa_context ca_key;
+
+static void init_message(signed_message &m)
+{
+    memset(&m, 0, sizeof(m));
+    mbedtls_ecdsa_init(&m.key);
+    mbedtls_mpi_init(&m.r);
+    mbedtls_mpi_init(&m.s);
+}
+
+static void free_message(signed_message &m)
+{
+    mbedtls_ecdsa_free(&m.key);
+    mbedtls_mpi_free(&m.r);
+    mbedtls_mpi_free(&m.s);
+}
+
+// e = H(m) mod n, as both verifiers derive it
+static void message_hash(const signed_message &m, uint8_t hash[32], mbedtls_mpi &e)
+{
+    crypto_backend::sha256(m.message, sizeof(m.message), hash);
+    OK(mbedtls_mpi_read_binary(&e, hash, 32));
+    OK(mbedtls_mpi_mod_mpi(&e, &e, &p256_group.N));
+}
+
+static void encode_signature(signed_message &m)
+{
+    uint8_t buf[MBEDTLS_ECDSA_MAX_LEN];
+    unsigned char *p = buf + sizeof(buf);
+    size_t len = 0;
+    int ret;
+    TEST_ASSERT((ret = mbedtls_asn1_write_mpi(&p, buf, &m.s)) > 0);
+    len += ret;
+    TEST_ASSERT((ret = mbedtls_asn1_write_mpi(&p, buf, &m.r)) > 0);
+    len += ret;
+    TEST_ASSERT((ret = mbedtls_asn1_write_len(&p, buf, len)) > 0);
+    len += ret;
+    TEST_ASSERT((ret = mbedtls_asn1_write_tag(&p, buf, MBEDTLS_ASN1_CONSTRUCTED | MBEDTLS_ASN1_SEQUENCE)) > 0);
+    len += ret;
+    memcpy(m.signature, p, len);
+    m.signature_len = len;
+}
+
+// key of m from d, Q = d*G
+static void set_key(signed_message &m, const mbedtls_mpi &d, bool compressed)
+{
+    OK(mbedtls_mpi_copy(&m.key.d, &d));
+    OK(mbedtls_ecp_mul(&p256_group, &m.key.Q, &m.key.d, &p256_group.G,
+                       mbedtls_ctr_drbg_random, &ctr_drbg));
+    get_public_bytes(m.key, m.pub, m.pub_len, compressed);
+}
+
+// a random message signed by a fresh key, or by the CA
+static void make_signed(signed_message &m, bool ca, bool compressed = false)
+{
+    OK(mbedtls_ctr_drbg_random(&ctr_drbg, m.message, sizeof(m.message)));
+    if (ca)
+        set_key(m, ca_key.d, false);
+    else
+    {
+        mbedtls_mpi d;
+        mbedtls_mpi_init(&d);
+        OK(mbedtls_ecp_gen_privkey(&p256_group, &d, mbedtls_ctr_drbg_random, &ctr_drbg));
+        set_key(m, d, compressed);
+        mbedtls_mpi_free(&d);
+    }
+    m.ca = ca;
+
+    uint8_t hash[32];
+    mbedtls_mpi e;
+    mbedtls_mpi_init(&e);
+    message_hash(m, hash, e);
+    OK(mbedtls_ecdsa_sign(&p256_group, &m.r, &m.s, &m.key.d, hash, sizeof(hash),
+                          mbedtls_ctr_drbg_random, &ctr_drbg));
+    mbedtls_mpi_free(&e);
+    encode_signature(m);
+}
+
+// x = x + 1 mod n, never 0
+static void bump(mbedtls_mpi &x)
+{
+    OK(mbedtls_mpi_add_int(&x, &x, 1));
+    if (mbedtls_mpi_cmp_mpi(&x, &p256_group.N) >= 0)
+        OK(mbedtls_mpi_lset(&x, 1));
+}
+
+static void corrupt_r(signed_message &m)
+{
+    bump(m.r);
+    encode_signature(m);
+}
+
+static void corrupt_s(signed_message &m)
+{
+    bump(m.s);
+    encode_signature(m);
+}
+
+// With d = e / r, u2*Q = (r / s)(e / r)G = (e / s)G = u1*G, whatever s is;
+// d = -e / r gives -u1*G. Choosing r = x(2 (e / s) G) makes the first a
+// valid signature whose check has to double instead of add.
+static void make_same_point(signed_message &m, bool opposite)
+{
+    const mbedtls_mpi &N = p256_group.N;
+    OK(mbedtls_ctr_drbg_random(&ctr_drbg, m.message, sizeof(m.message)));
+
+    uint8_t hash[32];
+    mbedtls_mpi e, k, d;
+    mbedtls_ecp_point P;
+    mbedtls_mpi_init(&e);
+    mbedtls_mpi_init(&k);
+    mbedtls_mpi_init(&d);
+    mbedtls_ecp_point_init(&P);
+    message_hash(m, hash, e);
+    TEST_ASSERT(mbedtls_mpi_cmp_int(&e, 0) != 0);
+
+    OK(mbedtls_ecp_gen_privkey(&p256_group, &m.s, mbedtls_ctr_drbg_random, &ctr_drbg));
+    OK(mbedtls_mpi_inv_mod(&k, &m.s, &N));
+    OK(mbedtls_mpi_mul_mpi(&k, &k, &e));
+    OK(mbedtls_mpi_shift_l(&k, 1));
+    OK(mbedtls_mpi_mod_mpi(&k, &k, &N));
+    OK(mbedtls_ecp_mul(&p256_group, &P, &k, &p256_group.G, mbedtls_ctr_drbg_random, &ctr_drbg));
+    OK(mbedtls_mpi_mod_mpi(&m.r, &P.X, &N));
+    TEST_ASSERT(mbedtls_mpi_cmp_int(&m.r, 0) != 0);
+
+    OK(mbedtls_mpi_inv_mod(&d, &m.r, &N));
+    OK(mbedtls_mpi_mul_mpi(&d, &d, &e));
+    OK(mbedtls_mpi_mod_mpi(&d, &d, &N));
+    if (opposite)
+        OK(mbedtls_mpi_sub_mpi(&d, &N, &d));
+    set_key(m, d, false);
+
+    mbedtls_mpi_free(&e);
+    mbedtls_mpi_free(&k);
+    mbedtls_mpi_free(&d);
+    mbedtls_ecp_point_free(&P);
+    encode_signature(m);
+}
+
+static int reference_verify(const signed_message &m)
+{
+    if (m.malformed)
+        return -1;
+    uint8_t hash[32];
+    mbedtls_mpi e;
+    mbedtls_mpi_init(&e);
+    message_hash(m, hash, e);
+    mbedtls_mpi_free(&e);
+    return mbedtls_ecdsa_verify(&p256_group, hash, sizeof(hash), &m.key.Q, &m.r, &m.s);
+}
+
+// Run the batch and hold every verdict against the reference; return how
+// many items the reference accepted
+static size_t check_batch(trust_anchor &batch_anchor, signed_message messages[], size_t count)
+{
+    verify_item items[2 * VERIFY_BATCH_MAX];
+    int results[2 * VERIFY_BATCH_MAX];
+    TEST_ASSERT(count <= 2 * VERIFY_BATCH_MAX);
+    for (size_t i = 0; i < count; i++)
+    {
+        signed_message &m = messages[i];
+        items[i] = {m.message, sizeof(m.message), m.ca ? nullptr : m.pub, m.signature, m.signature_len};
+    }
+
+    int batch_status = verify_batch(batch_anchor, items, count, results);
+
+    size_t valid = 0;
+    char label[32];
+    for (size_t i = 0; i < count; i++)
+    {
+        snprintf(label, sizeof(label), "item %u", (unsigned)i);
+        bool expected = reference_verify(messages[i]) == 0;
+        TEST_ASSERT_EQUAL_MESSAGE(expected, results[i] == 0, label);
+        valid += expected;
+    }
+    TEST_ASSERT_EQUAL(valid == count, batch_status == 0);
+    return valid;
+}
+
+static void free_messages(signed_message messages[], size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        free_message(messages[i]);
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_valid_signatures()
+{
+    signed_message messages[VERIFY_BATCH_MAX];
+    for (size_t i = 0; i < VERIFY_BATCH_MAX; i++)
+    {
+        init_message(messages[i]);
+        make_signed(messages[i], false, i % 2 == 1);
+    }
+    TEST_ASSERT_EQUAL(VERIFY_BATCH_MAX, check_batch(anchor, messages, VERIFY_BATCH_MAX));
+    free_messages(messages, VERIFY_BATCH_MAX);
+}
+
+void test_valid_ca_signatures()
+{
+    // more than one batch's worth, so verify_batch splits them
+    const size_t count = VERIFY_BATCH_MAX + 3;
+    signed_message messages[count];
+    for (size_t i = 0; i < count; i++)
+    {
+        init_message(messages[i]);
+        make_signed(messages[i], true);
+    }
+    TEST_ASSERT_EQUAL(count, check_batch(anchor, messages, count));
+    free_messages(messages, count);
+}
+
+void test_single_signature()
+{
+    signed_message m;
+    init_message(m);
+    make_signed(m, true);
+    TEST_ASSERT_EQUAL(1, check_batch(anchor, &m, 1));
+    OK(verify(anchor, m.message, sizeof(m.message), m.signature, m.signature_len));
+    corrupt_s(m);
+    TEST_ASSERT_EQUAL(0, check_batch(anchor, &m, 1));
+    TEST_ASSERT(verify(anchor, m.message, sizeof(m.message), m.signature, m.signature_len) != 0);
+    free_message(m);
+}
+
+void test_corrupted_r()
+{
+    signed_message messages[4];
+    for (size_t i = 0; i < 4; i++)
+    {
+        init_message(messages[i]);
+        make_signed(messages[i], i % 2 == 0);
+    }
+    corrupt_r(messages[1]);
+    corrupt_r(messages[2]);
+    TEST_ASSERT_EQUAL(2, check_batch(anchor, messages, 4));
+    free_messages(messages, 4);
+}
+
+void test_corrupted_s()
+{
+    signed_message messages[4];
+    for (size_t i = 0; i < 4; i++)
+    {
+        init_message(messages[i]);
+        make_signed(messages[i], i % 2 == 0);
+    }
+    // the wrong s go through the shared inversion with the right ones, which
+    // must still come out right
+    corrupt_s(messages[0]);
+    corrupt_s(messages[3]);
+    TEST_ASSERT_EQUAL(2, check_batch(anchor, messages, 4));
+    free_messages(messages, 4);
+}
+
+void test_mixed_batch()
+{
+    const size_t count = 2 * VERIFY_BATCH_MAX;
+    signed_message messages[count];
+    for (size_t i = 0; i < count; i++)
+    {
+        init_message(messages[i]);
+        make_signed(messages[i], i % 3 == 0, i % 4 == 1);
+        switch (i % 5)
+        {
+        case 1:
+            corrupt_r(messages[i]);
+            break;
+        case 3:
+            corrupt_s(messages[i]);
+            break;
+        }
+    }
+    // DER cut short, and s out of range
+    messages[4].signature_len -= 3;
+    messages[4].malformed = true;
+    OK(mbedtls_mpi_copy(&messages[9].s, &p256_group.N));
+    encode_signature(messages[9]);
+    messages[9].malformed = true;
+
+    check_batch(anchor, messages, count);
+    free_messages(messages, count);
+}
+
+void test_no_anchor()
+{
+    // CA items fail without a loaded anchor, the others are unaffected
+    trust_anchor empty;
+    empty.loaded = false;
+    signed_message messages[2];
+    init_message(messages[0]);
+    init_message(messages[1]);
+    make_signed(messages[0], true);
+    make_signed(messages[1], false);
+
+    verify_item items[2];
+    int results[2];
+    for (int i = 0; i < 2; i++)
+        items[i] = {messages[i].message, sizeof(messages[i].message), messages[i].ca ? nullptr : messages[i].pub,
+                    messages[i].signature, messages[i].signature_len};
+    TEST_ASSERT(verify_batch(empty, items, 2, results) != 0);
+    TEST_ASSERT(results[0] != 0);
+    TEST_ASSERT_EQUAL_INT(0, results[1]);
+    free_messages(messages, 2);
+}
+
+void test_same_point()
+{
+    signed_message messages[4];
+    for (size_t i = 0; i < 4; i++)
+        init_message(messages[i]);
+    make_same_point(messages[0], false);
+    make_same_point(messages[1], false);
+    corrupt_s(messages[1]); // still R1 == R2, now the wrong x
+    make_signed(messages[2], false);
+    make_signed(messages[3], true);
+
+    TEST_ASSERT_EQUAL_INT(0, reference_verify(messages[0]));
+    TEST_ASSERT_EQUAL(3, check_batch(anchor, messages, 4));
+
+    // The same with the crafted key as the CA, through its comb table
+    trust_anchor crafted;
+    OK(load_trust_anchor(crafted, messages[0].pub));
+    messages[0].ca = true;
+    messages[1].ca = true;
+    messages[3].ca = false;
+    TEST_ASSERT_EQUAL(3, check_batch(crafted, messages, 4));
+    mbedtls_ecp_group_free(&crafted.grp);
+    free_messages(messages, 4);
+}
+
+void test_opposite_points()
+{
+    signed_message messages[3];
+    for (size_t i = 0; i < 3; i++)
+        init_message(messages[i]);
+    make_signed(messages[0], true);
+    make_same_point(messages[1], true); // u1*G + u2*Q is the point at infinity
+    make_signed(messages[2], false);
+
+    TEST_ASSERT(reference_verify(messages[1]) != 0);
+    TEST_ASSERT_EQUAL(2, check_batch(anchor, messages, 3));
+    free_messages(messages, 3);
+}
+
+int main()
+{
+    init_crypto_random_engine();
+    mbedtls_ecdsa_init(&ca_key);
+    gen_signature_key(ca_key);
+    uint8_t ca_pub[POINT_LEN];
+    size_t ca_pub_len;
+    get_public_bytes(ca_key, ca_pub, ca_pub_len);
+    if (load_trust_anchor(anchor, ca_pub) != 0)
+        return 1;
+
+    UNITY_BEGIN();
+    RUN_TEST(test_valid_signatures);
+    RUN_TEST(test_valid_ca_signatures);
+    RUN_TEST(test_single_signature);
+    RUN_TEST(test_corrupted_r);
+    RUN_TEST(test_corrupted_s);
+    RUN_TEST(test_mixed_batch);
+    RUN_TEST(test_no_anchor);
+    RUN_TEST(test_same_point);
+    RUN_TEST(test_opposite_points);
+    int failures = UNITY_END();
+
+    mbedtls_ecp_group_free(&anchor.grp);
+    mbedtls_ecdsa_free(&ca_key);
+    return failures;
+}
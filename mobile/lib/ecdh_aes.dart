@@ -34,10 +34,14 @@ class ECDHCrypto {
     );
   }
 
-  /// Convert public key to uncompressed point bytes (X9.62 format)
-  /// Compatible with Python's X962 UncompressedPoint encoding
-  static Uint8List getPublicBytes(ECPublicKey publicKey) {
+  /// Convert public key to point bytes (X9.62 format), 65 bytes or 33 when
+  /// compressed. Compatible with Python's X962 UncompressedPoint and
+  /// CompressedPoint encodings
+  static Uint8List getPublicBytes(ECPublicKey publicKey, {bool compressed = false}) {
     final point = publicKey.Q!;
+    if (compressed) {
+      return point.getEncoded(true);
+    }
     
     // Get field size in bytes (32 for secp256r1)
     final fieldSize = 32;
@@ -57,24 +61,8 @@ class ECDHCrypto {
 
   /// Perform ECDH key exchange
   static Uint8List getSharedSecret(ECPrivateKey thisPrivateKey, Uint8List otherPublicBytes) {
-    if (otherPublicBytes[0] != 0x04) {
-      throw ArgumentError('Only uncompressed points are supported');
-    }
-    
     final domainParams = ECDomainParameters('secp256r1');
-    final fieldSize = 32; // 32 bytes for secp256r1
-    
-    if (otherPublicBytes.length != 1 + fieldSize * 2) {
-      throw ArgumentError('Invalid public key length');
-    }
-    
-    final xBytes = otherPublicBytes.sublist(1, 1 + fieldSize);
-    final yBytes = otherPublicBytes.sublist(1 + fieldSize, 1 + fieldSize * 2);
-    
-    final x = _bytesToBigInt(xBytes);
-    final y = _bytesToBigInt(yBytes);
-    
-    final point = domainParams.curve.createPoint(x, y);
+    final point = _decodePoint(domainParams, otherPublicBytes);
     
     final otherPublicKey = ECPublicKey(point, domainParams);
 
@@ -91,7 +79,15 @@ class ECDHCrypto {
   /// Derive shared key using HKDF-SHA256
   /// Compatible with Python's HKDF implementation
   static Uint8List getSharedKey(Uint8List sharedSecret) {
-    const info = 'handshake data';
+    return _hkdf(sharedSecret, 'handshake data');
+  }
+
+  /// Secret behind a sensor's resume ticket, proves we hold the ticket
+  static Uint8List getResumptionSecret(Uint8List sharedSecret) {
+    return _hkdf(sharedSecret, 'resumption');
+  }
+
+  static Uint8List _hkdf(Uint8List sharedSecret, String info) {
     const length = 32;
     
     // HKDF Extract: PRK = HMAC-SHA256(salt, IKM)
@@ -171,12 +167,17 @@ class ECDHCrypto {
     return bytes;
   }
 
-  static BigInt _bytesToBigInt(Uint8List bytes) {
-    BigInt result = BigInt.zero;
-    for (int i = 0; i < bytes.length; i++) {
-      result = (result << 8) + BigInt.from(bytes[i]);
+  /// Point from SEC1 bytes, 0x04 || x || y or 0x02/0x03 || x
+  static ECPoint _decodePoint(ECDomainParameters domainParams, Uint8List bytes) {
+    final length = bytes.isEmpty
+        ? 0
+        : bytes[0] == 0x04
+            ? 65
+            : (bytes[0] == 0x02 || bytes[0] == 0x03) ? 33 : 0;
+    if (length == 0 || bytes.length != length) {
+      throw ArgumentError('Invalid public key length');
     }
-    return result;
+    return domainParams.curve.decodePoint(bytes)!;
   }
 
   static Uint8List _generateSecureRandom(int length) {
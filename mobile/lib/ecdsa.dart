@@ -28,10 +28,14 @@ class ECDSA {
     );
   }
 
-  /// Convert public key to uncompressed point bytes (X9.62 format)
-  /// Compatible with Python's X962 UncompressedPoint encoding
-  static Uint8List getPublicBytes(ECPublicKey publicKey) {
+  /// Convert public key to point bytes (X9.62 format), 65 bytes or 33 when
+  /// compressed. Compatible with Python's X962 UncompressedPoint and
+  /// CompressedPoint encodings
+  static Uint8List getPublicBytes(ECPublicKey publicKey, {bool compressed = false}) {
     final point = publicKey.Q!;
+    if (compressed) {
+      return point.getEncoded(true);
+    }
 
     // Get field size in bytes (32 for secp256r1)
     final fieldSize = 32;
@@ -63,6 +67,14 @@ static Uint8List certBytes(Uint8List id, Uint8List publicBytes, Uint8List validU
       builder.add(serverPubBytes);
       return builder.toBytes();
   }
+
+  /// What a sensor signs for GET /challenge: nonce || its session key
+  static Uint8List challengeBytes(Uint8List nonce, Uint8List serverPubBytes) {
+      BytesBuilder builder = BytesBuilder();
+      builder.add(nonce);
+      builder.add(serverPubBytes);
+      return builder.toBytes();
+  }
   
   /// Encrypt using AES-GCM
   /// Returns (nonce, ciphertext, tag) - same as Python implementation
@@ -167,24 +179,8 @@ static ECPrivateKey pemToECPrivateKey(String pem) {
     Uint8List publicBytes,
     Uint8List signature,
   ) {
-    if (publicBytes[0] != 0x04) {
-      throw ArgumentError('Only uncompressed points are supported');
-    }
-
     final domainParams = ECDomainParameters('secp256r1');
-    final fieldSize = 32; // 32 bytes for secp256r1
-
-    if (publicBytes.length != 1 + fieldSize * 2) {
-      throw ArgumentError('Invalid public key length');
-    }
-
-    final xBytes = publicBytes.sublist(1, 1 + fieldSize);
-    final yBytes = publicBytes.sublist(1 + fieldSize, 1 + fieldSize * 2);
-
-    final x = _bytesToBigInt(xBytes);
-    final y = _bytesToBigInt(yBytes);
-
-    final point = domainParams.curve.createPoint(x, y);
+    final point = _decodePoint(domainParams, publicBytes);
 
     final publicKey = ECPublicKey(point, domainParams);
 
@@ -216,12 +212,17 @@ static ECPrivateKey pemToECPrivateKey(String pem) {
     return bytes;
   }
 
-  static BigInt _bytesToBigInt(Uint8List bytes) {
-    BigInt result = BigInt.zero;
-    for (int i = 0; i < bytes.length; i++) {
-      result = (result << 8) + BigInt.from(bytes[i]);
+  /// Point from SEC1 bytes, 0x04 || x || y or 0x02/0x03 || x
+  static ECPoint _decodePoint(ECDomainParameters domainParams, Uint8List bytes) {
+    final length = bytes.isEmpty
+        ? 0
+        : bytes[0] == 0x04
+            ? 65
+            : (bytes[0] == 0x02 || bytes[0] == 0x03) ? 33 : 0;
+    if (length == 0 || bytes.length != length) {
+      throw ArgumentError('Invalid public key length');
     }
-    return result;
+    return domainParams.curve.decodePoint(bytes)!;
   }
 
   static Uint8List _generateSecureRandom(int length) {
@@ -6,10 +6,12 @@ import 'package:path_provider/path_provider.dart';
 import 'package:http/http.dart' as http;
 import 'ecdsa.dart';
 import 'ecdh_aes.dart';
+import 'wire_codec.dart';
 import 'dart:typed_data';
 import 'package:shared_preferences/shared_preferences.dart';
 import 'dart:math';
 import 'dart:convert';
+import 'package:crypto/crypto.dart';
 
 String? ecdsa_pub;
 
@@ -36,6 +38,13 @@ class _HomePageState extends State<HomePage> {
   final TextEditingController _idController = TextEditingController();
   final TextEditingController _tokenController = TextEditingController();
 
+  // The sensor's published challenge, verified when fetched
+  ChallengeReply? _challenge;
+  DateTime _challengeUsableUntil = DateTime.fromMillisecondsSinceEpoch(0);
+  // Cert id of the sensor we last heard from; every sensor answers on the
+  // same address, so this is what tells them apart
+  Uint8List? _sensorId;
+
   @override
   void initState() {
     super.initState();
@@ -75,7 +84,7 @@ class _HomePageState extends State<HomePage> {
     final id = _idController.text.trim();
     final token = _tokenController.text.trim();
     final ecdsaKeyPair = ECDSA.genKey();
-    final ecdsaPubBytes = ECDSA.getPublicBytes(ecdsaKeyPair.publicKey);
+    final ecdsaPubBytes = ECDSA.getPublicBytes(ecdsaKeyPair.publicKey, compressed: true);
     final ecdasPrivate = ecdsaKeyPair.privateKey;
     final keyHex = _bytesToHex(ecdsaPubBytes).toUpperCase();
 
@@ -125,6 +134,9 @@ class _HomePageState extends State<HomePage> {
       await saveToFile('signature', data['signature']);
       await saveToLocalStorage('valid_until', data['valid_until']);
       await saveToLocalStorage('id', id);
+      final prefs = await SharedPreferences.getInstance();
+      await _forgetCachedCert(prefs);
+      await prefs.remove('ticket');
     } else {
       ScaffoldMessenger.of(context).showSnackBar(
         SnackBar(content: Text("Send fail: ${response.statusCode}")),
@@ -194,10 +206,16 @@ class _HomePageState extends State<HomePage> {
 
     final signature = await readFile('signature');
 
+    // A ticket from the last visit saves the whole handshake
+    if (await _resume(prefs)) {
+      print("resumed session");
+      return;
+    }
+
     final cNonce = _randomBytes(12);
 
     final ecdhKeyPair = await ECDHCrypto.genKey();
-    final ecdhPubBytes = ECDHCrypto.getPublicBytes(ecdhKeyPair.publicKey);
+    final ecdhPubBytes = ECDHCrypto.getPublicBytes(ecdhKeyPair.publicKey, compressed: true);
 
     final url = Uri.parse("http://192.168.4.1/handshake");
 
@@ -207,40 +225,64 @@ class _HomePageState extends State<HomePage> {
     print("cNonce: ${_bytesToHex(Uint8List.fromList(cNonce))}");
     print("signature: $signature");
 
-    final response = await http.post(
+    final cNonceBytes = Uint8List.fromList(cNonce);
+    final myCertBytes = ECDSA.certBytes(
+      ascii.encode(myId!),
+      _hexToBytes(ecdsa_pub!),
+      ascii.encode(validUntil!),
+    );
+
+    // One request over a challenge signed ahead, the two round handshake
+    // below is the fallback
+    if (await _checkIn(prefs, myCertBytes, signature!)) {
+      print("checked in with one request");
+      return;
+    }
+    final fullCert = WireCodec.encodeHandshake(
+      myCertBytes,
+      _hexToBytes(signature),
+      cNonceBytes,
+      ecdhPubBytes,
+    );
+    final wireHeaders = {'Content-Type': WireCodec.contentType};
+
+    // Once a sensor has verified our cert it only needs its digest
+    final sensorId = _sensorId;
+    final cached = sensorId != null && (prefs.getBool(_certCachedKey(sensorId)) ?? false);
+    var response = await http.post(
       url,
-      headers: {'Content-Type': 'application/json'},
-      body: jsonEncode({
-        'id': myId,
-        'valid_until': validUntil,
-        'pub': ecdsa_pub,
-        'signature': signature,
-        'c_nonce': _bytesToHex(Uint8List.fromList(cNonce)),
-        'session': _bytesToHex(ecdhPubBytes).toUpperCase(),
-      }),
+      headers: wireHeaders,
+      body: cached
+          ? WireCodec.encodeHandshakeRef(
+              _certRef(myCertBytes, signature),
+              cNonceBytes,
+              ecdhPubBytes,
+            )
+          : fullCert,
     );
 
+    if (response.statusCode == 409) {
+      print("sensor does not know our cert, sending it in full");
+      if (sensorId != null) {
+        await prefs.remove(_certCachedKey(sensorId));
+      }
+      response = await http.post(url, headers: wireHeaders, body: fullCert);
+    }
+
     if (response.statusCode == 200) {
-      final Map<String, dynamic> data = jsonDecode(response.body);
-      final serverId = data['id'];
-      final validUntil = data['valid_until'];
-      final pub = data['pub'];
-      final session_signature = data['session_signature'];
-      final cert_signature = data['cert_signature'];
-      final session = data['session'];
-      final s_nonce = data['s_nonce'];
-
-      print(data);
-
-      final certBytes = ECDSA.certBytes(
-        ascii.encode(serverId),
-        _hexToBytes(pub),
-        ascii.encode(validUntil),
-      );
+      final reply = WireCodec.decodeHandshakeReply(response.bodyBytes);
+      if (reply == null) {
+        print("malformed handshake reply");
+        return;
+      }
+      _sensorId = reply.id;
+      await prefs.setBool(_certCachedKey(reply.id), true);
+
+      final certBytes = ECDSA.certBytes(reply.id, reply.pub, reply.validUntil);
       if (ECDSA.verify(
         certBytes,
         _hexToBytes((await readFile('ca.pub'))!),
-        _hexToBytes(cert_signature),
+        reply.certSignature,
       )) {
         print("valid server cert");
       } else {
@@ -249,16 +291,12 @@ class _HomePageState extends State<HomePage> {
       }
 
       final sessionBytes = ECDSA.sessionBytes(
-        Uint8List.fromList(cNonce),
+        cNonceBytes,
         ecdhPubBytes,
-        _hexToBytes(session),
+        reply.session,
       );
 
-      if (ECDSA.verify(
-        sessionBytes,
-        _hexToBytes(pub),
-        _hexToBytes(session_signature),
-      )) {
+      if (ECDSA.verify(sessionBytes, reply.pub, reply.sessionSignature)) {
         print("valid server session");
       } else {
         print("invalid server session");
@@ -272,9 +310,9 @@ class _HomePageState extends State<HomePage> {
       );
 
       final returnSessionBytes = ECDSA.sessionBytes(
-        _hexToBytes(s_nonce),
+        reply.sNonce,
         ecdhPubBytes,
-        _hexToBytes(session),
+        reply.session,
       );
 
       final returnSessionSig = ECDSA.sign(
@@ -282,30 +320,210 @@ class _HomePageState extends State<HomePage> {
         returnSessionBytes,
       );
 
-      print("s_nonce: $s_nonce");
+      print("s_nonce: ${_bytesToHex(reply.sNonce)}");
       print("ecdhPubBytes: ${_bytesToHex(ecdhPubBytes).toUpperCase()}");
       print("ecdsa_pub: $ecdsa_pub");
-      print("session: ${_bytesToHex(_hexToBytes(session)).toUpperCase()}");
+      print("session: ${_bytesToHex(reply.session).toUpperCase()}");
       print("returnSessionSig: ${_bytesToHex(returnSessionSig).toUpperCase()}");
 
       final response2 = await http.post(
         authURL,
-        headers: {'Content-Type': 'application/json'},
-        body: jsonEncode({
-          'id': myId,
-          'signature': _bytesToHex(returnSessionSig).toUpperCase(),
-          'pub': ecdsa_pub,
-          'session': _bytesToHex(ecdhPubBytes).toUpperCase(),
-        }),
+        headers: wireHeaders,
+        body: WireCodec.encodeAuthenticate(
+          myId,
+          ecdhPubBytes,
+          returnSessionSig,
+        ),
       );
 
-      print("authentication response: ${response2.body}");
+      print("authentication response: ${response2.statusCode}");
+
+      final authReply = response2.statusCode == 200
+          ? WireCodec.decodeAuthenticateReply(response2.bodyBytes)
+          : null;
+      if (authReply?.ticket != null) {
+        await _keepTicket(
+          prefs,
+          authReply!,
+          ECDHCrypto.getSharedSecret(ecdhKeyPair.privateKey, reply.session),
+        );
+      }
     } else {
       print('Authentication failed:');
       return;
     }
   }
 
+  /// GET /challenge unless the cached one is still good, null if the sensor
+  /// has none or it does not verify
+  Future<ChallengeReply?> _fetchChallenge() async {
+    if (_challenge != null && DateTime.now().isBefore(_challengeUsableUntil)) {
+      return _challenge;
+    }
+    _challenge = null;
+
+    final response = await http.get(
+      Uri.parse("http://192.168.4.1/challenge"),
+      headers: {'Accept': WireCodec.contentType},
+    );
+    if (response.statusCode != 200) {
+      return null;
+    }
+    final reply = WireCodec.decodeChallengeReply(response.bodyBytes);
+    if (reply == null) {
+      return null;
+    }
+
+    final certBytes = ECDSA.certBytes(reply.id, reply.pub, reply.validUntil);
+    final caPub = _hexToBytes((await readFile('ca.pub'))!);
+    if (!ECDSA.verify(certBytes, caPub, reply.certSignature) ||
+        !ECDSA.verify(
+          ECDSA.challengeBytes(reply.challenge, reply.session),
+          reply.pub,
+          reply.challengeSignature,
+        )) {
+      print("invalid challenge");
+      return null;
+    }
+
+    // Leave the request time to get there before the sensor drops it
+    _sensorId = reply.id;
+    _challenge = reply;
+    _challengeUsableUntil = DateTime.now().add(
+      Duration(seconds: max(reply.expiresIn - 2, 0)),
+    );
+    return reply;
+  }
+
+  /// POST /checkin over the sensor's challenge, false if we need the two
+  /// round handshake
+  Future<bool> _checkIn(
+    SharedPreferences prefs,
+    Uint8List certBytes,
+    String signature,
+  ) async {
+    final challenge = await _fetchChallenge();
+    if (challenge == null) {
+      return false;
+    }
+
+    final ecdhKeyPair = ECDHCrypto.genKey();
+    final ecdhPubBytes = ECDHCrypto.getPublicBytes(ecdhKeyPair.publicKey, compressed: true);
+    final sessionSignature = ECDSA.sign(
+      ECDSA.pemToECPrivateKey((await readFile('ecdsa.pem'))!),
+      ECDSA.sessionBytes(challenge.challenge, ecdhPubBytes, challenge.session),
+    );
+
+    final url = Uri.parse("http://192.168.4.1/checkin");
+    final headers = {'Content-Type': WireCodec.contentType};
+    final fullCert = WireCodec.encodeCheckin(
+      certBytes,
+      _hexToBytes(signature),
+      challenge.challenge,
+      ecdhPubBytes,
+      sessionSignature,
+    );
+    final cachedKey = _certCachedKey(challenge.id);
+    final cached = prefs.getBool(cachedKey) ?? false;
+    var response = await http.post(
+      url,
+      headers: headers,
+      body: cached
+          ? WireCodec.encodeCheckinRef(
+              _certRef(certBytes, signature),
+              challenge.challenge,
+              ecdhPubBytes,
+              sessionSignature,
+            )
+          : fullCert,
+    );
+    if (response.statusCode == 409 && cached && response.body.contains('cert_ref')) {
+      // Rebooted, or evicted us: it needs the cert in full again
+      await prefs.remove(cachedKey);
+      response = await http.post(url, headers: headers, body: fullCert);
+    }
+    if (response.statusCode != 200) {
+      // A challenge that rotated out or was used already is not retried
+      print("checkin refused: ${response.statusCode}");
+      _challenge = null;
+      return false;
+    }
+    await prefs.setBool(cachedKey, true);
+
+    final authReply = WireCodec.decodeAuthenticateReply(response.bodyBytes);
+    if (authReply?.ticket != null) {
+      await _keepTicket(
+        prefs,
+        authReply!,
+        ECDHCrypto.getSharedSecret(ecdhKeyPair.privateKey, challenge.session),
+      );
+    }
+    return true;
+  }
+
+  Future<void> _keepTicket(
+    SharedPreferences prefs,
+    AuthenticateReply reply,
+    Uint8List sharedSecret,
+  ) async {
+    final resumptionSecret = ECDHCrypto.getResumptionSecret(sharedSecret);
+    await prefs.setString('ticket', _bytesToHex(reply.ticket!));
+    await prefs.setString('ticket_secret', _bytesToHex(resumptionSecret));
+    await prefs.setInt('ticket_expires', reply.expires);
+  }
+
+  /// POST /resume with the stored ticket, false if we need the full exchange
+  Future<bool> _resume(SharedPreferences prefs) async {
+    final ticketHex = prefs.getString('ticket');
+    final secretHex = prefs.getString('ticket_secret');
+    final expires = prefs.getInt('ticket_expires') ?? 0;
+    final now = DateTime.now().millisecondsSinceEpoch ~/ 1000;
+    if (ticketHex == null || secretHex == null || expires <= now) {
+      return false;
+    }
+
+    final ticket = _hexToBytes(ticketHex);
+    final timestamp = Uint8List(4)..buffer.asByteData().setUint32(0, now);
+    final proof = Hmac(sha256, _hexToBytes(secretHex))
+        .convert([...ascii.encode('resume'), ...timestamp, ...ticket]);
+
+    final response = await http.post(
+      Uri.parse("http://192.168.4.1/resume"),
+      headers: {'Content-Type': WireCodec.contentType},
+      body: WireCodec.encodeResume(
+        ticket,
+        now,
+        Uint8List.fromList(proof.bytes),
+      ),
+    );
+    if (response.statusCode == 200) {
+      return true;
+    }
+    print("resume refused: ${response.statusCode}");
+    await prefs.remove('ticket');
+    return false;
+  }
+
+  /// Pref set once the sensor with this cert id has verified and cached our
+  /// cert; each sensor keeps its own cache
+  static String _certCachedKey(Uint8List sensorId) =>
+      'cert_cached_${_bytesToHex(sensorId)}';
+
+  /// A new cert is unknown to every sensor
+  Future<void> _forgetCachedCert(SharedPreferences prefs) async {
+    for (final key in prefs.getKeys().toList()) {
+      if (key == 'cert_cached' || key.startsWith('cert_cached_')) {
+        await prefs.remove(key);
+      }
+    }
+  }
+
+  /// SHA-256 over cert_bytes || signature, the key of the sensor's cert cache
+  static Uint8List _certRef(Uint8List certBytes, String signature) {
+    final digest = sha256.convert([...certBytes, ..._hexToBytes(signature)]);
+    return Uint8List.fromList(digest.bytes);
+  }
+
   Future<String?> readFile(String filename) async {
     try {
       final dir = await getApplicationDocumentsDirectory();
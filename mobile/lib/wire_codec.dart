@@ -0,0 +1,279 @@
+import 'dart:convert';
+import 'dart:typed_data';
+
+/// Binary encoding of /handshake, /authenticate, /resume, /challenge and
+/// /checkin, version 1, matching esp32_sensor/include/wire-codec.h.
+/// Fixed-width fields, DER signatures prefixed with their length, big endian
+/// integers, sent as application/octet-stream. Points are SEC1 in either
+/// format, the prefix byte tells the length.
+class WireCodec {
+  static const int version = 1;
+  static const String contentType = 'application/octet-stream';
+  static const int handshake = 0x01;
+  static const int handshakeRef = 0x02;
+  static const int authenticate = 0x03;
+  static const int resume = 0x04;
+  static const int checkin = 0x05;
+  static const int checkinRef = 0x06;
+  static const int handshakeReply = 0x81;
+  static const int authenticateReply = 0x83;
+  static const int challengeReply = 0x85;
+  static const int maxSignature = 72;
+  static const int ticketLength = 71;
+
+  static Uint8List encodeHandshake(
+    Uint8List certBytes,
+    Uint8List signature,
+    Uint8List cNonce,
+    Uint8List session,
+  ) {
+    final builder = BytesBuilder();
+    builder.add([version, handshake]);
+    builder.add(certBytes);
+    _addSignature(builder, signature);
+    builder.add(cNonce);
+    builder.add(session);
+    return builder.toBytes();
+  }
+
+  static Uint8List encodeHandshakeRef(
+    Uint8List certRef,
+    Uint8List cNonce,
+    Uint8List session,
+  ) {
+    final builder = BytesBuilder();
+    builder.add([version, handshakeRef]);
+    builder.add(certRef);
+    builder.add(cNonce);
+    builder.add(session);
+    return builder.toBytes();
+  }
+
+  static Uint8List encodeAuthenticate(
+    String id,
+    Uint8List session,
+    Uint8List signature,
+  ) {
+    final builder = BytesBuilder();
+    builder.add([version, authenticate]);
+    builder.add(ascii.encode(id));
+    builder.add(session);
+    _addSignature(builder, signature);
+    return builder.toBytes();
+  }
+
+  /// The cert as in a handshake, then the challenge answered and the
+  /// session signed over it
+  static Uint8List encodeCheckin(
+    Uint8List certBytes,
+    Uint8List signature,
+    Uint8List challenge,
+    Uint8List session,
+    Uint8List sessionSignature,
+  ) {
+    final builder = BytesBuilder();
+    builder.add([version, checkin]);
+    builder.add(certBytes);
+    _addSignature(builder, signature);
+    builder.add(challenge);
+    builder.add(session);
+    _addSignature(builder, sessionSignature);
+    return builder.toBytes();
+  }
+
+  static Uint8List encodeCheckinRef(
+    Uint8List certRef,
+    Uint8List challenge,
+    Uint8List session,
+    Uint8List sessionSignature,
+  ) {
+    final builder = BytesBuilder();
+    builder.add([version, checkinRef]);
+    builder.add(certRef);
+    builder.add(challenge);
+    builder.add(session);
+    _addSignature(builder, sessionSignature);
+    return builder.toBytes();
+  }
+
+  static Uint8List encodeResume(
+    Uint8List ticket,
+    int timestamp,
+    Uint8List proof,
+  ) {
+    final builder = BytesBuilder();
+    builder.add([version, resume]);
+    builder.add(ticket);
+    builder.add(_uint32(timestamp));
+    builder.add(proof);
+    return builder.toBytes();
+  }
+
+  /// Returns null if body is not a complete version 1 authenticate reply
+  static AuthenticateReply? decodeAuthenticateReply(Uint8List body) {
+    if (body.length < 2 || body[0] != version || body[1] != authenticateReply) {
+      return null;
+    }
+    final reader = _WireReader(body, 2);
+    final expires = ByteData.sublistView(reader.take(4)).getUint32(0);
+    final length = reader.take(1)[0];
+    if (length != 0 && length != ticketLength) {
+      return null;
+    }
+    final ticket = reader.take(length);
+    if (!reader.ok || reader.pos != body.length) {
+      return null;
+    }
+    return AuthenticateReply(
+      expires: expires,
+      ticket: length == 0 ? null : ticket,
+    );
+  }
+
+  /// Returns null if body is not a complete version 1 challenge reply
+  static ChallengeReply? decodeChallengeReply(Uint8List body) {
+    if (body.length < 2 || body[0] != version || body[1] != challengeReply) {
+      return null;
+    }
+    final reader = _WireReader(body, 2);
+    final reply = ChallengeReply(
+      id: reader.take(6),
+      pub: reader.point(),
+      validUntil: reader.take(19),
+      challenge: reader.take(12),
+      session: reader.point(),
+      expiresIn: ByteData.sublistView(reader.take(2)).getUint16(0),
+      challengeSignature: reader.signature(),
+      certSignature: reader.signature(),
+    );
+    if (!reader.ok || reader.pos != body.length) {
+      return null;
+    }
+    return reply;
+  }
+
+  /// Returns null if body is not a complete version 1 handshake reply
+  static HandshakeReply? decodeHandshakeReply(Uint8List body) {
+    if (body.length < 2 || body[0] != version || body[1] != handshakeReply) {
+      return null;
+    }
+    final reader = _WireReader(body, 2);
+    final reply = HandshakeReply(
+      id: reader.take(6),
+      pub: reader.point(),
+      validUntil: reader.take(19),
+      sNonce: reader.take(12),
+      session: reader.point(),
+      sessionSignature: reader.signature(),
+      certSignature: reader.signature(),
+    );
+    if (!reader.ok || reader.pos != body.length) {
+      return null;
+    }
+    return reply;
+  }
+
+  static Uint8List _uint32(int value) {
+    return Uint8List(4)..buffer.asByteData().setUint32(0, value);
+  }
+
+  static void _addSignature(BytesBuilder builder, Uint8List signature) {
+    if (signature.length > maxSignature) {
+      throw ArgumentError('signature too long');
+    }
+    builder.addByte(signature.length);
+    builder.add(signature);
+  }
+}
+
+class HandshakeReply {
+  final Uint8List id;
+  final Uint8List pub;
+  final Uint8List validUntil;
+  final Uint8List sNonce;
+  final Uint8List session;
+  final Uint8List sessionSignature;
+  final Uint8List certSignature;
+
+  HandshakeReply({
+    required this.id,
+    required this.pub,
+    required this.validUntil,
+    required this.sNonce,
+    required this.session,
+    required this.sessionSignature,
+    required this.certSignature,
+  });
+}
+
+class ChallengeReply {
+  final Uint8List id;
+  final Uint8List pub;
+  final Uint8List validUntil;
+  final Uint8List challenge;
+  final Uint8List session;
+  final int expiresIn; // seconds the sensor still accepts it
+  final Uint8List challengeSignature;
+  final Uint8List certSignature;
+
+  ChallengeReply({
+    required this.id,
+    required this.pub,
+    required this.validUntil,
+    required this.challenge,
+    required this.session,
+    required this.expiresIn,
+    required this.challengeSignature,
+    required this.certSignature,
+  });
+}
+
+class AuthenticateReply {
+  final int expires;
+  final Uint8List? ticket; // null if the sensor issued none
+
+  AuthenticateReply({required this.expires, this.ticket});
+}
+
+class _WireReader {
+  final Uint8List body;
+  int pos;
+  bool ok = true;
+
+  _WireReader(this.body, this.pos);
+
+  Uint8List take(int length) {
+    if (!ok || pos + length > body.length) {
+      ok = false;
+      return Uint8List(length);
+    }
+    final field = Uint8List.sublistView(body, pos, pos + length);
+    pos += length;
+    return field;
+  }
+
+  /// SEC1 point, its prefix byte tells the length
+  Uint8List point() {
+    if (!ok || pos >= body.length) {
+      ok = false;
+      return Uint8List(0);
+    }
+    final prefix = body[pos];
+    if (prefix == 0x04) {
+      return take(65);
+    }
+    if (prefix == 0x02 || prefix == 0x03) {
+      return take(33);
+    }
+    ok = false;
+    return Uint8List(0);
+  }
+
+  Uint8List signature() {
+    final length = take(1)[0];
+    if (length > WireCodec.maxSignature) {
+      ok = false;
+    }
+    return take(length);
+  }
+}
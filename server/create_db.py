@@ -9,6 +9,8 @@ cursor.execute("DROP TABLE IF EXISTS CheckinHistory")
 cursor.execute("DROP TABLE IF EXISTS Employees")
 cursor.execute("DROP TABLE IF EXISTS Sessions")
 cursor.execute("DROP TABLE IF EXISTS cert")
+cursor.execute("DROP TABLE IF EXISTS Revocations")
+cursor.execute("DROP TABLE IF EXISTS DirectoryLog")
 
 cursor.execute("""
 CREATE TABLE IF NOT EXISTS Employees (
@@ -29,6 +31,25 @@ create table if not exists cert (
 );
  """)
 
+# Append only, RevocationID doubles as the version sensors sync against
+cursor.execute("""
+CREATE TABLE IF NOT EXISTS Revocations (
+    RevocationID INTEGER PRIMARY KEY AUTOINCREMENT,
+    id varchar(6) UNIQUE NOT NULL,
+    RevokedAt DATETIME DEFAULT CURRENT_TIMESTAMP
+);
+""")
+
+# Every cert that became usable (EmployeeID set) or stopped being (NULL),
+# in order; sensors fetch the entries past the LogID they have
+cursor.execute("""
+CREATE TABLE IF NOT EXISTS DirectoryLog (
+    LogID INTEGER PRIMARY KEY AUTOINCREMENT,
+    id varchar(6) NOT NULL,
+    EmployeeID INTEGER
+);
+""")
+
 cursor.execute("""
 CREATE TABLE IF NOT EXISTS CheckinHistory (
     CheckinID INTEGER PRIMARY KEY AUTOINCREMENT,
@@ -10,10 +10,11 @@ def gen_key():
     public_key = private_key.public_key()
     return private_key, public_key
 
-def get_public_bytes(public_key) -> bytes:
+def get_public_bytes(public_key, compressed: bool = False) -> bytes:
     public_bytes = public_key.public_bytes(
         encoding=serialization.Encoding.X962,
-        format=serialization.PublicFormat.UncompressedPoint
+        format=serialization.PublicFormat.CompressedPoint if compressed
+        else serialization.PublicFormat.UncompressedPoint
     )
     return public_bytes
 
@@ -29,6 +30,15 @@ def get_shared_key(shared_secret: bytes) -> bytes:
         info=b'handshake data',
     ).derive(shared_secret)
 
+def get_resumption_secret(shared_secret: bytes) -> bytes:
+    """Secret sealed in a sensor's resume ticket, see esp32_sensor/include/resume-ticket.h"""
+    return HKDF(
+        algorithm=hashes.SHA256(),
+        length=32,
+        salt=None,
+        info=b'resumption',
+    ).derive(shared_secret)
+
 def encrypt(key: bytes, plaintext: bytes) -> tuple[bytes, bytes, bytes]:
     """Ciphertext has the same length of plaintext
     nonce is 12 bytes
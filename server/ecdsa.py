@@ -1,3 +1,5 @@
+import hashlib
+import hmac
 from cryptography.hazmat.primitives.asymmetric import ec
 from cryptography.hazmat.backends import default_backend
 from cryptography.hazmat.primitives import hashes, serialization
@@ -26,16 +28,22 @@ def export_private_key(private_key) -> bytes:
         encryption_algorithm=serialization.NoEncryption()
     )
 
-def get_public_bytes(public_key) -> bytes:
+def get_public_bytes(public_key, compressed: bool = False) -> bytes:
+    """SEC1 point, 65 bytes or 33 when compressed"""
     public_bytes = public_key.public_bytes(
         encoding=serialization.Encoding.X962,
-        format=serialization.PublicFormat.UncompressedPoint
+        format=serialization.PublicFormat.CompressedPoint if compressed
+        else serialization.PublicFormat.UncompressedPoint
     )
     return public_bytes
 
+def point_len(prefix: int) -> int:
+    """Length of the SEC1 point starting with prefix, 0 if it is none"""
+    return {0x04: 65, 0x02: 33, 0x03: 33}.get(prefix, 0)
+
 def cert_bytes(id: str, public_bytes: bytes, valid_until: str) -> bytes:
     """id string 6 chars
-    public_bytes: 65 bytes
+    public_bytes: 65 bytes, or 33 compressed
     valid_until: datetime string "%Y-%m-%d %H:%M:%S"
     """
     return id.encode("ascii") + public_bytes + valid_until.encode("ascii")
@@ -43,6 +51,10 @@ def cert_bytes(id: str, public_bytes: bytes, valid_until: str) -> bytes:
 def session_bytes(nonce: bytes, c_pub_bytes: bytes, s_pub_bytes: bytes) -> bytes:
     return nonce + c_pub_bytes + s_pub_bytes
 
+def challenge_bytes(nonce: bytes, s_pub_bytes: bytes) -> bytes:
+    """What a sensor signs for GET /challenge"""
+    return nonce + s_pub_bytes
+
 def sign(private_key, message: bytes) -> bytes:
     return private_key.sign(
         message,
@@ -62,6 +74,200 @@ def verify(message: bytes, public_bytes: bytes, signature: bytes) -> bool:
         return False
 
 
+# Binary encoding of /handshake, /authenticate, /resume, /challenge and
+# /checkin, version 1, matching
+# esp32_sensor/include/wire-codec.h. Fixed-width fields, DER signatures
+# prefixed with their length, big endian integers, sent as
+# application/octet-stream. Points are SEC1 in either format, the prefix byte
+# tells the length.
+WIRE_VERSION = 1
+WIRE_CONTENT_TYPE = "application/octet-stream"
+WIRE_HANDSHAKE = 0x01
+WIRE_HANDSHAKE_REF = 0x02
+WIRE_AUTHENTICATE = 0x03
+WIRE_RESUME = 0x04
+WIRE_CHECKIN = 0x05
+WIRE_CHECKIN_REF = 0x06
+WIRE_HANDSHAKE_REPLY = 0x81
+WIRE_AUTHENTICATE_REPLY = 0x83
+WIRE_CHALLENGE_REPLY = 0x85
+WIRE_MAX_SIGNATURE = 72
+WIRE_TICKET_LEN = 71
+
+def _wire_signature(signature: bytes) -> bytes:
+    if len(signature) > WIRE_MAX_SIGNATURE:
+        raise ValueError("signature too long")
+    return bytes([len(signature)]) + signature
+
+class _WireReader:
+    def __init__(self, body: bytes, wire_type: int):
+        if len(body) < 2 or body[0] != WIRE_VERSION or body[1] != wire_type:
+            raise ValueError("not a version 1 message of this type")
+        self.body = body
+        self.pos = 2
+
+    def take(self, length: int) -> bytes:
+        if self.pos + length > len(self.body):
+            raise ValueError("message too short")
+        field = self.body[self.pos:self.pos + length]
+        self.pos += length
+        return field
+
+    def point(self) -> bytes:
+        length = point_len(self.take(1)[0])
+        if length == 0:
+            raise ValueError("not a point")
+        self.pos -= 1
+        return self.take(length)
+
+    def signature(self) -> bytes:
+        length = self.take(1)[0]
+        if length > WIRE_MAX_SIGNATURE:
+            raise ValueError("signature too long")
+        return self.take(length)
+
+    def done(self):
+        if self.pos != len(self.body):
+            raise ValueError("trailing bytes")
+
+def encode_handshake(id: str, public_bytes: bytes, valid_until: str, signature: bytes,
+                     c_nonce: bytes, session: bytes) -> bytes:
+    return (bytes([WIRE_VERSION, WIRE_HANDSHAKE]) + cert_bytes(id, public_bytes, valid_until)
+            + _wire_signature(signature) + c_nonce + session)
+
+def encode_handshake_ref(cert_ref: bytes, c_nonce: bytes, session: bytes) -> bytes:
+    return bytes([WIRE_VERSION, WIRE_HANDSHAKE_REF]) + cert_ref + c_nonce + session
+
+def decode_handshake(body: bytes) -> dict:
+    kind = body[1] if len(body) > 1 else None
+    reader = _WireReader(body, WIRE_HANDSHAKE_REF if kind == WIRE_HANDSHAKE_REF else WIRE_HANDSHAKE)
+    message = {}
+    if kind == WIRE_HANDSHAKE_REF:
+        message["cert_ref"] = reader.take(32)
+    else:
+        message["id"] = reader.take(6).decode("ascii")
+        message["pub"] = reader.point()
+        message["valid_until"] = reader.take(19).decode("ascii")
+        message["signature"] = reader.signature()
+    message["c_nonce"] = reader.take(12)
+    message["session"] = reader.point()
+    reader.done()
+    return message
+
+def encode_checkin(id: str, public_bytes: bytes, valid_until: str, signature: bytes,
+                   challenge: bytes, session: bytes, session_signature: bytes) -> bytes:
+    return (bytes([WIRE_VERSION, WIRE_CHECKIN]) + cert_bytes(id, public_bytes, valid_until)
+            + _wire_signature(signature) + challenge + session + _wire_signature(session_signature))
+
+def encode_checkin_ref(cert_ref: bytes, challenge: bytes, session: bytes, session_signature: bytes) -> bytes:
+    return (bytes([WIRE_VERSION, WIRE_CHECKIN_REF]) + cert_ref + challenge + session
+            + _wire_signature(session_signature))
+
+def decode_checkin(body: bytes) -> dict:
+    kind = body[1] if len(body) > 1 else None
+    reader = _WireReader(body, WIRE_CHECKIN_REF if kind == WIRE_CHECKIN_REF else WIRE_CHECKIN)
+    message = {}
+    if kind == WIRE_CHECKIN_REF:
+        message["cert_ref"] = reader.take(32)
+    else:
+        message["id"] = reader.take(6).decode("ascii")
+        message["pub"] = reader.point()
+        message["valid_until"] = reader.take(19).decode("ascii")
+        message["signature"] = reader.signature()
+    message["challenge"] = reader.take(12)
+    message["session"] = reader.point()
+    message["session_signature"] = reader.signature()
+    reader.done()
+    return message
+
+def encode_authenticate(id: str, session: bytes, signature: bytes) -> bytes:
+    return bytes([WIRE_VERSION, WIRE_AUTHENTICATE]) + id.encode("ascii") + session + _wire_signature(signature)
+
+def decode_authenticate(body: bytes) -> dict:
+    reader = _WireReader(body, WIRE_AUTHENTICATE)
+    message = {
+        "id": reader.take(6).decode("ascii"),
+        "session": reader.point(),
+        "signature": reader.signature(),
+    }
+    reader.done()
+    return message
+
+def encode_handshake_reply(cert: bytes, s_nonce: bytes, session: bytes,
+                           session_signature: bytes, cert_signature: bytes) -> bytes:
+    """cert: the sensor's cert_bytes, 90 bytes or 58 with a compressed key"""
+    return (bytes([WIRE_VERSION, WIRE_HANDSHAKE_REPLY]) + cert + s_nonce + session
+            + _wire_signature(session_signature) + _wire_signature(cert_signature))
+
+def decode_handshake_reply(body: bytes) -> dict:
+    reader = _WireReader(body, WIRE_HANDSHAKE_REPLY)
+    message = {
+        "id": reader.take(6).decode("ascii"),
+        "pub": reader.point(),
+        "valid_until": reader.take(19).decode("ascii"),
+        "s_nonce": reader.take(12),
+        "session": reader.point(),
+        "session_signature": reader.signature(),
+        "cert_signature": reader.signature(),
+    }
+    reader.done()
+    return message
+
+def encode_challenge_reply(cert: bytes, challenge: bytes, session: bytes, expires_in: int,
+                           challenge_signature: bytes, cert_signature: bytes) -> bytes:
+    """cert: the sensor's cert_bytes, 90 bytes or 58 with a compressed key"""
+    return (bytes([WIRE_VERSION, WIRE_CHALLENGE_REPLY]) + cert + challenge + session
+            + expires_in.to_bytes(2, "big")
+            + _wire_signature(challenge_signature) + _wire_signature(cert_signature))
+
+def decode_challenge_reply(body: bytes) -> dict:
+    reader = _WireReader(body, WIRE_CHALLENGE_REPLY)
+    message = {
+        "id": reader.take(6).decode("ascii"),
+        "pub": reader.point(),
+        "valid_until": reader.take(19).decode("ascii"),
+        "challenge": reader.take(12),
+        "session": reader.point(),
+        "expires_in": int.from_bytes(reader.take(2), "big"),
+        "challenge_signature": reader.signature(),
+        "cert_signature": reader.signature(),
+    }
+    reader.done()
+    return message
+
+def encode_authenticate_reply(expires: int, ticket: bytes = None) -> bytes:
+    ticket = ticket or b""
+    return bytes([WIRE_VERSION, WIRE_AUTHENTICATE_REPLY]) + expires.to_bytes(4, "big") + bytes([len(ticket)]) + ticket
+
+def decode_authenticate_reply(body: bytes) -> dict:
+    """ticket is None when the sensor issued none"""
+    reader = _WireReader(body, WIRE_AUTHENTICATE_REPLY)
+    expires = int.from_bytes(reader.take(4), "big")
+    length = reader.take(1)[0]
+    if length not in (0, WIRE_TICKET_LEN):
+        raise ValueError("bad ticket length")
+    ticket = reader.take(length)
+    reader.done()
+    return {"expires": expires, "ticket": ticket or None}
+
+def resume_proof(secret: bytes, timestamp: int, ticket: bytes) -> bytes:
+    """HMAC-SHA256(secret, "resume" || timestamp || ticket), what /resume checks"""
+    return hmac.new(secret, b"resume" + timestamp.to_bytes(4, "big") + ticket, hashlib.sha256).digest()
+
+def encode_resume(ticket: bytes, timestamp: int, proof: bytes) -> bytes:
+    return bytes([WIRE_VERSION, WIRE_RESUME]) + ticket + timestamp.to_bytes(4, "big") + proof
+
+def decode_resume(body: bytes) -> dict:
+    reader = _WireReader(body, WIRE_RESUME)
+    message = {
+        "ticket": reader.take(WIRE_TICKET_LEN),
+        "timestamp": int.from_bytes(reader.take(4), "big"),
+        "proof": reader.take(32),
+    }
+    reader.done()
+    return message
+
+
 if __name__ == "__main__":
     private_key, public_key = gen_signature_key()
     private_key_pem = export_private_key(private_key)
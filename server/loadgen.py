@@ -0,0 +1,485 @@
+"""Load generator for one sensor: simulated phones running the same
+/handshake -> /authenticate exchange as mobile/lib/main.dart.
+
+Each phone gets its own signing key and a cert signed with ca.pem, exactly
+as /sign_cert issues them, so the sensor does the full verification work.
+A phone whose cert the sensor already accepted sends only the cert_ref
+digest, like the app does, and falls back to the full cert on 409. A phone
+holding a resume ticket from an earlier visit tries /resume first and runs
+the full exchange only if the sensor refuses it. With --one-round phones
+sign a challenge fetched from GET /challenge ahead of time and check in
+with a single POST /checkin instead.
+
+    python loadgen.py --sensor http://192.168.4.1 --phones 40 --rate 2 --duration 60
+    python loadgen.py --pattern burst --burst 120 --burst-window 30 --concurrency 6
+
+The generated cert ids are not in the central server's database, so the
+check-ins the sensor forwards are rejected there; that happens after the
+phone got its answer and does not show up here.
+
+End-to-end latency counts from the moment a phone arrives at the door, so
+time spent waiting for a free connection to the sensor is included; that
+wait is the door queue.
+
+Every simulated phone shares this machine's IP, which the sensor rate
+limits like one phone: flash it with -D CLIENT_BURST=1000
+-D CLIENT_RATE_PER_S=1000 for a capacity run, or the run measures the
+limiter (failures handshake:429). Requests shed by the sensor's global
+limit show up as handshake:503 or checkin:503.
+"""
+import argparse
+import hashlib
+import http.client
+import json
+import os
+import queue
+import random
+import socket
+import threading
+import time
+from collections import Counter
+from datetime import datetime, timezone, timedelta
+from urllib.parse import urlparse
+
+import ecdsa
+import ecdh_aes
+
+CERT_VALIDITY = timedelta(days=365)
+
+
+class Phone:
+    def __init__(self, id: str, ca_private_key, compressed: bool = False):
+        self.id = id
+        self.compressed = compressed  # cert and session keys as 33 byte points
+        self.private_key, public_key = ecdsa.gen_signature_key()
+        self.public_bytes = ecdsa.get_public_bytes(public_key, compressed)
+        valid_until = (datetime.now(timezone.utc) + CERT_VALIDITY).strftime("%Y-%m-%d %H:%M:%S")
+        self.valid_until = valid_until
+        self.cert = ecdsa.cert_bytes(id, self.public_bytes, valid_until)
+        self.signature = ecdsa.sign(ca_private_key, self.cert)
+        # Same key as the sensor's cert cache, sha256(cert_bytes || signature)
+        self.cert_ref = hashlib.sha256(self.cert + self.signature).digest()
+        self.cert_cached = False
+        self.ticket = None  # (ticket, expires, resumption secret) from /authenticate
+
+
+class Failure(Exception):
+    """A check-in that did not end in 200 from /authenticate, kind is
+    stage:reason and is what the failure breakdown is keyed by"""
+    def __init__(self, kind: str):
+        super().__init__(kind)
+        self.kind = kind
+
+
+def post(conn, path: str, body: bytes, content_type: str, stage: str):
+    return send(conn, "POST", path, body, {"Content-Type": content_type}, stage)
+
+
+def send(conn, method: str, path: str, body, headers: dict, stage: str):
+    try:
+        conn.request(method, path, body=body, headers=headers)
+        response = conn.getresponse()
+        return response.status, response.read()
+    except socket.timeout:
+        raise Failure(f"{stage}:timeout")
+    except ConnectionRefusedError:
+        raise Failure(f"{stage}:refused")
+    except (ConnectionError, http.client.HTTPException, OSError):
+        raise Failure(f"{stage}:connection")
+
+
+def handshake_body(phone: Phone, c_nonce: bytes, session: bytes, wire: str, full: bool) -> bytes:
+    if wire == "binary":
+        if full:
+            return ecdsa.encode_handshake(phone.id, phone.public_bytes, phone.valid_until,
+                                          phone.signature, c_nonce, session)
+        return ecdsa.encode_handshake_ref(phone.cert_ref, c_nonce, session)
+
+    message = {"c_nonce": c_nonce.hex().upper(), "session": session.hex().upper()}
+    if full:
+        message.update({
+            "id": phone.id,
+            "valid_until": phone.valid_until,
+            "pub": phone.public_bytes.hex().upper(),
+            "signature": phone.signature.hex().upper(),
+        })
+    else:
+        message["cert_ref"] = phone.cert_ref.hex().upper()
+    return json.dumps(message).encode()
+
+
+def decode_handshake_reply(body: bytes, wire: str) -> dict:
+    if wire == "binary":
+        return ecdsa.decode_handshake_reply(body)
+    reply = json.loads(body)
+    return {
+        "id": reply["id"],
+        "pub": bytes.fromhex(reply["pub"]),
+        "valid_until": reply["valid_until"],
+        "s_nonce": bytes.fromhex(reply["s_nonce"]),
+        "session": bytes.fromhex(reply["session"]),
+        "session_signature": bytes.fromhex(reply["session_signature"]),
+        "cert_signature": bytes.fromhex(reply["cert_signature"]),
+    }
+
+
+class ChallengeCache:
+    """The sensor's published challenge, shared by every phone the way phones
+    pick it up on their way to the door; refetched once it runs out"""
+    # Keep clear of the end of the window, the request still has to get there
+    MARGIN_S = 2.0
+
+    def __init__(self, ca_public_bytes: bytes, wire: str):
+        self.ca_public_bytes = ca_public_bytes
+        self.wire = wire
+        self.lock = threading.Lock()
+        self.challenge = None
+        self.usable_until = 0.0
+        self.fetches = 0
+
+    def get(self, conn) -> dict:
+        with self.lock:
+            if self.challenge is None or time.monotonic() >= self.usable_until:
+                self.challenge = self.fetch(conn)
+                self.usable_until = time.monotonic() + self.challenge["expires_in"] - self.MARGIN_S
+            return self.challenge
+
+    def drop(self, challenge: dict):
+        with self.lock:
+            if self.challenge is challenge:
+                self.challenge = None
+
+    def fetch(self, conn) -> dict:
+        accept = ecdsa.WIRE_CONTENT_TYPE if self.wire == "binary" else "application/json"
+        status, body = send(conn, "GET", "/challenge", None, {"Accept": accept}, "challenge")
+        if status != 200:
+            raise Failure(f"challenge:{status}")
+        try:
+            if self.wire == "binary":
+                challenge = ecdsa.decode_challenge_reply(body)
+            else:
+                reply = json.loads(body)
+                challenge = {
+                    "id": reply["id"],
+                    "pub": bytes.fromhex(reply["pub"]),
+                    "valid_until": reply["valid_until"],
+                    "challenge": bytes.fromhex(reply["s_nonce"]),
+                    "session": bytes.fromhex(reply["session"]),
+                    "expires_in": reply["expires_in"],
+                    "challenge_signature": bytes.fromhex(reply["challenge_signature"]),
+                    "cert_signature": bytes.fromhex(reply["cert_signature"]),
+                }
+        except (ValueError, KeyError):
+            raise Failure("challenge:malformed")
+
+        sensor_cert = ecdsa.cert_bytes(challenge["id"], challenge["pub"], challenge["valid_until"])
+        if not ecdsa.verify(sensor_cert, self.ca_public_bytes, challenge["cert_signature"]):
+            raise Failure("verify:sensor_cert")
+        if not ecdsa.verify(ecdsa.challenge_bytes(challenge["challenge"], challenge["session"]),
+                            challenge["pub"], challenge["challenge_signature"]):
+            raise Failure("verify:challenge")
+        self.fetches += 1
+        return challenge
+
+
+def checkin_body(phone: Phone, challenge: dict, session: bytes, signature: bytes, wire: str, full: bool) -> bytes:
+    if wire == "binary":
+        if full:
+            return ecdsa.encode_checkin(phone.id, phone.public_bytes, phone.valid_until, phone.signature,
+                                        challenge["challenge"], session, signature)
+        return ecdsa.encode_checkin_ref(phone.cert_ref, challenge["challenge"], session, signature)
+
+    message = json.loads(handshake_body(phone, challenge["challenge"], session, "json", full))
+    message["s_nonce"] = message.pop("c_nonce")
+    message["session_signature"] = signature.hex().upper()
+    return json.dumps(message).encode()
+
+
+def decode_authenticate_reply(body: bytes, wire: str):
+    """(ticket, expires) or None if the sensor issued no ticket"""
+    if wire == "binary":
+        reply = ecdsa.decode_authenticate_reply(body)
+    else:
+        reply = json.loads(body)
+        if "ticket" in reply:
+            reply = {"ticket": bytes.fromhex(reply["ticket"]), "expires": reply["ticket_expires"]}
+    if reply.get("ticket") is None:
+        return None
+    return reply["ticket"], reply["expires"]
+
+
+def resume(conn, phone: Phone, wire: str) -> bool:
+    """Try the ticket from the last visit, False if the sensor wants the full exchange"""
+    ticket, expires, secret = phone.ticket
+    timestamp = int(time.time())
+    if expires <= timestamp:
+        phone.ticket = None
+        return False
+
+    proof = ecdsa.resume_proof(secret, timestamp, ticket)
+    if wire == "binary":
+        body = ecdsa.encode_resume(ticket, timestamp, proof)
+        content_type = ecdsa.WIRE_CONTENT_TYPE
+    else:
+        body = json.dumps({"ticket": ticket.hex().upper(), "timestamp": timestamp,
+                           "proof": proof.hex().upper()}).encode()
+        content_type = "application/json"
+    status, _ = post(conn, "/resume", body, content_type, "resume")
+    if status == 200:
+        return True
+    if status != 401:
+        raise Failure(f"resume:{status}")
+    phone.ticket = None
+    return False
+
+
+def keep_ticket(phone: Phone, body: bytes, wire: str, ecdh_private_key, sensor_session: bytes):
+    """Remember the ticket in a 200 from /authenticate or /checkin"""
+    try:
+        issued = decode_authenticate_reply(body, wire)
+    except (ValueError, KeyError):
+        raise Failure("authenticate:malformed")
+    if issued is not None:
+        shared_secret = ecdh_aes.get_shared_secret(ecdh_private_key, sensor_session)
+        phone.ticket = (issued[0], issued[1], ecdh_aes.get_resumption_secret(shared_secret))
+
+
+def one_round(conn, phone: Phone, challenges: ChallengeCache, args):
+    """Check in with one POST /checkin over the cached challenge"""
+    content_type = ecdsa.WIRE_CONTENT_TYPE if args.wire == "binary" else "application/json"
+    # A second try covers a challenge that rotated out under us
+    for _ in range(2):
+        challenge = challenges.get(conn)
+        ecdh_private_key, ecdh_public_key = ecdh_aes.gen_key()
+        session = ecdh_aes.get_public_bytes(ecdh_public_key, phone.compressed)
+        signature = ecdsa.sign(phone.private_key,
+                               ecdsa.session_bytes(challenge["challenge"], session, challenge["session"]))
+
+        full = args.no_cert_ref or not phone.cert_cached
+        status, body = post(conn, "/checkin", checkin_body(phone, challenge, session, signature, args.wire, full),
+                            content_type, "checkin")
+        if status == 409 and not full and b"cert_ref" in body:
+            status, body = post(conn, "/checkin", checkin_body(phone, challenge, session, signature, args.wire, True),
+                                content_type, "checkin")
+        if status == 409:
+            challenges.drop(challenge)
+            continue
+        if status != 200:
+            raise Failure(f"checkin:{status}")
+
+        phone.cert_cached = True
+        keep_ticket(phone, body, args.wire, ecdh_private_key, challenge["session"])
+        return
+    raise Failure("checkin:challenge")
+
+
+def check_in(phone: Phone, sensor, ca_public_bytes: bytes, args, challenges: ChallengeCache = None) -> bool:
+    """One visit to the door, raises Failure unless the sensor let us in;
+    return True if a resume ticket was enough"""
+    wire = args.wire
+    content_type = ecdsa.WIRE_CONTENT_TYPE if wire == "binary" else "application/json"
+
+    # A fresh connection per visit, kept alive for both requests like the app
+    conn = http.client.HTTPConnection(sensor.hostname, sensor.port or 80, timeout=args.timeout)
+    try:
+        if phone.ticket is not None and not args.no_resume and resume(conn, phone, wire):
+            return True
+        if challenges is not None:
+            one_round(conn, phone, challenges, args)
+            return False
+
+        c_nonce = os.urandom(12)
+        ecdh_private_key, ecdh_public_key = ecdh_aes.gen_key()
+        session = ecdh_aes.get_public_bytes(ecdh_public_key, phone.compressed)
+
+        full = args.no_cert_ref or not phone.cert_cached
+        status, body = post(conn, "/handshake", handshake_body(phone, c_nonce, session, wire, full),
+                            content_type, "handshake")
+        if status == 409 and not full:
+            status, body = post(conn, "/handshake", handshake_body(phone, c_nonce, session, wire, True),
+                                content_type, "handshake")
+        if status != 200:
+            raise Failure(f"handshake:{status}")
+        phone.cert_cached = True
+
+        try:
+            reply = decode_handshake_reply(body, wire)
+        except (ValueError, KeyError):
+            raise Failure("handshake:malformed")
+
+        sensor_cert = ecdsa.cert_bytes(reply["id"], reply["pub"], reply["valid_until"])
+        if not ecdsa.verify(sensor_cert, ca_public_bytes, reply["cert_signature"]):
+            raise Failure("verify:sensor_cert")
+        if not ecdsa.verify(ecdsa.session_bytes(c_nonce, session, reply["session"]),
+                            reply["pub"], reply["session_signature"]):
+            raise Failure("verify:session")
+
+        signature = ecdsa.sign(phone.private_key, ecdsa.session_bytes(reply["s_nonce"], session, reply["session"]))
+        if wire == "binary":
+            body = ecdsa.encode_authenticate(phone.id, session, signature)
+        else:
+            body = json.dumps({
+                "id": phone.id,
+                "session": session.hex().upper(),
+                "signature": signature.hex().upper(),
+            }).encode()
+        status, body = post(conn, "/authenticate", body, content_type, "authenticate")
+        if status != 200:
+            raise Failure(f"authenticate:{status}")
+
+        keep_ticket(phone, body, wire, ecdh_private_key, reply["session"])
+        return False
+    finally:
+        conn.close()
+
+
+def arrival_times(args) -> list:
+    """Seconds from the start at which a phone walks up to the door"""
+    arrivals = []
+    if args.pattern in ("steady", "burst") and args.rate > 0:
+        # Poisson background traffic
+        t = random.expovariate(args.rate)
+        while t < args.duration:
+            arrivals.append(t)
+            t += random.expovariate(args.rate)
+    if args.pattern == "ramp":
+        # Rate grows linearly from 0 to --rate over the run: N(t) = rate * t^2 / (2 * duration)
+        total = int(args.rate * args.duration / 2)
+        arrivals += [args.duration * ((i + random.random()) / total) ** 0.5 for i in range(total)]
+    if args.pattern == "burst":
+        # A shift change: everybody shows up within the window
+        start = args.burst_at
+        arrivals += [start + random.uniform(0, args.burst_window) for _ in range(args.burst)]
+    return sorted(arrivals)
+
+
+def percentile(sorted_values: list, fraction: float) -> float:
+    if not sorted_values:
+        return 0.0
+    rank = max(1, int(len(sorted_values) * fraction + 0.999999))
+    return sorted_values[min(rank, len(sorted_values)) - 1]
+
+
+def run(args):
+    with open(args.ca, "rb") as f:
+        ca_private_key, ca_public_key = ecdsa.load_private_key(f.read())
+    ca_public_bytes = ecdsa.get_public_bytes(ca_public_key)
+    sensor = urlparse(args.sensor)
+
+    phones = queue.Queue()
+    for i in range(args.phones):
+        phones.put(Phone(f"{args.id_prefix}{i:0{6 - len(args.id_prefix)}d}", ca_private_key, args.compressed))
+
+    arrivals = arrival_times(args)
+    doors = queue.Queue()
+    lock = threading.Lock()
+    latencies = []      # arrival to the 200 from /authenticate or /resume
+    service_times = []  # first byte sent to the 200, without the door queue
+    failures = Counter()
+    resumed = [0]
+    challenges = ChallengeCache(ca_public_bytes, args.wire) if args.one_round else None
+
+    def worker():
+        while True:
+            arrived = doors.get()
+            if arrived is None:
+                return
+            # A phone is only ever at the door once, the sensor keys sessions by cert id
+            phone = phones.get()
+            started = time.monotonic()
+            try:
+                was_resumed = check_in(phone, sensor, ca_public_bytes, args, challenges)
+                done = time.monotonic()
+                with lock:
+                    resumed[0] += was_resumed
+                    latencies.append(done - arrived)
+                    service_times.append(done - started)
+            except Failure as failure:
+                with lock:
+                    failures[failure.kind] += 1
+            finally:
+                phones.put(phone)
+
+    workers = [threading.Thread(target=worker, daemon=True) for _ in range(args.concurrency)]
+    for thread in workers:
+        thread.start()
+
+    start = time.monotonic()
+    for offset in arrivals:
+        delay = start + offset - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+        doors.put(start + offset)
+    for _ in workers:
+        doors.put(None)
+    for thread in workers:
+        thread.join()
+    elapsed = time.monotonic() - start
+
+    latencies.sort()
+    service_times.sort()
+    return {
+        "pattern": args.pattern,
+        "wire": args.wire,
+        "compressed": args.compressed,
+        "arrivals": len(arrivals),
+        "succeeded": len(latencies),
+        "resumed": resumed[0],
+        "challenge_fetches": challenges.fetches if challenges else 0,
+        "failed": sum(failures.values()),
+        "elapsed_s": round(elapsed, 3),
+        "checkins_per_min": round(len(latencies) * 60 / elapsed, 1) if elapsed > 0 else 0,
+        "latency_ms": {name: round(percentile(latencies, fraction) * 1000, 1)
+                       for name, fraction in (("p50", 0.5), ("p99", 0.99), ("p999", 0.999))},
+        "service_ms": {name: round(percentile(service_times, fraction) * 1000, 1)
+                       for name, fraction in (("p50", 0.5), ("p99", 0.99), ("p999", 0.999))},
+        "failures": dict(failures.most_common()),
+    }
+
+
+def print_report(report: dict):
+    print(f"{report['arrivals']} arrivals ({report['pattern']}, {report['wire']}"
+          f"{', compressed' if report['compressed'] else ''}) in {report['elapsed_s']} s")
+    print(f"  succeeded  {report['succeeded']}  ({report['checkins_per_min']} check-ins/min, "
+          f"{report['resumed']} resumed)")
+    print(f"  failed     {report['failed']}")
+    for kind, count in report["failures"].items():
+        print(f"    {kind:<24} {count}")
+    for label, key in (("end to end", "latency_ms"), ("at sensor", "service_ms")):
+        values = report[key]
+        print(f"  {label:<10} p50 {values['p50']} ms  p99 {values['p99']} ms  p999 {values['p999']} ms")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Simulated phones checking in at one sensor")
+    parser.add_argument("--sensor", default="http://192.168.4.1", help="sensor base URL")
+    parser.add_argument("--ca", default="ca.pem", help="CA private key the phone certs are signed with")
+    parser.add_argument("--phones", type=int, default=50, help="distinct phones (cert ids)")
+    parser.add_argument("--id-prefix", default="L", help="cert ids are this prefix padded with digits to 6 chars")
+    parser.add_argument("--concurrency", type=int, default=4, help="phones talking to the sensor at once")
+    parser.add_argument("--pattern", choices=("steady", "ramp", "burst"), default="steady")
+    parser.add_argument("--rate", type=float, default=1.0, help="arrivals per second (peak rate for ramp)")
+    parser.add_argument("--duration", type=float, default=60.0, help="seconds of arrivals")
+    parser.add_argument("--burst", type=int, default=100, help="phones in the shift-change burst")
+    parser.add_argument("--burst-at", type=float, default=0.0, help="seconds into the run the burst starts")
+    parser.add_argument("--burst-window", type=float, default=30.0, help="seconds the burst is spread over")
+    parser.add_argument("--wire", choices=("binary", "json"), default="binary", help="request encoding")
+    parser.add_argument("--compressed", action="store_true", help="phones use compressed points for their keys")
+    parser.add_argument("--no-cert-ref", action="store_true", help="always send the full cert")
+    parser.add_argument("--no-resume", action="store_true", help="ignore resume tickets, always run the full exchange")
+    parser.add_argument("--one-round", action="store_true",
+                        help="check in with GET /challenge ahead and a single POST /checkin")
+    parser.add_argument("--timeout", type=float, default=10.0, help="per request timeout in seconds")
+    parser.add_argument("--json", action="store_true", help="print the report as JSON")
+    args = parser.parse_args()
+
+    if len(args.id_prefix) >= 6 or args.phones > 10 ** (6 - len(args.id_prefix)):
+        parser.error("--phones does not fit in 6 char ids with this --id-prefix")
+    if args.phones < args.concurrency:
+        parser.error("--concurrency cannot exceed --phones")
+
+    report = run(args)
+    if args.json:
+        print(json.dumps(report, indent=2))
+    else:
+        print_report(report)
@@ -8,6 +8,9 @@ import ecdh_aes
 
 app = Flask(__name__)
 DB_PATH = 'attendance.db'
+CERT_VALIDITY = timedelta(days=365)
+# REVOCATION_MAX in esp32_sensor/include/revocation-list.h
+SENSOR_REVOCATION_MAX = 256
 
 # Load the ca private key for signing cert
 with open("ca.pem", "rb") as f:
@@ -19,6 +22,29 @@ def get_db_connection():
     conn.row_factory = sqlite3.Row
     return conn
 
+def init_sync_tables():
+    # Databases created before sensors synced revocations and the directory
+    # lack these tables
+    conn = get_db_connection()
+    conn.execute("""
+        CREATE TABLE IF NOT EXISTS Revocations (
+            RevocationID INTEGER PRIMARY KEY AUTOINCREMENT,
+            id varchar(6) UNIQUE NOT NULL,
+            RevokedAt DATETIME DEFAULT CURRENT_TIMESTAMP
+        )
+    """)
+    conn.execute("""
+        CREATE TABLE IF NOT EXISTS DirectoryLog (
+            LogID INTEGER PRIMARY KEY AUTOINCREMENT,
+            id varchar(6) NOT NULL,
+            EmployeeID INTEGER
+        )
+    """)
+    conn.commit()
+    conn.close()
+
+init_sync_tables()
+
 @app.route('/')
 def home():
     try:
@@ -34,13 +60,16 @@ def checkin():
     try:
         data = request.get_json()
         cert_id = data.get("cert_id")
+        # Sensors stamp the check-in when it happened, it may arrive late
+        timestamp = data.get("timestamp")
+        checkin_time = datetime.fromtimestamp(timestamp) if timestamp else datetime.now()
 
         session_id = data.get('session_id', 1)  # Default to session 1
         
         conn = get_db_connection()
         cursor = conn.cursor()
         # Look up employee by token
-        cursor.execute("SELECT Employees.EmployeeID, Name FROM cert INNER JOIN Employees ON cert.EmployeeID = Employees.EmployeeID where cert.id = ?", (cert_id,))
+        cursor.execute("SELECT Employees.EmployeeID, Name FROM cert INNER JOIN Employees ON cert.EmployeeID = Employees.EmployeeID where cert.id = ? AND cert.id NOT IN (SELECT id FROM Revocations)", (cert_id,))
         employee = cursor.fetchone()
 
         if not employee:
@@ -56,7 +85,7 @@ def checkin():
         print(f"Found employee: {employee_name} (ID: {employee_id})")
 
         # Process regular check-in
-        success = process_checkin(cursor, employee_id, session_id)
+        success = process_checkin(cursor, employee_id, session_id, checkin_time)
         
         if success:
             conn.commit()
@@ -82,14 +111,94 @@ def checkin():
             'message': 'Server error'
         }), 500
 
-def process_checkin(cursor, employee_id, session_id):
+@app.route('/checkin/batch', methods=['POST'])
+def checkin_batch():
+    """
+    Check-ins a sensor collected over a short window, as
+    {"events": [[cert_id, timestamp], ...]}. Every event gets its own result,
+    in order, and the whole batch goes to the database in one transaction.
+    """
+    conn = None
+    try:
+        data = request.get_json()
+        events = data.get("events") if data else None
+        if not isinstance(events, list):
+            return jsonify({
+                'success': False,
+                'message': 'Missing events'
+            }), 400
+
+        session_id = data.get('session_id', 1)
+
+        conn = get_db_connection()
+        # Transactions are managed by hand so each event can have a savepoint
+        conn.isolation_level = None
+        cursor = conn.cursor()
+        cursor.execute("BEGIN")
+
+        results = []
+        for event in events:
+            # A bad event would fail the whole batch, and the sensor would
+            # send it again forever
+            try:
+                cert_id, timestamp = event[0], event[1]
+                if not isinstance(cert_id, str) or isinstance(timestamp, bool):
+                    raise TypeError
+                checkin_time = datetime.fromtimestamp(timestamp) if timestamp else datetime.now()
+            except (TypeError, ValueError, OverflowError, OSError, IndexError, KeyError):
+                results.append({'success': False, 'message': 'Malformed event'})
+                continue
+
+            cursor.execute("SELECT Employees.EmployeeID, Name FROM cert INNER JOIN Employees ON cert.EmployeeID = Employees.EmployeeID where cert.id = ? AND cert.id NOT IN (SELECT id FROM Revocations)", (cert_id,))
+            employee = cursor.fetchone()
+            if not employee:
+                results.append({'success': False, 'message': 'Invalid token'})
+                continue
+
+            # One bad event must not undo the others
+            cursor.execute("SAVEPOINT event")
+            if process_checkin(cursor, employee['EmployeeID'], session_id, checkin_time):
+                cursor.execute("RELEASE event")
+                results.append({
+                    'success': True,
+                    'employee_name': employee['Name']
+                })
+            else:
+                cursor.execute("ROLLBACK TO event")
+                cursor.execute("RELEASE event")
+                # Not a verdict on the cert, the sensor sends it again later
+                results.append({
+                    'success': False,
+                    'retry': True,
+                    'message': 'Check-in processing failed'
+                })
+
+        cursor.execute("COMMIT")
+        print(f"Processed batch of {len(events)} check-ins")
+        return jsonify({'success': True, 'results': results}), 200
+
+    except Exception as e:
+        print(f"Error processing check-in batch: {str(e)}")
+        return jsonify({
+            'success': False,
+            'message': 'Server error'
+        }), 500
+    finally:
+        if conn is not None:
+            # Nothing of a batch that failed half way is kept
+            if conn.in_transaction:
+                conn.rollback()
+            conn.close()
+
+def process_checkin(cursor, employee_id, session_id, current_datetime=None):
     """
     Process check-in logic:
     - If no check-in today: create new record with FirstCheckinTime
     - If already checked in today: update LastCheckinTime
     """
     try:
-        current_datetime = datetime.now()
+        if current_datetime is None:
+            current_datetime = datetime.now()
         current_date = current_datetime.date()
         
         print(f"Processing check-in for employee {employee_id} on {current_date}")
@@ -241,7 +350,7 @@ def sign_cert():
     conn = get_db_connection()
     cursor = conn.cursor()
     cursor.execute("""
-        SELECT id, pub_key, valid_until, token, issued 
+        SELECT id, pub_key, valid_until, token, issued, EmployeeID
         FROM cert
         where id = ?
     """, (id,))
@@ -262,14 +371,25 @@ def sign_cert():
             "success": False,
             }), 303
 
-    
-    valid_until = datetime.now(timezone.utc)
+    # a SEC1 point, 65 bytes or 33 compressed; sensors read either
+    try:
+        pub_bytes = bytes.fromhex(pub_key)
+    except (TypeError, ValueError):
+        pub_bytes = b""
+    if len(pub_bytes) == 0 or ecdsa.point_len(pub_bytes[0]) != len(pub_bytes):
+        print(f"cannot sign cert invalid pub_key")
+        return jsonify({
+            "success": False,
+            }), 303
+
+    valid_until = datetime.now(timezone.utc) + CERT_VALIDITY
     cursor.execute("update cert set issued = 1, pub_key = ?, valid_until = ? where id = ?", (pub_key, valid_until, id))
+    cursor.execute("INSERT INTO DirectoryLog (id, EmployeeID) VALUES (?, ?)", (id, user["EmployeeID"]))
     conn.commit()
     conn.close()
 
     valid_until_string = valid_until.strftime("%Y-%m-%d %H:%M:%S")
-    cert_bytes = ecdsa.cert_bytes(id, bytes.fromhex(pub_key), valid_until_string)
+    cert_bytes = ecdsa.cert_bytes(id, pub_bytes, valid_until_string)
     print(cert_bytes)
     
     signature = ecdsa.sign(ca_private_key, cert_bytes)
@@ -282,6 +402,101 @@ def sign_cert():
         'ca_pub': ca_public_bytes.hex().upper()
     }), 200
 
+@app.route('/revoked', methods=['GET'])
+def get_revoked():
+    """
+    The revoked cert ids for sensors, as {"version": n, "ids": [...]}.
+    A sensor sends the version it has as ?since= and gets 304 if nothing was
+    revoked after it, or 507 if the list outgrew what a sensor can hold.
+    """
+    since = request.args.get('since', type=int)
+    conn = get_db_connection()
+    cursor = conn.cursor()
+    cursor.execute("SELECT COALESCE(MAX(RevocationID), 0) AS version FROM Revocations")
+    version = cursor.fetchone()['version']
+    if since == version:
+        conn.close()
+        return '', 304
+
+    cursor.execute("SELECT id FROM Revocations ORDER BY id")
+    ids = [row['id'] for row in cursor.fetchall()]
+    conn.close()
+    # A sensor keeps its previous list rather than a cut one, so say so
+    # instead of sending more than it can hold
+    if len(ids) > SENSOR_REVOCATION_MAX:
+        return jsonify({
+            'success': False,
+            'message': f'{len(ids)} revoked ids, sensors hold {SENSOR_REVOCATION_MAX}'
+        }), 507
+    return jsonify({'version': version, 'ids': ids}), 200
+
+@app.route('/revoke', methods=['POST'])
+def revoke():
+    """Revoke a cert id, e.g. of a lost phone; sensors pick it up on their next sync"""
+    data = request.get_json()
+    cert_id = data.get("id") if data else None
+    if not isinstance(cert_id, str) or len(cert_id) != 6:
+        return jsonify({
+            'success': False,
+            'message': 'Invalid id'
+        }), 400
+
+    conn = get_db_connection()
+    cursor = conn.cursor()
+    cursor.execute("INSERT OR IGNORE INTO Revocations (id) VALUES (?)", (cert_id,))
+    if cursor.rowcount == 1:
+        cursor.execute("INSERT INTO DirectoryLog (id, EmployeeID) VALUES (?, NULL)", (cert_id,))
+    conn.commit()
+    cursor.execute("SELECT COALESCE(MAX(RevocationID), 0) AS version FROM Revocations")
+    version = cursor.fetchone()['version']
+    conn.close()
+    return jsonify({'success': True, 'version': version}), 200
+
+@app.route('/directory', methods=['GET'])
+def get_directory():
+    """
+    Active cert ids and their employees for sensors to judge check-ins
+    locally. Without ?since= (or from a version this server never had) the
+    reply is a snapshot of every active cert:
+        {"version": n, "snapshot": true, "add": [[id, employee_id], ...], "remove": []}
+    With ?since=<version> it is only what changed after it, or 304 if
+    nothing did. A delta bigger than the snapshot is sent as the snapshot.
+    """
+    since = request.args.get('since', type=int)
+    conn = get_db_connection()
+    cursor = conn.cursor()
+    cursor.execute("SELECT COALESCE(MAX(LogID), 0) AS version FROM DirectoryLog")
+    version = cursor.fetchone()['version']
+    if since is not None and since == version:
+        conn.close()
+        return '', 304
+
+    cursor.execute("""
+        SELECT cert.id, cert.EmployeeID FROM cert
+        INNER JOIN Employees ON cert.EmployeeID = Employees.EmployeeID
+        WHERE cert.issued = 1 AND cert.id NOT IN (SELECT id FROM Revocations)
+        ORDER BY cert.id
+    """)
+    active = [[row['id'], row['EmployeeID']] for row in cursor.fetchall()]
+
+    if since is not None and since < version:
+        cursor.execute("SELECT id, EmployeeID FROM DirectoryLog WHERE LogID > ? ORDER BY LogID", (since,))
+        # Only the last change of each id matters
+        changes = {}
+        for row in cursor.fetchall():
+            changes[row['id']] = row['EmployeeID']
+        if len(changes) <= len(active):
+            conn.close()
+            return jsonify({
+                'version': version,
+                'snapshot': False,
+                'add': [[cert_id, employee_id] for cert_id, employee_id in changes.items() if employee_id is not None],
+                'remove': [cert_id for cert_id, employee_id in changes.items() if employee_id is None]
+            }), 200
+
+    conn.close()
+    return jsonify({'version': version, 'snapshot': True, 'add': active, 'remove': []}), 200
+
 @app.route('/api/attendance_pie')
 def attendance_pie():
     from datetime import date